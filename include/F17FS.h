@@ -36,6 +36,79 @@ typedef struct {
     file_t type;
 } file_record_t;
 
+// A directory being listed with fs_readdir, see fs_opendir
+typedef struct {
+    int handle;                 // the directory handle the listing holds
+    uint64_t cursor;            // where the next fs_readdir carries on, 0 for the start. A cursor kept from
+                                //  a listing resumes it in a later one of the same directory
+} fs_dir_t;
+
+// How the image file is accessed, see block_store_backend_t
+typedef enum {
+    FS_BACKEND_MMAP,    // mapped, the kernel pages and writes back (default)
+    FS_BACKEND_PREAD,   // pread/pwrite through the page cache
+    FS_BACKEND_DIRECT,  // O_DIRECT, bypasses the page cache
+    FS_BACKEND_URING    // io_uring batches, falls back to FS_BACKEND_PREAD where io_uring is unavailable
+} fs_backend_t;
+
+// Mount time options; a zeroed struct gives the defaults
+typedef struct {
+    fs_backend_t backend;
+    unsigned queue_depth;   // FS_BACKEND_URING: I/Os in flight (1 - 256), 0 for the default
+    bool flusher;               // write dirty blocks back from a background thread while mounted
+    size_t flush_dirty_bytes;   // flusher: sync once this much is dirty, 0 for the default (4 MB)
+    unsigned flush_max_age_ms;  // flusher: sync once the oldest change is this old, 0 for the default (1000 ms)
+    bool readahead;             // prefetch ahead of sequential fs_read calls, for when the kernel's own
+                                //  readahead of the image falls short (small device readahead, cold index tables)
+    bool map_populate;          // FS_BACKEND_MMAP: fault the whole image in at mount instead of on first touch
+    bool map_hugepages;         // FS_BACKEND_MMAP: ask for transparent huge pages for the mapping (a hint)
+    bool map_lock;              // FS_BACKEND_MMAP: mlock the image, mounting fails if it can't be locked
+    size_t blocks;              // fs_format_with: image size in blocks, up to 2^32 and making the image a multiple
+                                //  of 32 MB (0 for 65536). Images over 65536 blocks use 32-bit block ids, which
+                                //  halves the index fanout; mounting tells the format from the size
+    size_t block_size;          // fs_format_with: bytes per block, a power of two from 512 to 65536 (0 for 512).
+                                //  Index fanout and the largest file grow with it: 33 MB with 512-byte blocks, about
+                                //  4 GB with 4 KB ones (the image permitting). It's recorded in the image, mounting ignores this
+} fs_options_t;
+
+// Access hints for fs_advise, like posix_fadvise's
+typedef enum {
+    FS_ADVICE_NORMAL,       // back to the defaults for the descriptor
+    FS_ADVICE_SEQUENTIAL,   // the descriptor reads in order: read ahead aggressively
+    FS_ADVICE_RANDOM,       // the descriptor reads in no order: don't read ahead
+    FS_ADVICE_WILLNEED,     // the range is about to be read: start reading it now
+    FS_ADVICE_DONTNEED,     // the range isn't needed again soon: drop it from the cache
+    FS_ADVICE_NOREUSE       // the descriptor touches its data once: drop what it has read or written behind it
+} fs_advice_t;
+
+// Background flusher counters, see fs_get_flush_stats
+typedef struct {
+    size_t flushes;             // syncs run by the flusher
+    size_t flushed_blocks;      // dirty blocks they wrote
+    size_t failures;            // syncs that failed
+    uint64_t flush_ns_total;    // time spent syncing
+    uint64_t flush_ns_max;      // the longest sync
+} fs_flush_stats_t;
+
+// Feature bits of an image, recorded in its superblock (see fs_info_t.features)
+#define FS_FEATURE_WIDE_IDS 0x1     // 32-bit block ids in inodes and index tables, images over 65536 blocks
+#define FS_FEATURE_INODE_FILE 0x2   // more than 256 inodes, the rest in an inode file
+#define FS_FEATURE_HASHED_DIRS 0x4  // directories of more than 7 entries, with a hashed index
+
+// Geometry and state of a mounted F17FS, see fs_get_info
+typedef struct {
+    size_t block_size;          // bytes per block
+    size_t blocks;              // blocks in the image, the free block map's included
+    size_t free_blocks;
+    size_t inodes;              // the 256 of the inode table and those of the inode file, which
+                                //  grows as fs_create needs more
+    size_t free_inodes;
+    uint32_t features;          // FS_FEATURE_* bits
+    bool mounted_clean;         // the image had been unmounted cleanly, so mounting trusted its cached
+                                //  counts instead of recounting
+    size_t mount_count;         // mounts since the image was formatted (the format's included)
+} fs_info_t;
+
 ///
 /// Formats (and mounts) an F17FS file for use
 /// \param fname The file to format
@@ -52,6 +125,22 @@ F17FS_t *fs_format(const char *path);
 ///
 F17FS_t *fs_mount(const char *path);
 
+///
+/// fs_format with options
+/// \param path The file to format
+/// \param options Mount options, NULL for the defaults
+/// \return Mounted F17FS object, NULL on error
+///
+F17FS_t *fs_format_with(const char *path, const fs_options_t *options);
+
+///
+/// fs_mount with options
+/// \param path The file to mount
+/// \param options Mount options, NULL for the defaults
+/// \return Mounted F17FS object, NULL on error
+///
+F17FS_t *fs_mount_with(const char *path, const fs_options_t *options);
+
 ///
 /// Unmounts the given object and frees all related resources
 /// \param fs The F17FS object to unmount
@@ -59,19 +148,6 @@ F17FS_t *fs_mount(const char *path);
 ///
 int fs_unmount(F17FS_t *fs);
 
-// search if the absolute path leading to the directory exists
-// \param fs F17FS File system containing the file
-// \param dirPath Absolute path of the directory
-// return the inode number of the directory,  SIZE_MAX on error
-//size_t searchPath(F17FS_t *fs, char *dirPath);
-
-// check if the file already exists under the designated directory, if so, get the file's inode number
-// \param fs F17FS containing the file
-// \param dirInodeID The inode number of the directory
-// \param filename Name of the file to look for
-// return the file's inode number if the file is already created (exists), or 0 otherwise
-//size_t getFileInodeID(F17FS_t *fs, size_t dirInodeID, char *filename);
-
 ///
 /// Creates a new file at the specified location
 ///   Directories along the path that do not exist are not created
@@ -82,6 +158,16 @@ int fs_unmount(F17FS_t *fs);
 ///
 int fs_create(F17FS_t *fs, const char *path, file_t type);
 
+///
+/// Creates a new file, fs_create with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the file to create, relative to the directory
+/// \param type Type of file to create (regular/directory)
+/// \return 0 on success, < 0 on failure
+///
+int fs_createat(F17FS_t *fs, int dirfd, const char *path, file_t type);
+
 ///
 /// Opens the specified file for use
 ///   R/W position is set to the beginning of the file (BOF)
@@ -92,6 +178,15 @@ int fs_create(F17FS_t *fs, const char *path, file_t type);
 ///
 int fs_open(F17FS_t *fs, const char *path);
 
+///
+/// Opens a file, fs_open with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the requested file, relative to the directory
+/// \return file descriptor to the requested file, < 0 on error
+///
+int fs_openat(F17FS_t *fs, int dirfd, const char *path);
+
 ///
 /// Closes the given file descriptor
 /// \param fs The F17FS containing the file
@@ -100,6 +195,23 @@ int fs_open(F17FS_t *fs, const char *path);
 ///
 int fs_close(F17FS_t *fs, int fd);
 
+///
+/// Opens a directory as a handle for the *at calls, which look relative paths up from it
+///   The handle stays with the directory when it is moved, and is closed when it is removed
+/// \param fs The F17FS containing the directory
+/// \param path Absolute path to the directory
+/// \return directory handle, < 0 on error
+///
+int fs_opendir_handle(F17FS_t *fs, const char *path);
+
+///
+/// Closes a directory handle
+/// \param fs The F17FS containing the directory
+/// \param dirfd The handle to close
+/// \return 0 on success, < 0 on failure
+///
+int fs_closedir_handle(F17FS_t *fs, int dirfd);
+
 ///
 /// Moves the R/W position of the given descriptor to the given location
 ///   Files cannot be seeked past EOF or before BOF (beginning of file)
@@ -137,6 +249,51 @@ ssize_t fs_read(F17FS_t *fs, int fd, void *dst, size_t nbyte);
 ///
 ssize_t fs_write(F17FS_t *fs, int fd, const void *src, size_t nbyte);
 
+///
+/// Gets every change made to the file system onto the disk
+/// \param fs The F17FS to sync
+/// \return 0 on success, < 0 on error
+///
+int fs_sync(F17FS_t *fs);
+
+///
+/// Gets the changes to one file onto the disk: its data and index blocks, its inode and the
+///   allocation bitmaps. Other files' changes may stay behind
+/// \param fs The F17FS containing the file
+/// \param fd The file to sync
+/// \return 0 on success, < 0 on error
+///
+int fs_fsync(F17FS_t *fs, int fd);
+
+///
+/// Gives a hint about how a file will be accessed. SEQUENTIAL, RANDOM and NOREUSE stay with the
+///   descriptor until NORMAL (or another of the three); SEQUENTIAL and RANDOM are also passed on for the
+///   file's blocks when the image is mapped. WILLNEED and DONTNEED act on the range right away
+/// \param fs The F17FS containing the file
+/// \param fd The file
+/// \param offset Start of the range
+/// \param len Length of the range, 0 for up to the end of the file
+/// \param advice The hint
+/// \return 0 on success, < 0 on error
+///
+int fs_advise(F17FS_t *fs, int fd, off_t offset, size_t len, fs_advice_t advice);
+
+///
+/// Reads the background flusher's counters (all zero when it was never started)
+/// \param fs The F17FS
+/// \param stats Receives the counters
+/// \return 0 on success, < 0 on error
+///
+int fs_get_flush_stats(F17FS_t *fs, fs_flush_stats_t *stats);
+
+///
+/// Reads the geometry and counts of the file system
+/// \param fs The F17FS
+/// \param info Receives them
+/// \return 0 on success, < 0 on error
+///
+int fs_get_info(F17FS_t *fs, fs_info_t *info);
+
 ///
 /// Deletes the specified file and closes all open descriptors to the file
 ///   Directories can only be removed when empty
@@ -146,15 +303,63 @@ ssize_t fs_write(F17FS_t *fs, int fd, const void *src, size_t nbyte);
 ///
 int fs_remove(F17FS_t *fs, const char *path);
 
+///
+/// Deletes a file, fs_remove with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the file to remove, relative to the directory
+/// \return 0 on success, < 0 on error
+///
+int fs_removeat(F17FS_t *fs, int dirfd, const char *path);
+
 ///
 /// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 15 file_record_t structures
+///   Array contains a file_record_t per entry
 /// \param fs The F17FS containing the file
 /// \param path Absolute path to the directory to inspect
 /// \return dyn_array of file records, NULL on error
 ///
 dyn_array_t *fs_get_dir(F17FS_t *fs, const char *path);
 
+///
+/// Lists a directory, fs_get_dir with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the directory to inspect, relative to the directory; "" for the directory itself
+/// \return dyn_array of file records, NULL on error
+///
+dyn_array_t *fs_get_dirat(F17FS_t *fs, int dirfd, const char *path);
+
+///
+/// Opens a directory to be listed with fs_readdir, from the start
+///   The listing holds a directory handle (see fs_opendir_handle) until fs_closedir
+/// \param fs The F17FS containing the directory
+/// \param path Absolute path to the directory
+/// \param dir Receives the listing
+/// \return 0 on success, < 0 on error
+///
+int fs_opendir(F17FS_t *fs, const char *path, fs_dir_t *dir);
+
+///
+/// Lists the next entries of a directory into the caller's records, with no allocation and without reading
+///   the entries' inodes. Entries come in hash order; those added or removed meanwhile may or may not be
+///   listed, the others are listed once
+/// \param fs The F17FS containing the directory
+/// \param dir The listing, its cursor moves past the entries listed
+/// \param records Receives the entries
+/// \param count The number of records there's room for
+/// \return number of records filled, 0 at the end of the directory, < 0 on error
+///
+ssize_t fs_readdir(F17FS_t *fs, fs_dir_t *dir, file_record_t *records, size_t count);
+
+///
+/// Ends a listing, closing its directory handle
+/// \param fs The F17FS containing the directory
+/// \param dir The listing
+/// \return 0 on success, < 0 on error
+///
+int fs_closedir(F17FS_t *fs, fs_dir_t *dir);
+
 /// Moves the file from one location to the other
 ///   Moving files does not affect open descriptors
 /// \param fs The F17FS containing the file
@@ -66,6 +66,22 @@ size_t bitmap_ffs(const bitmap_t *const bitmap);
 ///
 size_t bitmap_ffz(const bitmap_t *const bitmap);
 
+///
+/// Find first set at or after the given bit
+/// \param bitmap The bitmap
+/// \param start The first bit to consider
+/// \return The first one bit address >= start, SIZE_MAX on error/not found
+///
+size_t bitmap_ffs_from(const bitmap_t *const bitmap, const size_t start);
+
+///
+/// Find first zero at or after the given bit
+/// \param bitmap The bitmap
+/// \param start The first bit to consider
+/// \return The first zero bit address >= start, SIZE_MAX on error/not found
+///
+size_t bitmap_ffz_from(const bitmap_t *const bitmap, const size_t start);
+
 ///
 /// Count all bits set
 /// \param bitmap the bitmap
@@ -90,6 +106,34 @@ void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *),
 ///
 void bitmap_format(bitmap_t *const bitmap, const uint8_t pattern);
 
+///
+/// Sets up in-memory summary levels for the bitmap: one bit per 64-bit word, set when that word
+///  has a zero bit, then one bit per word of that level, and so on up to a single word.
+///  Zero searches (bitmap_ffz, bitmap_ffz_from) then take a word per level instead of a scan, however
+///  big or full the map. The levels are built by bitmap_build_summary, not here (searches scan the
+///  map until then), and kept up to date by the bitmap functions from then on, so writing to
+///  overlaid data behind the bitmap's back requires calling both again.
+/// \param bitmap The bitmap
+/// \return true on success, false on error (allocation failure)
+///
+bool bitmap_enable_summary(bitmap_t *const bitmap);
+
+///
+/// Like bitmap_enable_summary, but the levels track set bits and speed up set searches
+///  (bitmap_ffs, bitmap_ffs_from) instead, for sparse maps. Replaces a zero summary
+/// \param bitmap The bitmap
+/// \return true on success, false on error (allocation failure)
+///
+bool bitmap_enable_set_summary(bitmap_t *const bitmap);
+
+///
+/// Builds the summary levels set up by bitmap_enable_summary or bitmap_enable_set_summary, if they
+///  aren't built yet. Searches never build them, so they don't modify the bitmap and can run
+///  concurrently with each other; call this before the searches that should use the levels
+/// \param bitmap The bitmap
+///
+void bitmap_build_summary(bitmap_t *const bitmap);
+
 ///
 /// Gets total number of bits in bitmap
 /// \param bitmap The bitmap
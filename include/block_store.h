@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/mman.h>
 
 // Declaring the struct but not implementing in the header allows us to prevent users
@@ -15,6 +16,69 @@ extern "C" {
 // This enforces a black box device, but it can be restricting
 typedef struct block_store block_store_t;
 
+// How the image file is accessed
+typedef enum {
+    BLOCK_STORE_MMAP,   // the whole image mapped MAP_SHARED, the kernel decides paging and writeback (default)
+    BLOCK_STORE_PREAD,  // pread/pwrite through the page cache; the FBM and pinned views are kept in memory
+    BLOCK_STORE_DIRECT, // like BLOCK_STORE_PREAD, but O_DIRECT through aligned buffers, bypassing the page cache
+    BLOCK_STORE_URING   // like BLOCK_STORE_PREAD, but batches go through io_uring with registered buffers;
+                        //  falls back to BLOCK_STORE_PREAD when io_uring can't be set up
+} block_store_backend_t;
+
+typedef struct {
+    block_store_backend_t backend;
+    bool extents;           // start with the free extent tree enabled, see block_store_enable_extents
+    unsigned queue_depth;   // BLOCK_STORE_URING: pieces in flight (1 - 256), 0 for the default (32)
+    bool populate;          // BLOCK_STORE_MMAP: fault the whole image in at open instead of on first touch
+    bool hugepages;         // BLOCK_STORE_MMAP: align the mapping and ask for transparent huge pages (a hint,
+                            //  the kernel and file system may keep using 4 KB pages)
+    bool lock;              // BLOCK_STORE_MMAP: mlock the image, opening fails if it can't be locked
+    size_t blocks;          // block_store_create_with: image size in blocks, up to 2^32 and making the image
+                            //  a multiple of 32 MB (0 for 65536). Opening takes it from the file's size instead
+    size_t block_size;      // bytes per block, a power of two from 512 to 65536 (0 for 512). Nothing in the image
+                            //  records it, opening has to be given the size the image was created with
+    size_t used_blocks;     // opening: the block_store_get_used_blocks count from when the image was last closed,
+                            //  trusted instead of recounting the FBM (0 to recount). Only pass a count known to
+                            //  be current, e.g. one saved at a clean shutdown
+    size_t alloc_cursor;    // opening: where block_store_allocate resumes, see block_store_get_alloc_cursor
+} block_store_options_t;
+
+// Access hints for block_store_advise, in the order of the madvise ones they map to
+typedef enum {
+    BLOCK_STORE_ADVICE_NORMAL,
+    BLOCK_STORE_ADVICE_SEQUENTIAL,  // read in order: more readahead (mmap only)
+    BLOCK_STORE_ADVICE_RANDOM,      // read in no order: no readahead (mmap only)
+    BLOCK_STORE_ADVICE_WILLNEED,    // about to be read: start reading now
+    BLOCK_STORE_ADVICE_DONTNEED     // not needed again soon: evict from the page cache
+} block_store_advice_t;
+
+// When the background flusher (block_store_start_flusher) syncs; zeroed fields give the defaults
+typedef struct {
+    size_t dirty_bytes;     // once this much is dirty (default 4 MB)
+    unsigned max_age_ms;    // once the oldest change is this old (default 1000 ms)
+} block_store_flusher_options_t;
+
+// What the background flusher has done
+typedef struct {
+    size_t flushes;             // syncs it ran
+    size_t flushed_blocks;      // dirty blocks they wrote
+    size_t failures;            // syncs that failed, the blocks stay dirty
+    uint64_t flush_ns_total;    // time spent in the syncs
+    uint64_t flush_ns_max;      // the longest one
+} block_store_flush_stats_t;
+
+// One piece of a vectored transfer: length bytes at offset within block_id, to/from buffer
+//  (block_store_writev only reads from it, so it takes a const pointer too, as source)
+typedef struct {
+    size_t block_id;
+    size_t offset;
+    size_t length;
+    union {
+        void *buffer;       // where block_store_readv puts the bytes
+        const void *source; // where block_store_writev takes them from, either member will do
+    };
+} block_store_segment_t;
+
 ///
 /// This creates a new BS device, ready to go
 /// \return Pointer to a new block storage device, NULL on error
@@ -37,11 +101,64 @@ block_store_t *block_store_create(const char *const fname);
 /////
 block_store_t *block_store_open(const char *const fname);
 
+///
+/// block_store_create with options (a zeroed options struct gives the defaults)
+/// \param fname the file to create
+/// \param options Backend and allocator options, NULL for the defaults
+/// \return a pointer to the new object, NULL on error (including a backend the file system can't do)
+///
+block_store_t *block_store_create_with(const char *const fname, const block_store_options_t *const options);
+
+///
+/// block_store_open with options (a zeroed options struct gives the defaults)
+/// \param fname the file to open
+/// \param options Backend and allocator options, NULL for the defaults
+/// \return a pointer to the new object, NULL on error
+///
+block_store_t *block_store_open_with(const char *const fname, const block_store_options_t *const options);
+
+///
+/// The backend in use, which differs from the one asked for after a fallback
+/// \param bs BS device
+/// \return The backend, BLOCK_STORE_MMAP on error
+///
+block_store_backend_t block_store_get_backend(const block_store_t *const bs);
+
 block_store_t *block_store_inode_create(void *const BM_start_pos, void *const data_start_pos);
 
+///
+/// Tells an inode sub store which blocks of which store its bitmap and records live in, so that
+///  allocations and block_store_inode_write through the sub store dirty those blocks in the parent
+/// \param bs The inode sub store
+/// \param parent The store the sub store's memory belongs to
+/// \param map_block Block holding the sub store's bitmap
+/// \param table_block First block of the sub store's records
+///
+void block_store_inode_track(block_store_t *const bs, block_store_t *const parent, const size_t map_block, const size_t table_block);
+
 block_store_t *block_store_fd_create();
+// Start of the mapped image, NULL unless the backend is BLOCK_STORE_MMAP (see block_store_view_range_mut)
 uint8_t * block_store_Data_location(block_store_t *const bs);
 
+///
+/// Starts keeping a tree of the free extents (start, length), built from the free block map now
+///  and kept in sync by every allocate/request/release afterwards.
+///  With it, block_store_allocate_run is best fit (the smallest free run that is long enough)
+///  and run lengths are looked up instead of scanned for.
+///  Should keeping it in sync run out of memory, the tree is dropped and allocation goes back to the bitmap.
+/// \param bs BS device
+/// \return true on success, false on error
+///
+bool block_store_enable_extents(block_store_t *const bs);
+
+///
+/// Counts the maximal runs of free blocks (a fragmentation measure)
+///  O(1) with the extent tree enabled, a bitmap walk otherwise
+/// \param bs BS device
+/// \return Number of free runs, SIZE_MAX on error
+///
+size_t block_store_get_free_extents(const block_store_t *const bs);
+
 ///
 /// Destroys the provided block storage device
 /// This is an idempotent operation, so there is no return value
@@ -59,6 +176,38 @@ void block_store_fd_destroy(block_store_t *const bs);
 ///
 size_t block_store_allocate(block_store_t *const bs);
 
+///
+/// Searches for a free block at or after the hint (wrapping around), marks it as in use,
+///  and returns the block's id. Used to keep related blocks (data next to its index table) together
+/// \param bs BS device
+/// \param hint The block id to start looking from
+/// \return Allocated block's id, SIZE_MAX on error
+///
+size_t block_store_allocate_near(block_store_t *const bs, const size_t hint);
+
+///
+/// Allocates a run of contiguous free blocks, up to want blocks long
+///  The run is the first free stretch found from the allocation cursor, so it may be shorter than want;
+///  call again for the rest
+/// \param bs BS device
+/// \param want The number of blocks wanted
+/// \param start Set to the first block id of the run
+/// \param got Set to the number of blocks in the run (1 to want)
+/// \return true if a run was allocated, false when out of space or on error
+///
+bool block_store_allocate_run(block_store_t *const bs, const size_t want, size_t *const start, size_t *const got);
+
+///
+/// Same as block_store_allocate_run, but searches from the hint instead of the allocation cursor
+/// \param bs BS device
+/// \param hint The block id to start looking from
+/// \param want The number of blocks wanted
+/// \param start Set to the first block id of the run
+/// \param got Set to the number of blocks in the run (1 to want)
+/// \return true if a run was allocated, false when out of space or on error
+///
+bool block_store_allocate_run_near(block_store_t *const bs, const size_t hint, const size_t want, size_t *const start, size_t *const got);
+
 size_t block_store_sub_allocate(block_store_t *const bs);
 
 
@@ -109,11 +258,55 @@ size_t block_store_get_used_blocks(const block_store_t *const bs);
 size_t block_store_get_free_blocks(const block_store_t *const bs);
 
 ///
-/// Returns the total number of user-addressable blocks
-///  (since this is constant, you don't even need the bs object)
+/// Recounts the blocks in use straight from the free block map
+///  (the two getters above return counters that are kept up to date incrementally;
+///   this is the slow path, for checking them)
+/// \param bs BS device
+/// \return Total blocks in use, SIZE_MAX on error
+///
+size_t block_store_count_used_blocks(const block_store_t *const bs);
+
+///
+/// Returns where block_store_allocate's next-fit search resumes, to be handed back
+///  through block_store_options_t.alloc_cursor when the image is opened again
+/// \param bs BS device
+/// \return The block id the next search starts at, 0 on error
+///
+size_t block_store_get_alloc_cursor(const block_store_t *const bs);
+
+///
+/// Deprecated: returns the total number of blocks of a default sized image, whatever the store;
+///  images can have more or fewer blocks now, use block_store_get_block_count
 /// \return Total blocks
 ///
-size_t block_store_get_total_blocks();
+size_t block_store_get_total_blocks() __attribute__((deprecated("use block_store_get_block_count")));
+
+///
+/// Returns the number of blocks in the image, the FBM's own included. The FBM takes the last
+///  blocks, as many as it takes to hold a bit per block (1 in 4096 with 512-byte blocks);
+///  block ids below those are addressable
+/// \param bs BS device
+/// \return Total blocks, 0 on error
+///
+size_t block_store_get_block_count(const block_store_t *const bs);
+
+///
+/// Returns the number of bytes in a block of the image
+/// \param bs BS device
+/// \return Block size, 0 on error
+///
+size_t block_store_get_block_size(const block_store_t *const bs);
+
+///
+/// Reads bytes straight from an image file that isn't open, for a header saying how to open it
+///  (its block size, say) that its owner keeps at a fixed byte offset
+/// \param fname The image file
+/// \param offset Byte offset in the file
+/// \param buffer Data buffer to write to
+/// \param bytes Number of bytes to read
+/// \return Number of bytes read, 0 on error (a short file included)
+///
+size_t block_store_peek(const char *const fname, const size_t offset, void *buffer, const size_t bytes);
 
 ///
 /// Reads data from the specified block and writes it to the designated buffer
@@ -159,9 +352,169 @@ size_t block_store_write(block_store_t *const bs, const size_t block_id, const v
 ///
 size_t block_store_n_write(block_store_t *const bs, const size_t block_id, size_t offset, const void *buffer, size_t bytes);
 
+///
+/// Reads a list of segments, each one a block_store_n_read
+///  Segments that continue each other both in the image (next offset in the same block, or the
+///  start of the next block) and in memory are merged and copied in one go
+/// \param bs BS device
+/// \param segments The segments to read
+/// \param count Number of segments
+/// \return Number of bytes read; stops at the first invalid segment, 0 on error
+///
+size_t block_store_readv(const block_store_t *const bs, const block_store_segment_t *segments, const size_t count);
+
+///
+/// Writes a list of segments, each one a block_store_n_write, merged like block_store_readv
+/// \param bs BS device
+/// \param segments The segments to write
+/// \param count Number of segments
+/// \return Number of bytes written; stops at the first invalid segment, 0 on error
+///
+size_t block_store_writev(block_store_t *const bs, const block_store_segment_t *segments, const size_t count);
+
 size_t block_store_inode_write(block_store_t *const bs, const size_t block_id, const void *buffer);
 size_t block_store_fd_write(block_store_t *const bs, const size_t block_id, const void *buffer);
 
+///
+/// Pins a block and returns a read-only view of it
+///  With the mmap backend this points straight into the image (no copy); the other backends read
+///  the block into a buffer shared by every view of it, which block_store_read/write keep coherent
+///  The view stays valid until block_store_unpin; every view must be unpinned
+/// \param bs BS device
+/// \param block_id Block to view
+/// \return Pointer to the block's contents, NULL on error
+///
+const void *block_store_view(block_store_t *const bs, const size_t block_id);
+
+///
+/// Same as block_store_view, but the view is writable and the block is marked dirty
+///  Without the mmap backend, changes reach the image when the last pin is dropped.
+///  A sync can run between the pin and the writes through the view: unpin with block_store_unpin_mut,
+///  which marks the block dirty again once they are done
+/// \param bs BS device
+/// \param block_id Block to view
+/// \return Pointer to the block's contents, NULL on error
+///
+void *block_store_view_mut(block_store_t *const bs, const size_t block_id);
+
+///
+/// Same as block_store_view_mut for count consecutive blocks, as one contiguous buffer
+///  Fails if the range partly overlaps a view already pinned; views of single blocks
+///  inside a pinned range share it. Unpin with any block id in the range
+/// \param bs BS device
+/// \param first First block to view
+/// \param count Number of blocks
+/// \return Pointer to the blocks' contents, NULL on error
+///
+void *block_store_view_range_mut(block_store_t *const bs, const size_t first, const size_t count);
+
+///
+/// Releases a view taken by block_store_view/block_store_view_mut
+/// \param bs BS device
+/// \param block_id The viewed block
+///
+void block_store_unpin(block_store_t *const bs, const size_t block_id);
+
+///
+/// Releases a view taken by block_store_view_mut/block_store_view_range_mut after writing through it:
+///  the blocks are marked dirty again, so writes made after a sync cleared them still get synced
+/// \param bs BS device
+/// \param first The first viewed block
+/// \param count Number of viewed blocks (1 for block_store_view_mut)
+///
+void block_store_unpin_mut(block_store_t *const bs, const size_t first, const size_t count);
+
+///
+/// Number of views not yet unpinned
+/// \param bs BS device
+/// \return Pinned views, SIZE_MAX on error
+///
+size_t block_store_get_pinned(const block_store_t *const bs);
+
+///
+/// Tests if a block was changed (written, viewed mutably, or its allocation bit flipped)
+///  since the store was opened; allocation changes dirty the FBM block holding the bit
+/// \param bs BS device
+/// \param block_id The block to test
+/// \return true if dirty, false if clean or on error
+///
+bool block_store_is_dirty(const block_store_t *const bs, const size_t block_id);
+
+///
+/// Passes an access hint for blocks [first, first + count) on to the kernel. BLOCK_STORE_MMAP madvises
+///  the pages holding them (DONTNEED evicts them from the page cache as well); BLOCK_STORE_PREAD and
+///  BLOCK_STORE_URING only act on WILLNEED and DONTNEED, since Linux applies the pattern hints to the
+///  whole image; BLOCK_STORE_DIRECT ignores all of them. Pages are shared with neighbouring blocks
+/// \param bs BS device
+/// \param first First block
+/// \param count Number of blocks
+/// \param advice The hint
+/// \return true if the hint was given or the backend has no use for it, false on error
+///
+bool block_store_advise(const block_store_t *const bs, const size_t first, const size_t count, const block_store_advice_t advice);
+
+///
+/// block_store_advise with BLOCK_STORE_ADVICE_WILLNEED: starts reading the blocks without waiting
+/// \param bs BS device
+/// \param first First block
+/// \param count Number of blocks
+/// \return true if the hint was given or the backend has no use for it, false on error
+///
+bool block_store_prefetch(const block_store_t *const bs, const size_t first, const size_t count);
+
+///
+/// Counts the dirty blocks
+/// \param bs BS device
+/// \return Number of dirty blocks, SIZE_MAX on error
+///
+size_t block_store_get_dirty_blocks(const block_store_t *const bs);
+
+///
+/// Writes every dirty block to the disk and marks it clean. With BLOCK_STORE_MMAP that is one
+///  msync(MS_SYNC) per run of dirty blocks; the other backends write the blocks only held in memory
+///  (the FBM, writable pinned views) and fdatasync. A writable view still pinned after the sync
+///  goes unnoticed until it is re-pinned: changes made through it later aren't marked dirty
+/// \param bs BS device
+/// \return true on success, false on error
+///
+bool block_store_sync(block_store_t *const bs);
+
+///
+/// block_store_sync for the given blocks only, plus any dirty FBM block
+/// \param bs BS device
+/// \param ids The blocks, in any order and with duplicates allowed; sorted in place
+/// \param count Number of ids
+/// \return true on success, false on error
+///
+bool block_store_sync_blocks(block_store_t *const bs, size_t *const ids, const size_t count);
+
+///
+/// Starts a thread that runs block_store_sync in the background whenever options->dirty_bytes
+///  are dirty or the oldest change is options->max_age_ms old. While it runs, the store may be used
+///  from one other thread at a time; block_store_destroy stops it
+/// \param bs BS device
+/// \param options Thresholds, NULL for the defaults
+/// \return true on success, false on error (including a flusher already running)
+///
+bool block_store_start_flusher(block_store_t *const bs, const block_store_flusher_options_t *const options);
+
+///
+/// Stops the flusher, waiting for a flush in progress; whatever is still dirty stays dirty
+/// \param bs BS device
+///
+void block_store_stop_flusher(block_store_t *const bs);
+
+///
+/// Copies the flusher's counters, which keep counting across restarts
+/// \param bs BS device
+/// \param stats Receives the counters
+/// \return true on success, false on error
+///
+bool block_store_get_flush_stats(const block_store_t *const bs, block_store_flush_stats_t *const stats);
+
+// Read-only view of a record in the inode sub store, valid as long as the store is
+const void *block_store_inode_view(const block_store_t *const bs, const size_t block_id);
+
 ///
 /// Imports BS device from the given file - for grads/bonus
 /// \param filename The file to load
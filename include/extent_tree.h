@@ -0,0 +1,88 @@
+#ifndef EXTENT_TREE_H__
+#define EXTENT_TREE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A set of disjoint extents (start, length), indexed both by start and by length
+// Adjacent extents are always merged, so the tree holds maximal free runs.
+// Each index is a treap, all operations are O(log n) expected.
+typedef struct extent_tree extent_tree_t;
+
+///
+/// Creates an empty extent tree
+/// \return New extent tree, NULL on error
+///
+extent_tree_t *extent_tree_create(void);
+
+///
+/// Destructs and destroys the extent tree
+/// \param tree The extent tree
+///
+void extent_tree_destroy(extent_tree_t *tree);
+
+///
+/// Adds [start, start + length) to the set, merging it with the extents on either side
+///  The range must not overlap anything already in the set
+/// \param tree The extent tree
+/// \param start First unit of the range
+/// \param length Number of units in the range
+/// \return true on success, false on error (overlap, allocation failure, bad parameters)
+///
+bool extent_tree_insert(extent_tree_t *tree, const size_t start, const size_t length);
+
+///
+/// Removes [start, start + length) from the set, splitting the extent that holds it
+///  The whole range must be inside a single extent
+/// \param tree The extent tree
+/// \param start First unit of the range
+/// \param length Number of units in the range
+/// \return true on success, false on error (range not in the set, allocation failure, bad parameters)
+///
+bool extent_tree_remove(extent_tree_t *tree, const size_t start, const size_t length);
+
+///
+/// Finds the smallest extent at least length long (lowest start on ties)
+///  If there is none, the largest extent is returned instead
+/// \param tree The extent tree
+/// \param length The length wanted
+/// \param start Set to the start of the extent found
+/// \param found_length Set to the full length of the extent found
+/// \return true if an extent was found, false if the set is empty or on error
+///
+bool extent_tree_best_fit(const extent_tree_t *tree, const size_t length, size_t *start, size_t *found_length);
+
+///
+/// Finds the extent containing the given unit
+/// \param tree The extent tree
+/// \param unit The unit to look for
+/// \param start Set to the start of the extent found
+/// \param length Set to the length of the extent found
+/// \return true if unit is in the set, false otherwise
+///
+bool extent_tree_find(const extent_tree_t *tree, const size_t unit, size_t *start, size_t *length);
+
+///
+/// Number of extents in the set (a fragmentation measure)
+/// \param tree The extent tree
+/// \return Number of extents, 0 on error
+///
+size_t extent_tree_count(const extent_tree_t *tree);
+
+///
+/// Total length of all extents in the set
+/// \param tree The extent tree
+/// \return Sum of all extent lengths, 0 on error
+///
+size_t extent_tree_total(const extent_tree_t *tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
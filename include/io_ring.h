@@ -0,0 +1,74 @@
+#ifndef IO_RING_H__
+#define IO_RING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// An io_uring instance with a fixed (registered) file and a registered buffer per queue slot
+// Transfers are cut into IO_RING_SLOT_BYTES pieces, each staged through a slot buffer,
+//  with up to depth pieces in flight at once. Not thread safe.
+typedef struct io_ring io_ring_t;
+
+#define IO_RING_SLOT_BYTES (64 * 1024)
+
+// A transfer of the bytes of iov to/from one contiguous stretch of the file, starting at byte pos
+typedef struct {
+    size_t pos;
+    const struct iovec *iov;
+    int iovcnt;
+} io_ring_run_t;
+
+///
+/// Sets up a ring for the file, registering it and depth slot buffers
+/// \param fd The file all transfers go to
+/// \param depth Queue depth, the number of pieces in flight (1 - 256)
+/// \return New ring, NULL on error or when io_uring is not available
+///
+io_ring_t *io_ring_create(const int fd, const unsigned depth);
+
+///
+/// Tears the ring down, the file stays open
+/// \param ring The ring
+///
+void io_ring_destroy(io_ring_t *ring);
+
+///
+/// Submits every run, keeping up to depth pieces in flight, and waits for all of them
+/// \param ring The ring
+/// \param runs The transfers
+/// \param count Number of runs
+/// \param write true to write iov to the file, false to read into iov
+/// \return Bytes moved before the first piece that failed or came up short, 0 on error
+///
+size_t io_ring_transfer(io_ring_t *ring, const io_ring_run_t *runs, const size_t count, const bool write);
+
+///
+/// Queue depth the ring was set up with
+/// \param ring The ring
+/// \return Queue depth, 0 on error
+///
+unsigned io_ring_depth(const io_ring_t *ring);
+
+///
+/// Copies bytes between a flat buffer and iov, starting skip bytes into iov
+///  (shared with the other block_store backends, which stage iov through a bounce buffer too)
+/// \param iov The scattered side
+/// \param iovcnt Number of iov entries
+/// \param skip Bytes of iov to skip before the copy starts
+/// \param flat The flat side
+/// \param bytes Number of bytes to copy, stops early at the end of iov
+/// \param to_iov true to copy flat into iov, false iov into flat
+///
+void io_ring_iov_copy(const struct iovec *iov, const int iovcnt, size_t skip, uint8_t *flat, size_t bytes, const bool to_iov);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
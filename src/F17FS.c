@@ -3,32 +3,54 @@
 #include "block_store.h"
 #include "F17FS.h"
 #include "string.h"
-#include "libgen.h"
 #include "math.h"
 
+// SSE2 is baseline on x86-64, so directory entries' fingerprints are compared 4 at a time there.
+// Define F17FS_NO_SIMD to force the portable scalar code.
+#if defined(__SSE2__) && !defined(F17FS_NO_SIMD)
+#include <emmintrin.h>
+#define F17FS_USE_SSE2 1
+#endif
+
 #define BLOCK_STORE_NUM_BLOCKS 65536   // 2^16 blocks.
-#define BLOCK_STORE_AVAIL_BLOCKS 65520 // Last 2^16/2^3/2^9 = 16 blocks consumed by the FBM
-#define BLOCK_SIZE_BYTES 512           // 2^9 BYTES per block
-// direct each: 512, total size: 512 * 6 = 3072
-// indirect, index block: 512/2 = 256 addresses, total size: 512 * 256 = 131072
-// double indirect, first index block: 256 addresses, second index block total: 256*256 = 65536, total: 65536 * 512 = 33554432  
-#define DIRECT_TOTAL_BYTES 3072	
-#define SINGLE_INDIRECT_TOTAL_BYTES 131072
-#define DOUBLE_INDIRECT_TOTAL_BYTES 33554432
+#define BLOCK_SIZE_BYTES 512           // 2^9 BYTES per block, the default (and legacy) block size
+// the rest of the geometry follows from the block size B and the block id width W (2 or 4 bytes), see set_geometry
+// direct: 6 blocks, 6 * B bytes
+// indirect, index block: B/W addresses (F17FS.tableEntries), B * B/W bytes
+// double indirect: (B/W)^2 blocks. With 512-byte blocks and 16-bit ids: 3072 + 131072 + 33554432 = 33688576 bytes at most
 #define DIRECT_BLOCKS 6	
-#define INDIRECT_BLOCKS 256
-#define DOUBLE_INDIRECT_BLOCKS 65536
-#define MAX_FILE_SIZE 33688576
+#define INODE_COUNT 256	// the inode table holds INODE_COUNT 64-byte inodes, in as many blocks as that takes
+// inodes from INODE_COUNT on live in the inode file (superblock_t.inodeFile), which grows a block at a time
 
 // each inode represents a regular file or a directory file
+// this is the layout of images with 32-bit block ids, and what the code works with for both formats
 struct inode {
 	uint8_t vacantFile;			// this parameter is only for directory, denotes which place in the array is empty and can hold a new file
-	char owner[18];
-
 	char fileType;				// 'r' denotes regular file, 'd' denotes directory file
+	uint8_t flags;				// INODE_HASHED_DIR
+	uint8_t reserved;
+	uint32_t linkCount;
+	uint32_t inodeNumber;		// 0-255 in the inode table, from 256 on in the inode file
+	uint32_t reserved2;
+	uint64_t fileSize;			// the unit is in byte
+
+	// pointers are acutally block numbers, rather than 'real' pointers.
+	uint32_t directPointer[6];
+	uint32_t indirectPointer;
+	uint32_t doubleIndirectPointer;
+	uint32_t reserved3[2];
+};
+
+// the inode of images with 16-bit block ids (up to 65536 blocks), converted by read_inode/write_inode
+typedef struct {
+	uint8_t vacantFile;
+	uint8_t flags;
+	char owner[17];
+
+	char fileType;
 	
-	size_t inodeNumber;			// for F17FS, the range should be 0-255
-	size_t fileSize; 			// the unit is in byte	
+	size_t inodeNumber;
+	size_t fileSize;
 	size_t linkCount;
 	
 	// to realize the 16-bit addressing, pointers are acutally block numbers, rather than 'real' pointers.
@@ -36,34 +58,533 @@ struct inode {
 	uint16_t indirectPointer;
 	uint16_t doubleIndirectPointer;
 		
-};
+} legacyInode_t;
 
 
 struct fileDescriptor {
-	uint8_t inodeNum;	// the inode # of the fd
+	uint32_t inodeNum;	// the inode # of the fd
 	uint8_t usage; 		// only the lower 3 digits will be used. 1 for direct, 2 for indirect, 4 for dbindirect
 	// locate_block and locate_offset together lcoate the exact byte
-	uint16_t locate_order;		// the n-th block in the direct, indirect, or dbindirect pointer
 	uint16_t locate_offset; // offset from the first byte (0 byte) in the data block
+	uint32_t locate_order;		// the n-th block in the direct, indirect, or dbindirect pointer
 };
 
 
 struct directoryFile {
 	char filename[64];
-	uint8_t inodeNumber;
+	uint8_t inodeNumber;	// the low 8 bits, see dentry_inode
 };
 
 struct directoryBlock {
 	directoryFile_t dentries[7];
-	char padding[57];
+	uint8_t inodeHigh[7][3];	// bits 8-31 of each entry's inode number, zero in images from before 32-bit inode numbers
+	char types[7];	// each entry's fileType, so listings needn't read the inodes; zero in images from before
+	char padding[1];
+	uint32_t fingerprints[7];	// each entry's name_fingerprint, names are only compared where it matches;
+					//  zero in images from before (and for entries not in use)
 };
 
+// a directory is a directoryBlock_t at the start of its block, with vacantFile marking the entries in use,
+//  until it needs an 8th entry. Then it becomes a hashed directory (INODE_HASHED_DIR): the directory file is
+//  cut into 512-byte slots, slot 0 is the root of an index on the names' hashes (name_hash), and the
+//  leaves are directoryBlock_ts, entries in use having a name. A leaf holds a range of hashes, split in
+//  two when it overflows; index nodes split the same way, and a full root moves down a level
+#define INODE_HASHED_DIR 0x1
+#define DIR_SLOT_BYTES 512	// sizeof(directoryBlock_t) and sizeof(dirIndex_t)
+#define DIR_INDEX_ENTRIES 62
+#define DIR_MAX_LEVELS 8	// index levels, 62^8 leaves are far more than a directory file holds
+
+typedef struct {
+	uint32_t hash;	// the lowest hash under the child, 0 for the first child of the root
+	uint32_t slot;	// the child's slot in the directory file
+} dirIndexEntry_t;
+
+typedef struct {
+	uint16_t count;		// entries in use, sorted by hash
+	uint16_t level;		// 0 when the children are leaves
+	uint32_t names;		// root only: the entries in the directory
+	uint64_t reserved;
+	dirIndexEntry_t entries[DIR_INDEX_ENTRIES];
+} dirIndex_t;
+
+// the index nodes from the root down to a leaf, and the entry taken in each
+typedef struct {
+	size_t depth;
+	size_t slots[DIR_MAX_LEVELS];
+	size_t positions[DIR_MAX_LEVELS];
+} dirPath_t;
+
+// sequential read detection and access hints for one file descriptor
+typedef struct {
+	size_t next;	// byte where a sequential read would start
+	size_t window;	// readahead window in blocks, 0 until reads look sequential
+	size_t ahead;	// logical blocks before this one have been prefetched
+	fs_advice_t pattern;	// FS_ADVICE_NORMAL, SEQUENTIAL or RANDOM (fs_advise)
+	bool noreuse;	// FS_ADVICE_NOREUSE: drop blocks from the cache once transferred
+	size_t dropped;	// FS_ADVICE_NOREUSE: logical blocks before this one have been dropped
+	size_t tailStart, tailEnd;	// FS_ADVICE_NOREUSE: the last run of blocks dropped
+} readahead_t;
+
+// the dentry cache: what looking a name up in a directory gave, positive or negative, in a direct-mapped
+//  table of DCACHE_ENTRIES keyed by (directory inode, name). dir_insert and dir_remove keep it coherent, it
+//  starts out empty with every mount
+#define DCACHE_ENTRIES 4096
+#define DCACHE_EMPTY 0
+#define DCACHE_NEGATIVE 1	// the name isn't in the directory
+#define DCACHE_POSITIVE 2	// the name is the inode's
+typedef struct {
+	uint32_t parent;	// inode of the directory
+	uint32_t inode;		// DCACHE_POSITIVE: the inode the name is
+	uint32_t hash;		// dcache_hash of (parent, name)
+	uint8_t state;		// DCACHE_EMPTY, DCACHE_NEGATIVE or DCACHE_POSITIVE
+	char type;		// DCACHE_POSITIVE: the inode's fileType, 0 until somebody needed it
+	char name[FS_FNAME_MAX];
+} dentry_t;
+
+// a directory opened by fs_opendir_handle, which the *at calls resolve their paths from
+#define DIR_HANDLES 256
+typedef struct {
+	bool open;
+	uint32_t inode;
+} dirHandle_t;
+
+// in bytes, so windows cover the same amount of data whatever the block size (but at least a block)
+#define READAHEAD_MIN_BYTES (4 * 1024)		// first window
+#define READAHEAD_SEQ_BYTES (128 * 1024)	// first window after FS_ADVICE_SEQUENTIAL
+#define READAHEAD_MAX_BYTES (1024 * 1024)	// the window doubles up to this
+#define DROP_BEHIND_BYTES (2 * 1024 * 1024)	// FS_ADVICE_NOREUSE drops in batches this big, the page cache keeps large folios
+
+// geometry, features and state of the image, at SUPERBLOCK_OFFSET of block 0 (past the 32-byte inode bitmap)
+// images from before it have none: they mount with the legacy geometry (512-byte blocks, inode bitmap in
+//  block 0, inode table from block 1) and get one
+typedef struct {
+	char magic[8];			// SUPERBLOCK_MAGIC
+	uint32_t features;		// FS_FEATURE_* bits, an image with bits this code doesn't know isn't mounted
+	uint32_t blockSize;		// bytes per block
+	uint64_t blockCount;		// blocks in the image, the FBM's included
+	uint32_t inodeBitmapBlock;	// block holding the inode bitmap (at its start)
+	uint32_t inodeTableBlock;	// first block of the inode table
+	uint32_t inodeTableBlocks;	// blocks in the inode table
+	uint32_t inodeCount;		// inodes in the table
+	uint32_t rootInode;		// inode of "/"
+	uint32_t state;			// SUPERBLOCK_CLEAN or SUPERBLOCK_MOUNTED
+	uint32_t mountCount;		// mounts since the image was formatted
+	uint32_t reserved;
+	// as of the last clean unmount, only trusted while state is SUPERBLOCK_CLEAN
+	uint64_t freeBlocks;		// block_store_get_free_blocks
+	uint64_t freeInodes;
+	uint64_t allocCursor;		// block_store_get_alloc_cursor
+	// the inodes past the table: an inode file with inode INODE_COUNT + i at byte i * 64, and a bitmap file
+	//  with bit i set while it is in use. Both are mapped like regular files (map_file_blocks)
+	inode_t inodeFile;
+	inode_t inodeMapFile;
+} superblock_t;
+
+#define SUPERBLOCK_OFFSET 256
+#define SUPERBLOCK_MAGIC "F17FS_SB"
+#define SUPERBLOCK_CLEAN 1	// unmounted after everything was synced, the cached counts are right
+#define SUPERBLOCK_MOUNTED 2	// mounted, or it wasn't unmounted: the counts have to be rebuilt
+#define SUPPORTED_FEATURES (FS_FEATURE_WIDE_IDS | FS_FEATURE_INODE_FILE | FS_FEATURE_HASHED_DIRS)
+
 struct F17FS {
 	block_store_t * BlockStore_whole;
 	block_store_t * BlockStore_inode;
 	block_store_t * BlockStore_fd;
+	uint8_t * metadata;	// blocks 0 up to the end of the inode table, pinned for as long as the fs is mounted
+	size_t metadataBlocks;	// blocks in metadata: 33 with 512-byte blocks
+	size_t inodeBitmapBlock, inodeTableBlock;	// superblock_t's, 0 and 1 unless it says otherwise
+	superblock_t super;	// the image's superblock, written back by write_superblock
+	bool mountedClean;	// the image was cleanly unmounted last time, its cached counts were used
+	size_t blockSize;	// bytes per block, 512 to 65536
+	bool wideIds;		// 32-bit block ids in inodes and index tables, for images over 65536 blocks
+	size_t tableEntries;	// block ids per index table: blockSize / 2, or blockSize / 4 with wideIds
+	bitmap_t *inodeMap;	// the inode file's bitmap, loaded by load_inode_map on first use, NULL until then
+	size_t inodeMapUsed;	// bits set in inodeMap
+	bool readaheadOn;	// fs_options_t.readahead
+	readahead_t readahead[256];	// indexed by fd
+	dentry_t dcache[DCACHE_ENTRIES];	// see dcache_find
+	dirHandle_t dirHandles[DIR_HANDLES];	// indexed by directory handle, see fs_opendir_handle
 };
 
+// translate mount options into block store options
+static block_store_options_t store_options(const fs_options_t *options){
+	block_store_options_t bsOptions = {BLOCK_STORE_MMAP, false, 0, false, false, false, 0, 0, 0, 0};
+	if(options != NULL){
+		switch(options->backend){
+			case FS_BACKEND_PREAD: bsOptions.backend = BLOCK_STORE_PREAD; break;
+			case FS_BACKEND_DIRECT: bsOptions.backend = BLOCK_STORE_DIRECT; break;
+			case FS_BACKEND_URING: bsOptions.backend = BLOCK_STORE_URING; break;
+			default: bsOptions.backend = BLOCK_STORE_MMAP; break;
+		}
+		bsOptions.queue_depth = options->queue_depth;
+		bsOptions.populate = options->map_populate;
+		bsOptions.hugepages = options->map_hugepages;
+		bsOptions.lock = options->map_lock;
+		bsOptions.blocks = options->blocks;
+		bsOptions.block_size = options->block_size;
+	}
+	return bsOptions;
+}
+
+// the block id format follows from the image size, so images of up to 65536 blocks keep the old layout
+// everything else follows from the block size, unless a superblock (sb, NULL if there's none) places the inodes
+// return true on success, false if the superblock doesn't fit the image or this code
+static bool set_geometry(F17FS_t *fs, const superblock_t *sb){
+	fs->blockSize = block_store_get_block_size(fs->BlockStore_whole);
+	fs->wideIds = block_store_get_block_count(fs->BlockStore_whole) > BLOCK_STORE_NUM_BLOCKS;
+	fs->tableEntries = fs->blockSize / (fs->wideIds ? sizeof(uint32_t) : sizeof(uint16_t));
+	fs->inodeBitmapBlock = 0;
+	fs->inodeTableBlock = 1;
+	size_t tableBlocks = (INODE_COUNT * sizeof(inode_t) + fs->blockSize - 1) / fs->blockSize;
+	if(sb != NULL){
+		if((sb->features & ~SUPPORTED_FEATURES) != 0 || !(sb->features & FS_FEATURE_WIDE_IDS) != !fs->wideIds
+			|| sb->blockSize != fs->blockSize || sb->blockCount != block_store_get_block_count(fs->BlockStore_whole)
+			|| sb->inodeCount != INODE_COUNT + sb->inodeFile.fileSize / sizeof(inode_t) || sb->rootInode != 0
+			|| sb->inodeFile.fileSize % fs->blockSize != 0 || sb->inodeMapFile.fileSize * 8 < sb->inodeFile.fileSize / sizeof(inode_t)
+			|| sb->inodeTableBlocks < tableBlocks
+			|| sb->inodeBitmapBlock >= sb->inodeTableBlock || sb->inodeTableBlock + sb->inodeTableBlocks >= sb->blockCount){
+			return false;
+		}
+		fs->inodeBitmapBlock = sb->inodeBitmapBlock;
+		fs->inodeTableBlock = sb->inodeTableBlock;
+		tableBlocks = sb->inodeTableBlocks;
+	}
+	fs->metadataBlocks = fs->inodeTableBlock + tableBlocks;
+	return true;
+}
+
+// fill in the superblock of a newly formatted (or not yet upgraded) image from its geometry
+static void init_superblock(F17FS_t *fs){
+	superblock_t *sb = &fs->super;
+	memset(sb, 0, sizeof(superblock_t));
+	memcpy(sb->magic, SUPERBLOCK_MAGIC, sizeof(sb->magic));
+	sb->features = fs->wideIds ? FS_FEATURE_WIDE_IDS : 0;
+	sb->blockSize = fs->blockSize;
+	sb->blockCount = block_store_get_block_count(fs->BlockStore_whole);
+	sb->inodeBitmapBlock = fs->inodeBitmapBlock;
+	sb->inodeTableBlock = fs->inodeTableBlock;
+	sb->inodeTableBlocks = fs->metadataBlocks - fs->inodeTableBlock;
+	sb->inodeCount = INODE_COUNT;
+	sb->rootInode = 0;
+	sb->state = SUPERBLOCK_MOUNTED;
+}
+
+// return true on success, false on error
+static bool write_superblock(F17FS_t *fs){
+	return block_store_n_write(fs->BlockStore_whole, 0, SUPERBLOCK_OFFSET, &fs->super, sizeof(superblock_t)) == sizeof(superblock_t);
+}
+
+// write the superblock and wait for it to reach the disk
+// return true on success, false on error
+static bool sync_superblock(F17FS_t *fs){
+	size_t block = 0;
+	return write_superblock(fs) && block_store_sync_blocks(fs->BlockStore_whole, &block, 1);
+}
+
+// read the superblock of an image that isn't mounted yet
+// return true if it has one, false for an image from before superblocks (or an unreadable one, which opening will reject)
+static bool peek_superblock(const char *path, superblock_t *sb){
+	return block_store_peek(path, SUPERBLOCK_OFFSET, sb, sizeof(superblock_t)) == sizeof(superblock_t)
+		&& memcmp(sb->magic, SUPERBLOCK_MAGIC, sizeof(sb->magic)) == 0;
+}
+
+// a size in bytes as a number of blocks, at least 1
+static size_t bytes_to_blocks(const F17FS_t *fs, size_t bytes){
+	return bytes > fs->blockSize ? bytes / fs->blockSize : 1;
+}
+
+// the number of logical blocks a file can have: direct, single indirect and double indirect
+static size_t max_file_blocks(const F17FS_t *fs){
+	return DIRECT_BLOCKS + fs->tableEntries + fs->tableEntries * fs->tableEntries;
+}
+
+// block id i of an index table, 16 or 32 bits wide
+static uint32_t get_entry(const void *table, bool wide, size_t i){
+	return wide ? ((const uint32_t *)table)[i] : ((const uint16_t *)table)[i];
+}
+
+static void set_entry(void *table, bool wide, size_t i, uint32_t id){
+	if(wide){
+		((uint32_t *)table)[i] = id;
+	} else {
+		((uint16_t *)table)[i] = (uint16_t)id;
+	}
+}
+
+size_t map_file_blocks(F17FS_t *fs, inode_t *ino, size_t first, size_t count, bool allocate, uint32_t *ids);
+
+// the block holding byte `byte` of a file, and the offset in it; SIZE_MAX past the end
+// at most an outer and an inner index table are looked at
+static size_t locate_in(F17FS_t *fs, inode_t *file, size_t byte, size_t *offset){
+	uint32_t blockID;
+	if(byte >= file->fileSize || 1 != map_file_blocks(fs, file, byte / fs->blockSize, 1, false, &blockID)){
+		return SIZE_MAX;
+	}
+	*offset = byte % fs->blockSize;
+	return blockID;
+}
+
+// copy the 64 bytes of an inode in or out, from the inode table or the inode file
+// return the number of bytes transferred (64), 0 on error
+static size_t transfer_inode(F17FS_t *fs, size_t inodeID, void *raw, bool write){
+	if(inodeID < INODE_COUNT){
+		return write ? block_store_inode_write(fs->BlockStore_inode, inodeID, raw) : block_store_inode_read(fs->BlockStore_inode, inodeID, raw);
+	}
+	size_t offset, blockID = locate_in(fs, &fs->super.inodeFile, (inodeID - INODE_COUNT) * sizeof(inode_t), &offset);
+	if(blockID == SIZE_MAX){
+		return 0;
+	}
+	return write ? block_store_n_write(fs->BlockStore_whole, blockID, offset, raw, sizeof(inode_t))
+			: block_store_n_read(fs->BlockStore_whole, blockID, offset, raw, sizeof(inode_t));
+}
+
+// read an inode, converting it from the legacy layout
+// flags were owner[0] before FS_FEATURE_HASHED_DIRS, which code of the time left uninitialized: they count
+//  from the feature on only (make_hashed clears them all when it sets it)
+// return the number of bytes read (64), 0 on error
+static size_t read_inode(F17FS_t *fs, size_t inodeID, inode_t *ino){
+	if(fs->wideIds){
+		return transfer_inode(fs, inodeID, ino, false);
+	}
+	legacyInode_t old;
+	if(0 == transfer_inode(fs, inodeID, &old, false)){
+		return 0;
+	}
+	memset(ino, 0, sizeof(inode_t));
+	ino->vacantFile = old.vacantFile;
+	ino->flags = (fs->super.features & FS_FEATURE_HASHED_DIRS) ? old.flags : 0;
+	ino->fileType = old.fileType;
+	ino->inodeNumber = old.inodeNumber;
+	ino->fileSize = old.fileSize;
+	ino->linkCount = old.linkCount;
+	for(int i = 0; i < DIRECT_BLOCKS; i++){
+		ino->directPointer[i] = old.directPointer[i];
+	}
+	ino->indirectPointer = old.indirectPointer;
+	ino->doubleIndirectPointer = old.doubleIndirectPointer;
+	return sizeof(inode_t);
+}
+
+// write an inode, converting it to the legacy layout
+// return the number of bytes written (64), 0 on error
+static size_t write_inode(F17FS_t *fs, size_t inodeID, const inode_t *ino){
+	if(fs->wideIds){
+		return transfer_inode(fs, inodeID, (void *)ino, true);
+	}
+	legacyInode_t old;
+	memset(&old, 0, sizeof(legacyInode_t));
+	old.vacantFile = ino->vacantFile;
+	old.flags = ino->flags;
+	old.fileType = ino->fileType;
+	old.inodeNumber = ino->inodeNumber;
+	old.fileSize = ino->fileSize;
+	old.linkCount = ino->linkCount;
+	for(int i = 0; i < DIRECT_BLOCKS; i++){
+		old.directPointer[i] = ino->directPointer[i];
+	}
+	old.indirectPointer = ino->indirectPointer;
+	old.doubleIndirectPointer = ino->doubleIndirectPointer;
+	return transfer_inode(fs, inodeID, &old, true);
+}
+
+// a directory is a directoryBlock_t at the start of its block, whatever the block size
+// return the number of bytes read/written, 0 on error
+static size_t read_directory(F17FS_t *fs, size_t blockID, directoryBlock_t *dir){
+	return block_store_n_read(fs->BlockStore_whole, blockID, 0, dir, sizeof(directoryBlock_t));
+}
+
+static size_t write_directory(F17FS_t *fs, size_t blockID, const directoryBlock_t *dir){
+	return block_store_n_write(fs->BlockStore_whole, blockID, 0, dir, sizeof(directoryBlock_t));
+}
+
+// the inode number of entry i of a directory: the low 8 bits are in the entry, the rest in inodeHigh
+static size_t dentry_inode(const directoryBlock_t *dir, size_t i){
+	const uint8_t *high = dir->inodeHigh[i];
+	return dir->dentries[i].inodeNumber | (size_t)high[0] << 8 | (size_t)high[1] << 16 | (size_t)high[2] << 24;
+}
+
+static void set_dentry_inode(directoryBlock_t *dir, size_t i, size_t inodeID){
+	dir->dentries[i].inodeNumber = (uint8_t)inodeID;
+	dir->inodeHigh[i][0] = (uint8_t)(inodeID >> 8);
+	dir->inodeHigh[i][1] = (uint8_t)(inodeID >> 16);
+	dir->inodeHigh[i][2] = (uint8_t)(inodeID >> 24);
+}
+
+// copy entry from of a directory block to entry to of another: name, inode number and type
+static void copy_dentry(directoryBlock_t *dst, size_t to, const directoryBlock_t *src, size_t from){
+	dst->dentries[to] = src->dentries[from];
+	memcpy(dst->inodeHigh[to], src->inodeHigh[from], sizeof(dst->inodeHigh[to]));
+	dst->types[to] = src->types[from];
+	dst->fingerprints[to] = src->fingerprints[from];
+}
+
+// the most inodes the inode file can hold: a file's worth, short of running out of 32-bit inode numbers
+static size_t max_file_inodes(const F17FS_t *fs){
+	size_t most = max_file_blocks(fs) * (fs->blockSize / sizeof(inode_t));
+	return most < (size_t)UINT32_MAX - INODE_COUNT ? most : (size_t)UINT32_MAX - INODE_COUNT;
+}
+
+// load the inode file's bitmap into inodeMap on first use (with a summary, so finding a free inode
+//  doesn't depend on how many there are), or grow it to at least `bits` bits
+// return true on success, false on error
+static bool load_inode_map(F17FS_t *fs, size_t bits){
+	if(fs->inodeMap != NULL && bitmap_get_bits(fs->inodeMap) >= bits){
+		return true;
+	}
+	const size_t inodes = fs->super.inodeFile.fileSize / sizeof(inode_t);
+	bits = bits > inodes ? bits : inodes;
+	bits = bits > 4096 ? bits : 4096;
+	bits = bits < max_file_inodes(fs) ? bits : max_file_inodes(fs);
+	uint8_t *bytes = calloc((bits + 7) / 8, 1);
+	if(bytes == NULL){
+		return false;
+	}
+	if(fs->inodeMap != NULL){
+		memcpy(bytes, bitmap_export(fs->inodeMap), bitmap_get_bytes(fs->inodeMap));
+	} else {
+		const size_t end = (inodes + 7) / 8;
+		for(size_t byte = 0; byte < end;){
+			size_t offset, blockID = locate_in(fs, &fs->super.inodeMapFile, byte, &offset);
+			size_t n = fs->blockSize - offset < end - byte ? fs->blockSize - offset : end - byte;
+			if(blockID == SIZE_MAX || n != block_store_n_read(fs->BlockStore_whole, blockID, offset, bytes + byte, n)){
+				free(bytes);
+				return false;
+			}
+			byte += n;
+		}
+	}
+	bitmap_t *map = bitmap_import(bits, bytes);
+	free(bytes);
+	if(map == NULL || !bitmap_enable_summary(map)){
+		bitmap_destroy(map);
+		return false;
+	}
+	bitmap_build_summary(map);
+	if(fs->inodeMap == NULL){
+		fs->inodeMapUsed = bitmap_total_set(map);
+	}
+	bitmap_destroy(fs->inodeMap);
+	fs->inodeMap = map;
+	return true;
+}
+
+// write the byte of inodeMap holding bit `bit` to the inode file's bitmap
+// return true on success, false on error
+static bool store_inode_map(F17FS_t *fs, size_t bit){
+	size_t offset, blockID = locate_in(fs, &fs->super.inodeMapFile, bit / 8, &offset);
+	return blockID != SIZE_MAX && 1 == block_store_n_write(fs->BlockStore_whole, blockID, offset, bitmap_export(fs->inodeMap) + bit / 8, 1);
+}
+
+// add a zeroed block to the end of the inode file or its bitmap
+// return true on success, false when out of space
+static bool append_block(F17FS_t *fs, inode_t *file){
+	uint32_t blockID;
+	if(1 != map_file_blocks(fs, file, file->fileSize / fs->blockSize, 1, true, &blockID)){
+		return false;
+	}
+	void *block = block_store_view_mut(fs->BlockStore_whole, blockID);
+	if(block == NULL){
+		return false;
+	}
+	memset(block, 0, fs->blockSize);
+	block_store_unpin_mut(fs->BlockStore_whole, blockID, 1);
+	file->fileSize += fs->blockSize;
+	return true;
+}
+
+// add a block of inodes to the inode file, and a block to its bitmap when that is full
+// return true on success, false when out of space or inode numbers
+static bool grow_inode_file(F17FS_t *fs){
+	superblock_t *sb = &fs->super;
+	const size_t inodes = sb->inodeFile.fileSize / sizeof(inode_t) + fs->blockSize / sizeof(inode_t);
+	if(inodes > max_file_inodes(fs) || (sb->inodeMapFile.fileSize * 8 < inodes && !append_block(fs, &sb->inodeMapFile))
+		|| !append_block(fs, &sb->inodeFile)){
+		return false;
+	}
+	sb->inodeCount = INODE_COUNT + inodes;
+	sb->features |= FS_FEATURE_INODE_FILE;
+	return write_superblock(fs);
+}
+
+// allocate an inode: from the inode table while it has room, then the first free one of the inode file,
+//  which grows when they are all in use
+// return the inode number, SIZE_MAX when out of inodes or space
+static size_t allocate_inode(F17FS_t *fs){
+	size_t inodeID = block_store_sub_allocate(fs->BlockStore_inode);
+	if(inodeID != SIZE_MAX){
+		return inodeID;
+	}
+	if(!load_inode_map(fs, 0)){
+		return SIZE_MAX;
+	}
+	size_t slot = bitmap_ffz(fs->inodeMap);
+	if(slot == SIZE_MAX && load_inode_map(fs, 2 * bitmap_get_bits(fs->inodeMap))){
+		slot = bitmap_ffz(fs->inodeMap);
+	}
+	if(slot == SIZE_MAX || (slot >= fs->super.inodeFile.fileSize / sizeof(inode_t) && !grow_inode_file(fs))){
+		return SIZE_MAX;
+	}
+	bitmap_set(fs->inodeMap, slot);
+	if(!store_inode_map(fs, slot)){
+		bitmap_reset(fs->inodeMap, slot);
+		return SIZE_MAX;
+	}
+	fs->inodeMapUsed++;
+	return INODE_COUNT + slot;
+}
+
+// free an inode allocated by allocate_inode
+static void release_inode(F17FS_t *fs, size_t inodeID){
+	if(inodeID < INODE_COUNT){
+		block_store_sub_release(fs->BlockStore_inode, inodeID);
+		return;
+	}
+	size_t slot = inodeID - INODE_COUNT;
+	if(load_inode_map(fs, 0) && slot < bitmap_get_bits(fs->inodeMap) && bitmap_test(fs->inodeMap, slot)){
+		bitmap_reset(fs->inodeMap, slot);
+		store_inode_map(fs, slot);
+		fs->inodeMapUsed--;
+	}
+}
+
+// the number of inodes not in use, the inode table's and the inode file's
+static size_t free_inodes(F17FS_t *fs){
+	size_t free = INODE_COUNT - block_store_get_used_blocks(fs->BlockStore_inode);
+	if(fs->super.inodeFile.fileSize > 0 && load_inode_map(fs, 0)){
+		free += fs->super.inodeFile.fileSize / sizeof(inode_t) - fs->inodeMapUsed;
+	}
+	return free;
+}
+
+// pin the metadata blocks and lay the inode bitmap/table store over them
+// return true on success, false on error (nothing is left pinned)
+static bool attach_metadata(F17FS_t *fs){
+	fs->metadata = block_store_view_range_mut(fs->BlockStore_whole, 0, fs->metadataBlocks);
+	if(fs->metadata == NULL){
+		return false;
+	}
+	// the 1st block holds the inode bitmap, the inode table starts at the 2nd (unless the superblock moved them)
+	fs->BlockStore_inode = block_store_inode_create(fs->metadata + fs->inodeBitmapBlock * fs->blockSize,
+		fs->metadata + fs->inodeTableBlock * fs->blockSize);
+	if(fs->BlockStore_inode == NULL){
+		block_store_unpin(fs->BlockStore_whole, 0);
+		return false;
+	}
+	// the view stays pinned, so inode changes have to tell the whole store which blocks they dirty
+	block_store_inode_track(fs->BlockStore_inode, fs->BlockStore_whole, fs->inodeBitmapBlock, fs->inodeTableBlock);
+	return true;
+}
+
+// start the background flusher if the options ask for one
+// return true on success or when there is none to start, false on error
+static bool start_flusher(F17FS_t *fs, const fs_options_t *options){
+	if(options == NULL || !options->flusher){
+		return true;
+	}
+	block_store_flusher_options_t flusherOptions = {options->flush_dirty_bytes, options->flush_max_age_ms};
+	return block_store_start_flusher(fs->BlockStore_whole, &flusherOptions);
+}
+
 // initialize directoryFile to 0 or "";
 directoryFile_t init_dirFile(void){
 	directoryFile_t df;
@@ -79,7 +600,10 @@ directoryBlock_t init_dirBlock(void){
 	for(; i<7; i++){
 		db.dentries[i] = init_dirFile();
 	}
-	memset(db.padding,'\0',57);
+	memset(db.inodeHigh,'\0',sizeof(db.inodeHigh));
+	memset(db.types,'\0',sizeof(db.types));
+	memset(db.fingerprints,'\0',sizeof(db.fingerprints));
+	memset(db.padding,'\0',sizeof(db.padding));
 	return db;
 }
 
@@ -88,29 +612,46 @@ directoryBlock_t init_dirBlock(void){
 /// \return Mounted F17FS object, NULL on error
 ///
 F17FS_t *fs_format(const char *path)
+{
+	return fs_format_with(path, NULL);
+}
+
+F17FS_t *fs_format_with(const char *path, const fs_options_t *options)
 {
 	if(path != NULL && strlen(path) != 0)
 	{
-		F17FS_t * ptr_F17FS = malloc(sizeof(F17FS_t));	// get started
-		ptr_F17FS->BlockStore_whole = block_store_create(path);				// pointer to start of a large chunck of memory
+		F17FS_t * ptr_F17FS = calloc(1, sizeof(F17FS_t));	// get started
+		if(ptr_F17FS == NULL){
+			return NULL;
+		}
+		block_store_options_t bsOptions = store_options(options);
+		ptr_F17FS->readaheadOn = options != NULL && options->readahead;
+		ptr_F17FS->BlockStore_whole = block_store_create_with(path, &bsOptions);				// pointer to start of a large chunck of memory
+		if(ptr_F17FS->BlockStore_whole == NULL){
+			free(ptr_F17FS);
+			return NULL;
+		}
+		set_geometry(ptr_F17FS, NULL);
 		
-		// reserve the 1st block for bitmaps (this block is cut half and half, for inode bitmap and fd bitmap)
-		size_t bitmap_ID = block_store_allocate(ptr_F17FS->BlockStore_whole);
-		//printf("bitmap_ID = %zu\n", bitmap_ID);
-		// 2nd - 33th block for inodes, 32 blocks in total
-		size_t inode_start_block = block_store_allocate(ptr_F17FS->BlockStore_whole);
-		//printf("inode_start_block = %zu\n", inode_start_block);		
-		for(int i = 0; i < 31; i++)
+		// reserve the 1st block for bitmaps (the inode bitmap, then the superblock)
+		// the blocks after it for inodes, 32 blocks in total with 512-byte blocks
+		for(size_t i = 0; i < ptr_F17FS->metadataBlocks; i++)
 		{
 			block_store_allocate(ptr_F17FS->BlockStore_whole);
 		}
+		init_superblock(ptr_F17FS);
+		ptr_F17FS->super.mountCount = 1;
+		write_superblock(ptr_F17FS);
 		
-		// 34th block for root directory
+		// the next block for root directory (the 34th with 512-byte blocks)
 		size_t root_data_ID = block_store_allocate(ptr_F17FS->BlockStore_whole);
 		//printf("root_data_ID = %zu\n\n", root_data_ID);				
 		// install inode block store inside the whole block store
-		// install inode block store inside the whole block store
-		ptr_F17FS->BlockStore_inode = block_store_inode_create(block_store_Data_location(ptr_F17FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_F17FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
+		if(!attach_metadata(ptr_F17FS)){
+			block_store_destroy(ptr_F17FS->BlockStore_whole);
+			free(ptr_F17FS);
+			return NULL;
+		}
 
 		// the first inode is reserved for root dir
 		block_store_sub_allocate(ptr_F17FS->BlockStore_inode);
@@ -120,17 +661,21 @@ F17FS_t *fs_format(const char *path)
 		inode_t * root_inode = (inode_t *) calloc(1, sizeof(inode_t));
 		root_inode->vacantFile = 0x00;
 		root_inode->fileType = 'd';
-		root_inode->fileSize = BLOCK_SIZE_BYTES;								
+		root_inode->fileSize = ptr_F17FS->blockSize;								
 		root_inode->inodeNumber = root_inode_ID;
 		root_inode->linkCount = 1;
 		root_inode->directPointer[0] = root_data_ID;
-		block_store_inode_write(ptr_F17FS->BlockStore_inode, root_inode_ID, root_inode);
+		write_inode(ptr_F17FS, root_inode_ID, root_inode);
 		directoryBlock_t rootDataBlock = init_dirBlock();		
-		block_store_write(ptr_F17FS->BlockStore_whole, root_data_ID,&rootDataBlock );
+		write_directory(ptr_F17FS,root_data_ID,&rootDataBlock );
 		free(root_inode);
 		
 		// now allocate space for the file descriptors
 		ptr_F17FS->BlockStore_fd = block_store_fd_create();
+		if(!start_flusher(ptr_F17FS, options)){
+			fs_unmount(ptr_F17FS);
+			return NULL;
+		}
 
 		return ptr_F17FS;
 	}	
@@ -148,23 +693,54 @@ F17FS_t *fs_format(const char *path)
 
 ///
 F17FS_t *fs_mount(const char *path)
+{
+	return fs_mount_with(path, NULL);
+}
+
+F17FS_t *fs_mount_with(const char *path, const fs_options_t *options)
 {
 	if(path != NULL && strlen(path) != 0)
 	{
 		F17FS_t * ptr_F17FS = (F17FS_t *)calloc(1, sizeof(F17FS_t));	// get started
-		ptr_F17FS->BlockStore_whole = block_store_open(path);	// get the chunck of data	
-		
-		// the bitmap block should be the 1st one
-		size_t bitmap_ID = 0;
-
-		// the inode blocks start with the 2nd block, and goes around until the 33th block, 32 in total
-		size_t inode_start_block = 1;
+		if(ptr_F17FS == NULL){
+			return NULL;
+		}
+		block_store_options_t bsOptions = store_options(options);
+		ptr_F17FS->readaheadOn = options != NULL && options->readahead;
+		// the block size comes from the image, not the options: the superblock, or 512 without one
+		// after a clean unmount its counts and allocation cursor stand in for a recount of the FBM
+		superblock_t sb;
+		bool hasSuper = peek_superblock(path, &sb);
+		ptr_F17FS->mountedClean = hasSuper && sb.state == SUPERBLOCK_CLEAN;
+		bsOptions.block_size = hasSuper ? sb.blockSize : BLOCK_SIZE_BYTES;
+		if(ptr_F17FS->mountedClean){
+			bsOptions.used_blocks = sb.blockCount - sb.freeBlocks;
+			bsOptions.alloc_cursor = sb.allocCursor;
+		}
+		ptr_F17FS->BlockStore_whole = block_store_open_with(path, &bsOptions);	// get the chunck of data	
 		
 		// attach the bitmaps to their designated place
-		ptr_F17FS->BlockStore_inode = block_store_inode_create(block_store_Data_location(ptr_F17FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_F17FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
+		// the bitmap block should be the 1st one, the inode blocks follow it (the 2nd until the 33th block with 512-byte blocks)
+		if(ptr_F17FS->BlockStore_whole == NULL || !set_geometry(ptr_F17FS, hasSuper ? &sb : NULL) || !attach_metadata(ptr_F17FS)){
+			block_store_destroy(ptr_F17FS->BlockStore_whole);
+			free(ptr_F17FS);
+			return NULL;
+		}
 		
 		// since file descriptors are alloacted outside of the whole blocks, we only can reallocate space for it.
 		ptr_F17FS->BlockStore_fd = block_store_fd_create();
+		// the image is in use until fs_unmount says otherwise; that has to be on the disk before anything else changes
+		if(hasSuper){
+			ptr_F17FS->super = sb;
+		} else {
+			init_superblock(ptr_F17FS);
+		}
+		ptr_F17FS->super.state = SUPERBLOCK_MOUNTED;
+		ptr_F17FS->super.mountCount++;
+		if(!sync_superblock(ptr_F17FS) || !start_flusher(ptr_F17FS, options)){
+			fs_unmount(ptr_F17FS);
+			return NULL;
+		}
 		
 		return ptr_F17FS;
 	}
@@ -184,7 +760,19 @@ int fs_unmount(F17FS_t *fs)
 {
 	if(fs != NULL)
 	{	
+		block_store_stop_flusher(fs->BlockStore_whole);
+		// everything else reaches the disk before the superblock says the image is clean;
+		//  if that fails it stays marked as mounted and the next mount recounts
+		if(block_store_sync(fs->BlockStore_whole)){
+			fs->super.state = SUPERBLOCK_CLEAN;
+			fs->super.freeBlocks = block_store_get_free_blocks(fs->BlockStore_whole);
+			fs->super.freeInodes = free_inodes(fs);
+			fs->super.allocCursor = block_store_get_alloc_cursor(fs->BlockStore_whole);
+			sync_superblock(fs);
+		}
 		block_store_inode_destroy(fs->BlockStore_inode);
+		bitmap_destroy(fs->inodeMap);
+		block_store_unpin(fs->BlockStore_whole, 0);	// writes the metadata back on the non-mmap backends
 		
 		block_store_destroy(fs->BlockStore_whole);
 		block_store_fd_destroy(fs->BlockStore_fd);
@@ -195,239 +783,796 @@ int fs_unmount(F17FS_t *fs)
 	return -1;
 }
 
-// search if the absolute path leading to the directory exists
-// \param fs F17FS File system containing the file
-// \param dirPath Absolute path of the directory
-// return the inode number of the directory,  SIZE_MAX on error
-size_t searchPath(F17FS_t *fs, char* dirPath){
-	char *fn = strtok(dirPath,"/");
-	// search and check if the directory name "fn" along the path are valid
-	size_t iNum = 0; // inode number of the searched directory inode
-	inode_t dirInode; // inode of the searched directory
-	directoryBlock_t dirBlock; // file block of the searched directory
-	while(fn != NULL){
-		// find the inode
-		if(0 == block_store_inode_read(fs->BlockStore_inode,iNum,&dirInode)){
-			return SIZE_MAX;
+// FNV-1a of a name, orders the entries of hashed directories
+static uint32_t name_hash(const char *name){
+	uint32_t hash = 2166136261u;
+	for(; *name != '\0'; name++){
+		hash = (hash ^ (uint8_t)*name) * 16777619u;
+	}
+	return hash;
+}
+
+// copy slot `slot` of a hashed directory (a directoryBlock_t leaf or a dirIndex_t) in or out
+// return true on success, false on error
+static bool transfer_dir_slot(F17FS_t *fs, inode_t *dir, size_t slot, void *buffer, bool write){
+	size_t offset, blockID = locate_in(fs, dir, slot * DIR_SLOT_BYTES, &offset);
+	if(blockID == SIZE_MAX){
+		return false;
+	}
+	return DIR_SLOT_BYTES == (write ? block_store_n_write(fs->BlockStore_whole, blockID, offset, buffer, DIR_SLOT_BYTES)
+			: block_store_n_read(fs->BlockStore_whole, blockID, offset, buffer, DIR_SLOT_BYTES));
+}
+
+// add a slot to the end of a hashed directory, for the caller to fill in; the inode has to be written back
+// return the slot, SIZE_MAX when out of space
+static size_t append_dir_slot(F17FS_t *fs, inode_t *dir){
+	const size_t slot = dir->fileSize / DIR_SLOT_BYTES;
+	uint32_t blockID;
+	if(1 != map_file_blocks(fs, dir, slot * DIR_SLOT_BYTES / fs->blockSize, 1, true, &blockID)){
+		return SIZE_MAX;
+	}
+	dir->fileSize += DIR_SLOT_BYTES;
+	return slot;
+}
+
+// the entry of an index node whose range holds hash h: the last one starting at or below it
+static size_t index_position(const dirIndex_t *node, uint32_t h){
+	size_t low = 0, high = node->count;
+	while(high - low > 1){
+		size_t mid = (low + high) / 2;
+		if(node->entries[mid].hash <= h){
+			low = mid;
+		} else {
+			high = mid;
 		}
-		// the inode must be of directory
-		if(dirInode.fileType != 'd'){
+	}
+	return low;
+}
+
+// walk the index of a hashed directory down to the leaf whose range holds hash h
+// \param path Receives the index nodes passed and the entries taken, NULL if not needed
+// \param end Set to the end of the leaf's range, 2^32 for the last leaf; NULL if not needed
+// return the leaf's slot, SIZE_MAX on error
+static size_t find_leaf(F17FS_t *fs, inode_t *dir, uint32_t h, dirPath_t *path, uint64_t *end){
+	dirIndex_t node;
+	size_t slot = 0;
+	uint64_t rangeEnd = (uint64_t)UINT32_MAX + 1;
+	for(size_t depth = 0; depth < DIR_MAX_LEVELS; depth++){
+		if(!transfer_dir_slot(fs, dir, slot, &node, false) || node.count == 0 || node.count > DIR_INDEX_ENTRIES){
 			return SIZE_MAX;
 		}
-		// read the directory file block 	
-		if(0 == block_store_read(fs->BlockStore_whole,dirInode.directPointer[0],&dirBlock)){
-			return SIZE_MAX;
+		size_t pos = index_position(&node, h);
+		if(pos + 1 < node.count){
+			rangeEnd = node.entries[pos + 1].hash;
 		}
-		// search in the entries of the directory to see if the next directory name is found
-		// use bitmap to jump over uninitialzied(unused) entries
-		bitmap_t * dirBitmap = bitmap_overlay(8,&(dirInode.vacantFile));
-		size_t j=0, found = 0;
-		for(; j<7; j++){
-			if(!bitmap_test(dirBitmap,j)){continue;}		
-			if(strncmp(dirBlock.dentries[j].filename,fn,strlen(fn)) == 0 /* && (0 < dirBlock.dentries[j].inodeNumber)*/){
-				inode_t nextInode; // inode whoes filename is fn
-				// check if it is found and is dir  
-				if((0 != block_store_inode_read(fs->BlockStore_inode,dirBlock.dentries[j].inodeNumber,&nextInode)) && (nextInode.fileType == 'd')){
-					iNum = nextInode.inodeNumber;
-					found = 1;
-				}
-			}
+		if(path != NULL){
+			path->slots[depth] = slot;
+			path->positions[depth] = pos;
+			path->depth = depth + 1;
 		}
-		bitmap_destroy(dirBitmap);
-		// if not found, exit on error
-		if(found == 0){
-			return SIZE_MAX;		
+		slot = node.entries[pos].slot;
+		if(node.level == 0){
+			if(end != NULL){
+				*end = rangeEnd;
+			}
+			return slot;
 		}
-		fn = strtok(NULL,"/");
 	}
-	return iNum;
-} 
+	return SIZE_MAX;
+}
 
-// check if the file already exists under the designated directory, if so, get the file's inode number
-// \param fs F17FS containing the file
-// \param dirInodeID The inode number of the directory
-// \param filename Name of the file to look for
-// return the file's inode number if the file is already created (exists), or 0 otherwise
-size_t getFileInodeID(F17FS_t *fs, size_t dirInodeID, char *filename){
-	// file aready exists?? use iNum as the inode number of the parent dir to search if this directory already contains the file/dir to be created
-	inode_t parentInode; // inode for the parent directory of the destinated file/dir
-	directoryBlock_t parentDir; // directory file block of the parent directory
-	if((0==block_store_inode_read(fs->BlockStore_inode,dirInodeID,&parentInode)) || (0==block_store_read(fs->BlockStore_whole, parentInode.directPointer[0],&parentDir))){
-		return 0;
+// what a directory entry keeps of its name (of name_hash hash) to tell it from others without comparing
+//  the names: the top 24 bits of the hash and the length. Never zero
+static uint32_t name_fingerprint(const char *name, uint32_t hash){
+	return (hash & 0xFFFFFF00u) | (uint32_t) strnlen(name, FS_FNAME_MAX - 1);
+}
+
+// the entry in use of a directory block with the given name, SIZE_MAX if there is none
+// names are only compared for the entries with the name's fingerprint, or with none (older images)
+// \param used The entries in use (vacantFile) of a directory that isn't hashed; NULL for the leaves of
+//  hashed directories, where the entries in use are those with a name
+static size_t find_dentry(const directoryBlock_t *block, const bitmap_t *used, const char *name, uint32_t fingerprint){
+	unsigned candidates = 0;	// bit i for entry i
+#ifdef F17FS_USE_SSE2
+	// entries 0-3 and 3-6, each compared to the fingerprint and to zero at once
+	const __m128i want = _mm_set1_epi32((int) fingerprint), none = _mm_setzero_si128();
+	const __m128i low = _mm_loadu_si128((const __m128i *) &block->fingerprints[0]);
+	const __m128i high = _mm_loadu_si128((const __m128i *) &block->fingerprints[3]);
+	candidates = (unsigned) _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(low, want), _mm_cmpeq_epi32(low, none))))
+		| (unsigned) _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(high, want), _mm_cmpeq_epi32(high, none)))) << 3;
+#else
+	for(size_t i = 0; i < 7; i++){
+		if(block->fingerprints[i] == fingerprint || block->fingerprints[i] == 0){
+			candidates |= 1u << i;
+		}
 	}
-	// use bitmap to jump over uninitialized(unused) entries
-	bitmap_t *parentBitmap = bitmap_overlay(8, &(parentInode.vacantFile)); 	
-	int k=0;
-	for(; k<7; k++){
-		if(bitmap_test(parentBitmap,k)){
-			if(0 == strncmp(parentDir.dentries[k].filename,filename,strlen(filename)) /* && 0 < parentDir.dentries[k].inodeNumber*/){
-				// DO NOT worry about same name but different file type.
-				// files can't have same name, regardless of file type.
-				//inode_t tempInode;
-				//if((0 != block_store_inode_read(fs->BlockStore_inode,parentDir.dentries[k].inodeNumber,&tempInode)) && (tempInode.fileType == fileType)){
-		        	// printf("path: %s\nfilename already exists: %s\n",path,parentDir.dentries[k].filename);	
-				bitmap_destroy(parentBitmap);
-				return parentDir.dentries[k].inodeNumber;
-				//}
-			}
+#endif
+	for(size_t i = 0; i < 7; i++){
+		if(!(candidates & (1u << i))){
+			continue;
+		}
+		bool inUse = used != NULL ? bitmap_test(used, i) : block->dentries[i].filename[0] != '\0';
+		if(inUse && 0 == strncmp(block->dentries[i].filename, name, FS_FNAME_MAX)){
+			return i;
 		}
 	}
-	bitmap_destroy(parentBitmap);
-	return 0;
-}	
+	return SIZE_MAX;
+}
 
-///
-/// Creates a new file at the specified location
-///   Directories along the path that do not exist are not created
-/// \param fs The F17FS containing the file
-/// \param path Absolute path to file to create
-/// \param type Type of file to create (regular/directory)
-/// \return 0 on success, < 0 on failure
-//
-int fs_create(F17FS_t *fs, const char *path, file_t type){
-	if(fs == NULL || path == NULL || (type != FS_REGULAR && type != FS_DIRECTORY) || strlen(path) <= 1){
-		return -1;
+// look a name up in a directory
+// \param type Receives the fileType kept with the entry found, 0 in older images
+// return its inode number, SIZE_MAX if it isn't there (or on error)
+static size_t dir_lookup(F17FS_t *fs, inode_t *dir, const char *name, char *type){
+	const uint32_t hash = name_hash(name), fingerprint = name_fingerprint(name, hash);
+	size_t i, found = SIZE_MAX;
+	if(dir->flags & INODE_HASHED_DIR){
+		directoryBlock_t leaf;
+		size_t slot = find_leaf(fs, dir, hash, NULL, NULL);
+		if(slot != SIZE_MAX && transfer_dir_slot(fs, dir, slot, &leaf, false) && SIZE_MAX != (i = find_dentry(&leaf, NULL, name, fingerprint))){
+			found = dentry_inode(&leaf, i);
+			*type = leaf.types[i];
+		}
+		return found;
 	}
-	// check if inode table is full
-	if(block_store_get_used_blocks(fs->BlockStore_inode) >= 256){
-		return -2;
+	// the directory block is looked at in place (a view)
+	const directoryBlock_t *block = block_store_view(fs->BlockStore_whole, dir->directPointer[0]);
+	if(block == NULL){
+		return SIZE_MAX;
 	}
-	// valid path must start with '/'
-	char firstChar = *path;
-	//printf("path: %s\nfirstChar: %c\n",path,firstChar);
-	if(firstChar != '/'){return -3;}
-	// path cannot end with "/"
-	char lastChar = path[strlen(path)-1];
-	//printf("path: %s\nlastChar: %c\n",path,lastChar);
-	if(lastChar == '/'){return -4;}
-	char dirc[strlen(path)+1]; // p is the non const copy of path
-	char basec[strlen(path)+1];
-	strcpy(dirc,path);
-	strcpy(basec,path);
-	char *dirPath = dirname(dirc);
-	char *baseFileName = basename(basec);
-	//printf("path: %s\ndirPath: %s\nbaseFileName: %s\n",path,dirPath,baseFileName);
-	if(strlen(baseFileName)>=64){return -5;}
+	bitmap_t *used = bitmap_overlay(8, &dir->vacantFile);
+	if(SIZE_MAX != (i = find_dentry(block, used, name, fingerprint))){
+		found = dentry_inode(block, i);
+		*type = block->types[i];
+	}
+	bitmap_destroy(used);
+	block_store_unpin(fs->BlockStore_whole, dir->directPointer[0]);
+	return found;
+}
 
-	// set fileType
-	char fileType = 'r';
-	if(type == FS_DIRECTORY){fileType = 'd';}
+// the dcache entry (parent, name) would have, with its dcache_hash in *hash
+// return NULL for names too long to be cached
+static dentry_t *dcache_slot(F17FS_t *fs, size_t parent, const char *name, uint32_t *hash){
+	if(strnlen(name, FS_FNAME_MAX) == FS_FNAME_MAX){
+		return NULL;
+	}
+	*hash = name_hash(name) ^ ((uint32_t) parent * 0x9E3779B1u);
+	return &fs->dcache[*hash % DCACHE_ENTRIES];
+}
 
-	// search and check if the directory name "fn" along the path are valid
-	size_t iNum; // inode number of the searched directory inode
-	iNum = searchPath(fs,dirPath);
-	if(iNum == SIZE_MAX){return -6;}
+// the dcache entry of (parent, name), NULL if it isn't cached
+static dentry_t *dcache_find(F17FS_t *fs, size_t parent, const char *name){
+	uint32_t hash;
+	dentry_t *entry = dcache_slot(fs, parent, name, &hash);
+	if(entry == NULL || entry->state == DCACHE_EMPTY || entry->hash != hash || entry->parent != parent
+		|| 0 != strncmp(entry->name, name, FS_FNAME_MAX)){
+		return NULL;
+	}
+	return entry;
+}
 
-	// file aready exists?? use iNum as the inode number of the parent dir to search if this directory already contains the file/dir to be created
-	if(0!=getFileInodeID(fs,iNum,baseFileName)){ return -7;}		
-	
-	inode_t parentInode; // get the inode for the parent directory of the destinated file/dir
-	directoryBlock_t parentDir; // get the directory file block of the parent directory
-	if((0==block_store_inode_read(fs->BlockStore_inode,iNum,&parentInode)) || (0==block_store_read(fs->BlockStore_whole, parentInode.directPointer[0],&parentDir))){
-		return -8;
-	}
-
-	// check if the dir block is full of entries using bitmap
-	// only 7 entries are allowed in a directory, 0 - 6 bit, not including 7
-	size_t available = 7;
-	bitmap_t *bmp = bitmap_overlay(8,&(parentInode.vacantFile));
-	available = bitmap_ffz(bmp);
-	//printf("path: %s\ndirPath: %s\navailable: %lu\n\n",path,dirPath,available);
-	if(available == SIZE_MAX || available == 7){
-		bitmap_destroy(bmp);
-		return -9;
-	} 
-	bitmap_set(bmp, available);
-	bitmap_destroy(bmp);
+// cache what looking name up in parent gives: inodeID of the given type (0 if unknown), DCACHE_NEGATIVE if SIZE_MAX
+static void dcache_store(F17FS_t *fs, size_t parent, const char *name, size_t inodeID, char type){
+	uint32_t hash;
+	dentry_t *entry = dcache_slot(fs, parent, name, &hash);
+	if(entry != NULL){
+		entry->parent = parent;
+		entry->hash = hash;
+		entry->state = inodeID == SIZE_MAX ? DCACHE_NEGATIVE : DCACHE_POSITIVE;
+		entry->inode = inodeID == SIZE_MAX ? 0 : inodeID;
+		entry->type = type;
+		strncpy(entry->name, name, FS_FNAME_MAX);
+	}
+}
 
-	// allocate a new inode for the new file and get its inode number
-	size_t newInodeID = block_store_sub_allocate(fs->BlockStore_inode);
-	// create a new inode for the file
-	inode_t newInode;
-	newInode.fileType = fileType;
-	if(fileType == 'd'){ // If create a directory
-		newInode.vacantFile = 0x00;
-		// allocate a block for the directory entries
-		size_t directoryBlockPointer = block_store_allocate(fs->BlockStore_whole);
-		if(SIZE_MAX == directoryBlockPointer){
-			return -12;
-		} 
-		newInode.directPointer[0] = directoryBlockPointer;
-		directoryBlock_t newDirBlock = init_dirBlock();
-		block_store_write(fs->BlockStore_whole, newInode.directPointer[0],&newDirBlock);
-		newInode.fileSize = BLOCK_SIZE_BYTES;	
-	} else { // If to create a file
-		newInode.fileSize = 0;
-		int i=0;
-		for(;i<6;i++){
-			newInode.directPointer[i] = 0x0000;
-		}	
-		newInode.indirectPointer = 0x0000;
-		newInode.doubleIndirectPointer = 0x0000;
-		// Not need to allocate an empty data block for the file.
-		// The get_data_block_id will take care of allocation of the data blocks when writing data to the file
-		
+// drop whatever is cached for name in parent
+static void dcache_forget(F17FS_t *fs, size_t parent, const char *name){
+	dentry_t *entry = dcache_find(fs, parent, name);
+	if(entry != NULL){
+		entry->state = DCACHE_EMPTY;
 	}
-	newInode.inodeNumber = newInodeID;
-	newInode.linkCount = 1;
-	// write the created inode to the inode table
-	block_store_inode_write(fs->BlockStore_inode,newInodeID,&newInode);
-	
-	// write it to the block store
-	if(64 != block_store_inode_write(fs->BlockStore_inode, parentInode.inodeNumber, &parentInode)){
-		return -10;
+}
+
+// look a name up in a directory, through the dcache
+// \param type Receives the fileType of the inode found, if not NULL
+// return its inode number, SIZE_MAX if it isn't there (or on error)
+static size_t dir_find(F17FS_t *fs, size_t dirInodeID, const char *name, char *type){
+	dentry_t *entry = dcache_find(fs, dirInodeID, name);
+	inode_t inode;
+	if(entry == NULL){
+		char foundType = 0;
+		size_t found;
+		if(0 == read_inode(fs, dirInodeID, &inode)){
+			return SIZE_MAX;
+		}
+		found = dir_lookup(fs, &inode, name, &foundType);
+		dcache_store(fs, dirInodeID, name, found, foundType);
+		if(NULL == (entry = dcache_find(fs, dirInodeID, name))){
+			return found;	// too long a name to cache, found is SIZE_MAX then
+		}
 	}
-	// add a new entry of filename and inode number to the parentDir 
-	directoryFile_t df;
-	strcpy(df.filename, baseFileName);
-	df.inodeNumber = newInodeID; 
-	//printf("baseFileName: %s inodeNumber: %d\n", baseFileName, newInodeID);
-	parentDir.dentries[available] = df;
-	if(0==block_store_write(fs->BlockStore_whole,parentInode.directPointer[0],&parentDir)){
-		return -11;
+	if(entry->state == DCACHE_NEGATIVE){
+		return SIZE_MAX;
 	}
-	
-	// printf("dirPath: %s \n baseName: %s\n",dirPath, baseFileName);
-	return 0;   
+	if(type != NULL){
+		if(entry->type == 0){
+			if(0 == read_inode(fs, entry->inode, &inode)){
+				return SIZE_MAX;
+			}
+			entry->type = inode.fileType;
+		}
+		*type = entry->type;
+	}
+	return entry->inode;
 }
 
-///
-/// Opens the specified file for use
-///   R/W position is set to the beginning of the file (BOF)
-///   Directories cannot be opened
-/// \param fs The F17FS containing the file
-/// \param path path to the requested file
-/// \return file descriptor to the requested file, < 0 on error
-///
-int fs_open(F17FS_t *fs, const char *path){
-	if(fs == NULL || path == NULL || strlen(path) <= 1){
-		return -1;
+// add delta to the count of names in a hashed directory's root
+// return true on success, false on error
+static bool count_names(F17FS_t *fs, inode_t *dir, int delta){
+	dirIndex_t root;
+	if(!transfer_dir_slot(fs, dir, 0, &root, false)){
+		return false;
 	}
-	// valid path must start with '/'
-	char firstChar = *path;
-	//printf("path: %s\nfirstChar: %c\n",path,firstChar);
-	if(firstChar != '/'){return -2;}
-	// path cannot end with "/"
-	char lastChar = path[strlen(path)-1];
-	//printf("path: %s\nlastChar: %c\n",path,lastChar);
-	if(lastChar == '/'){return -3;}
+	root.names += delta;
+	return transfer_dir_slot(fs, dir, 0, &root, true);
+}
 
-	char dirc[strlen(path)+1]; // p is the non const copy of path
-	char basec[strlen(path)+1];
-	strcpy(dirc,path);
-	strcpy(basec,path);
-	char *dirPath = dirname(dirc);
-	char *baseFileName = basename(basec);
-	//printf("path: %s\ndirPath: %s\nbaseFileName: %s\n",path,dirPath,baseFileName);
-	if(strlen(baseFileName)>=64){return -4;}
-
-	size_t dirInodeID = searchPath(fs,dirPath);
-	if(dirInodeID == SIZE_MAX){return -5;} // No such path for the dir containing the requested file
-	size_t fileInodeID = getFileInodeID(fs,dirInodeID,baseFileName);
-	if(fileInodeID == 0){return -6;} // No such file is found
-	inode_t fileInode;
-	if(0 == block_store_inode_read(fs->BlockStore_inode,fileInodeID,&fileInode)){return -7;} // get the inode object of the file
-	if('d'==fileInode.fileType){return -8;} // file can't be directory
+// whether a directory has no entries
+static bool dir_is_empty(F17FS_t *fs, inode_t *dir){
+	if(!(dir->flags & INODE_HASHED_DIR)){
+		return dir->vacantFile == 0x00;
+	}
+	dirIndex_t root;
+	return transfer_dir_slot(fs, dir, 0, &root, false) && root.names == 0;
+}
+
+// turn a full directory into a hashed one: its entries move to a leaf in slot 1, slot 0 becomes the root
+// return true on success, false on error or out of space
+static bool make_hashed(F17FS_t *fs, inode_t *dir, const directoryBlock_t *block){
+	directoryBlock_t leaf = init_dirBlock();
+	dirIndex_t root;
+	memset(&root, 0, sizeof(dirIndex_t));
+	bitmap_t *used = bitmap_overlay(8, &dir->vacantFile);
+	for(size_t i = 0; i < 7; i++){
+		if(bitmap_test(used, i)){
+			copy_dentry(&leaf, i, block, i);
+			root.names++;
+		}
+	}
+	bitmap_destroy(used);
+	// the image isn't for older code anymore, that has to be on the disk first. The inodes older code wrote
+	//  may have anything in their flags, written back through read_inode they have none
+	if(!(fs->super.features & FS_FEATURE_HASHED_DIRS)){
+		for(size_t i = 0; !fs->wideIds && i < INODE_COUNT; i++){
+			inode_t inode;
+			if(0 == read_inode(fs, i, &inode) || 0 == write_inode(fs, i, &inode)){
+				return false;
+			}
+		}
+		fs->super.features |= FS_FEATURE_HASHED_DIRS;
+		if(!write_superblock(fs)){
+			return false;
+		}
+	}
+	const uint64_t fileSize = dir->fileSize;
+	dir->fileSize = DIR_SLOT_BYTES;	// the slots after the first are free
+	size_t slot = append_dir_slot(fs, dir);
+	root.count = 1;
+	root.entries[0].slot = slot;
+	if(slot == SIZE_MAX || !transfer_dir_slot(fs, dir, slot, &leaf, true) || !transfer_dir_slot(fs, dir, 0, &root, true)){
+		dir->fileSize = fileSize;
+		return false;
+	}
+	dir->vacantFile = 0x00;
+	dir->flags |= INODE_HASHED_DIR;
+	return true;
+}
+
+// the slots add_to_index takes to add an entry under path: one for each full node from the bottom up, and
+//  one more when that reaches the root (which moves down into two nodes)
+// return 0 on success, -1 when the index can't get any deeper, -2 on error
+static int index_slots_needed(F17FS_t *fs, inode_t *dir, const dirPath_t *path, size_t *needed){
+	*needed = 0;
+	for(size_t d = path->depth; d-- > 0;){
+		dirIndex_t node;
+		if(!transfer_dir_slot(fs, dir, path->slots[d], &node, false)){
+			return -2;
+		}
+		if(node.count < DIR_INDEX_ENTRIES){
+			return 0;
+		}
+		if(d == 0){
+			if(node.level + 1 >= DIR_MAX_LEVELS){
+				return -1;
+			}
+			(*needed)++;
+		}
+		(*needed)++;
+	}
+	return 0;
+}
+
+// add (hash, slot) to the index after the entry taken at each level of path, from the bottom up: a full
+//  node splits in half and the new half goes in the level above; a full root moves down into two nodes
+// \param spare The index_slots_needed slots, already in the directory file, taken in order
+// return 0 on success, -1 when the index can't get any deeper, -2 on error
+static int add_to_index(F17FS_t *fs, inode_t *dir, const dirPath_t *path, uint32_t hash, size_t slot, const size_t *spare){
+	dirIndexEntry_t entry = {hash, (uint32_t)slot};
+	for(size_t d = path->depth; d-- > 0;){
+		dirIndex_t node;
+		if(!transfer_dir_slot(fs, dir, path->slots[d], &node, false)){
+			return -2;
+		}
+		// the node's entries with the new one in place
+		dirIndexEntry_t entries[DIR_INDEX_ENTRIES + 1];
+		const size_t pos = path->positions[d] + 1, count = node.count + 1;
+		memcpy(entries, node.entries, pos * sizeof(dirIndexEntry_t));
+		entries[pos] = entry;
+		memcpy(entries + pos + 1, node.entries + pos, (node.count - pos) * sizeof(dirIndexEntry_t));
+		if(count <= DIR_INDEX_ENTRIES){
+			memcpy(node.entries, entries, count * sizeof(dirIndexEntry_t));
+			node.count = count;
+			return transfer_dir_slot(fs, dir, path->slots[d], &node, true) ? 0 : -2;
+		}
+		if(d == 0 && node.level + 1 >= DIR_MAX_LEVELS){
+			return -1;
+		}
+		dirIndex_t upper;
+		memset(&upper, 0, sizeof(dirIndex_t));
+		upper.level = node.level;
+		upper.count = count - count / 2;
+		memcpy(upper.entries, entries + count / 2, upper.count * sizeof(dirIndexEntry_t));
+		dirIndex_t root = node;
+		node.count = count / 2;
+		node.names = 0;
+		memset(node.entries, 0, sizeof(node.entries));
+		memcpy(node.entries, entries, node.count * sizeof(dirIndexEntry_t));
+		const size_t upperSlot = *spare++;
+		if(d > 0){
+			if(!transfer_dir_slot(fs, dir, upperSlot, &upper, true) || !transfer_dir_slot(fs, dir, path->slots[d], &node, true)){
+				return -2;
+			}
+			entry = (dirIndexEntry_t){upper.entries[0].hash, (uint32_t)upperSlot};
+			continue;
+		}
+		// the root stays in slot 0 (keeping the count of names), both halves move out under it
+		const size_t lowerSlot = *spare++;
+		root.level = node.level + 1;
+		root.count = 2;
+		memset(root.entries, 0, sizeof(root.entries));
+		root.entries[0] = (dirIndexEntry_t){0, (uint32_t)lowerSlot};
+		root.entries[1] = (dirIndexEntry_t){upper.entries[0].hash, (uint32_t)upperSlot};
+		return transfer_dir_slot(fs, dir, lowerSlot, &node, true) && transfer_dir_slot(fs, dir, upperSlot, &upper, true)
+				&& transfer_dir_slot(fs, dir, 0, &root, true) ? 0 : -2;
+	}
+	return -2;
+}
+
+// split a full leaf and the entry that didn't fit into two leaves, in hash order, and index the new one
+// the split goes where the hash changes as near the middle as it can, so a hash is never in two leaves.
+//  Every slot it takes is added before anything is written, out of space the directory is left as it was
+// return 0 on success, -1 when all 8 names have the same hash (or the index is too deep), -2 on error or out of space
+static int split_leaf(F17FS_t *fs, inode_t *dir, const dirPath_t *path, size_t leafSlot, const directoryBlock_t *leaf,
+		const char *name, uint32_t hash, size_t inodeID, char type){
+	struct {
+		uint32_t hash;
+		size_t entry;	// 7 for the new one
+	} order[8], next;
+	for(size_t i = 0; i < 8; i++){
+		next.hash = i < 7 ? name_hash(leaf->dentries[i].filename) : hash;
+		next.entry = i;
+		size_t j = i;
+		for(; j > 0 && order[j - 1].hash > next.hash; j--){
+			order[j] = order[j - 1];
+		}
+		order[j] = next;
+	}
+	static const size_t splits[] = {4, 3, 5, 2, 6, 1, 7};
+	size_t split = 0;
+	for(size_t c = 0; c < 7 && split == 0; c++){
+		if(order[splits[c] - 1].hash != order[splits[c]].hash){
+			split = splits[c];
+		}
+	}
+	if(split == 0){
+		return -1;
+	}
+	directoryBlock_t halves[2] = {init_dirBlock(), init_dirBlock()};
+	for(size_t k = 0; k < 8; k++){
+		directoryBlock_t *half = &halves[k >= split];
+		const size_t at = k >= split ? k - split : k;
+		if(order[k].entry < 7){
+			copy_dentry(half, at, leaf, order[k].entry);
+		} else {
+			strncpy(half->dentries[at].filename, name, FS_FNAME_MAX);
+			set_dentry_inode(half, at, inodeID);
+			half->types[at] = type;
+			half->fingerprints[at] = name_fingerprint(name, hash);
+		}
+	}
+	size_t needed, slots[DIR_MAX_LEVELS + 2];	// the new leaf's, then add_to_index's
+	int result = index_slots_needed(fs, dir, path, &needed);
+	if(result != 0){
+		return result;
+	}
+	const uint64_t fileSize = dir->fileSize;
+	for(size_t k = 0; k <= needed; k++){
+		if(SIZE_MAX == (slots[k] = append_dir_slot(fs, dir))){
+			dir->fileSize = fileSize;	// blocks mapped stay with the file, the next slots added take them
+			return -2;
+		}
+	}
+	// the old leaf keeps all its entries until the new one is indexed
+	if(!transfer_dir_slot(fs, dir, slots[0], &halves[1], true)){
+		return -2;
+	}
+	result = add_to_index(fs, dir, path, order[split].hash, slots[0], slots + 1);
+	if(result == 0 && !transfer_dir_slot(fs, dir, leafSlot, &halves[0], true)){
+		result = -2;
+	}
+	return result;
+}
+
+// add an entry to a directory, which becomes a hashed directory when it runs out of room
+// \param type The fileType of inodeID
+// return 0 on success, -1 when the directory can't take the name (see split_leaf), -2 on error or out of space
+static int dir_insert(F17FS_t *fs, size_t dirInodeID, const char *name, size_t inodeID, char type){
+	inode_t dir;
+	if(0 == read_inode(fs, dirInodeID, &dir)){
+		return -2;
+	}
+	// whatever looking the name up gave before may not hold any more
+	dcache_forget(fs, dirInodeID, name);
+	const uint32_t hash = name_hash(name);
+	if(!(dir.flags & INODE_HASHED_DIR)){
+		directoryBlock_t block;
+		if(0 == read_directory(fs, dir.directPointer[0], &block)){
+			return -2;
+		}
+		// only 7 entries are allowed in a directory block, 0 - 6 bit, not including 7
+		bitmap_t *used = bitmap_overlay(8, &dir.vacantFile);
+		size_t available = bitmap_ffz(used);
+		if(available < 7){
+			bitmap_set(used, available);
+			bitmap_destroy(used);
+			memset(block.dentries[available].filename, '\0', FS_FNAME_MAX);
+			strncpy(block.dentries[available].filename, name, FS_FNAME_MAX);
+			set_dentry_inode(&block, available, inodeID);
+			block.types[available] = type;
+			block.fingerprints[available] = name_fingerprint(name, hash);
+			return write_directory(fs, dir.directPointer[0], &block) && write_inode(fs, dirInodeID, &dir) ? 0 : -2;
+		}
+		bitmap_destroy(used);
+		if(!make_hashed(fs, &dir, &block)){
+			return -2;
+		}
+	}
+	dirPath_t path;
+	directoryBlock_t leaf;
+	int result = -2;
+	size_t slot = find_leaf(fs, &dir, hash, &path, NULL), i;
+	if(slot != SIZE_MAX && transfer_dir_slot(fs, &dir, slot, &leaf, false)){
+		for(i = 0; i < 7 && leaf.dentries[i].filename[0] != '\0'; i++){
+		}
+		if(i < 7){
+			strncpy(leaf.dentries[i].filename, name, FS_FNAME_MAX);
+			set_dentry_inode(&leaf, i, inodeID);
+			leaf.types[i] = type;
+			leaf.fingerprints[i] = name_fingerprint(name, hash);
+			result = transfer_dir_slot(fs, &dir, slot, &leaf, true) ? 0 : -2;
+		} else {
+			result = split_leaf(fs, &dir, &path, slot, &leaf, name, hash, inodeID, type);
+		}
+		if(result == 0 && !count_names(fs, &dir, 1)){
+			result = -2;
+		}
+		if(result == 0){
+			dcache_store(fs, dirInodeID, name, inodeID, type);
+		}
+	}
+	// whatever happened, slots added stay in the directory file
+	return write_inode(fs, dirInodeID, &dir) ? result : -2;
+}
+
+// remove the entry with the given name from a directory
+// return the inode number it had, SIZE_MAX if there is none (or on error)
+static size_t dir_remove(F17FS_t *fs, size_t dirInodeID, const char *name){
+	inode_t dir;
+	directoryBlock_t block;
+	size_t i, removed;
+	if(0 == read_inode(fs, dirInodeID, &dir)){
+		return SIZE_MAX;
+	}
+	dcache_forget(fs, dirInodeID, name);
+	const uint32_t hash = name_hash(name), fingerprint = name_fingerprint(name, hash);
+	if(dir.flags & INODE_HASHED_DIR){
+		size_t slot = find_leaf(fs, &dir, hash, NULL, NULL);
+		if(slot == SIZE_MAX || !transfer_dir_slot(fs, &dir, slot, &block, false) || SIZE_MAX == (i = find_dentry(&block, NULL, name, fingerprint))){
+			return SIZE_MAX;
+		}
+		removed = dentry_inode(&block, i);
+		memset(block.dentries[i].filename, '\0', FS_FNAME_MAX);
+		set_dentry_inode(&block, i, 0);
+		block.types[i] = '\0';
+		block.fingerprints[i] = 0;
+		if(!transfer_dir_slot(fs, &dir, slot, &block, true) || !count_names(fs, &dir, -1)){
+			return SIZE_MAX;
+		}
+		dcache_store(fs, dirInodeID, name, SIZE_MAX, 0);
+		return removed;
+	}
+	if(0 == read_directory(fs, dir.directPointer[0], &block)){
+		return SIZE_MAX;
+	}
+	bitmap_t *used = bitmap_overlay(8, &dir.vacantFile);
+	if(SIZE_MAX != (i = find_dentry(&block, used, name, fingerprint))){
+		bitmap_reset(used, i);
+	}
+	bitmap_destroy(used);
+	if(i == SIZE_MAX){
+		return SIZE_MAX;
+	}
+	removed = dentry_inode(&block, i);
+	memset(block.dentries[i].filename, '\0', FS_FNAME_MAX);
+	set_dentry_inode(&block, i, 0);
+	block.types[i] = '\0';
+	block.fingerprints[i] = 0;
+	return write_directory(fs, dir.directPointer[0], &block) && write_inode(fs, dirInodeID, &dir) ? removed : SIZE_MAX;
+}
+
+// where a listing of a directory carries on (fs_dir_t.cursor): the hash of the next entry shifted left 8
+//  bits, with how many entries of that hash were listed already in the low 8 bits. A hash never spans two
+//  leaves, so a cursor stays right while leaves split
+#define DIR_CURSOR_END ((uint64_t)1 << 40)
+
+// fill records with the entries of a directory from *cursor on, moving the cursor past them
+// entries are listed in the order of their (name_hash, name), a leaf at a time, directories that aren't hashed
+//  included; their type is the one kept in the directory block, the inode is only read for older images
+// return the number of records filled, 0 at the end, < 0 on error
+static ssize_t dir_read(F17FS_t *fs, inode_t *dir, uint64_t *cursor, file_record_t *records, size_t count){
+	size_t filled = 0;
+	while(filled < count && *cursor < DIR_CURSOR_END){
+		const uint32_t hash = (uint32_t)(*cursor >> 8);
+		size_t skip = *cursor & 0xFF, n = 0, k;
+		uint64_t end = DIR_CURSOR_END >> 8;	// the first hash of the next leaf
+		directoryBlock_t block;
+		bitmap_t *used = NULL;
+		if(dir->flags & INODE_HASHED_DIR){
+			size_t slot = find_leaf(fs, dir, hash, NULL, &end);
+			if(slot == SIZE_MAX || !transfer_dir_slot(fs, dir, slot, &block, false)){
+				return -1;
+			}
+		} else {
+			if(0 == read_directory(fs, dir->directPointer[0], &block)){
+				return -1;
+			}
+			used = bitmap_overlay(8, &dir->vacantFile);
+		}
+		// the entries in use from hash on, in order
+		struct {
+			uint32_t hash;
+			size_t entry;
+		} order[7], next;
+		for(size_t i = 0; i < 7; i++){
+			if(used != NULL ? !bitmap_test(used, i) : block.dentries[i].filename[0] == '\0'){
+				continue;
+			}
+			next.hash = name_hash(block.dentries[i].filename);
+			next.entry = i;
+			if(next.hash < hash){
+				continue;
+			}
+			for(k = n++; k > 0 && (order[k - 1].hash > next.hash || (order[k - 1].hash == next.hash
+				&& strncmp(block.dentries[order[k - 1].entry].filename, block.dentries[i].filename, FS_FNAME_MAX) > 0)); k--){
+				order[k] = order[k - 1];
+			}
+			order[k] = next;
+		}
+		bitmap_destroy(used);
+		for(k = 0; k < n && filled < count; k++){
+			if(order[k].hash == hash && skip > 0){
+				skip--;
+				continue;
+			}
+			const size_t e = order[k].entry;
+			file_record_t *record = &records[filled++];
+			memcpy(record->name, block.dentries[e].filename, FS_FNAME_MAX);
+			char type = block.types[e];
+			inode_t inode;
+			if(type != 'd' && type != 'r'){
+				type = read_inode(fs, dentry_inode(&block, e), &inode) ? inode.fileType : 'r';
+			}
+			record->type = type == 'd' ? FS_DIRECTORY : FS_REGULAR;
+			*cursor = order[k].hash == (uint32_t)(*cursor >> 8) ? *cursor + 1 : ((uint64_t)order[k].hash << 8) + 1;
+		}
+		if(k == n){
+			*cursor = end << 8;	// on to the next leaf
+		}
+	}
+	return filled;
+}
+
+// a path split into its names as it is walked, in place: nothing is copied and the iterator keeps no state
+//  outside itself, so it is reentrant. resolve_path isn't: the lookups fill the dentry cache and pin blocks
+typedef struct {
+	const char *next;	// the rest of the path, after the current name
+	const char *name;	// the current name, length characters of the path
+	size_t length;
+} pathIter_t;
+
+// move on to the next name of a path, slashes in a row count as one
+// return false when there are no more names
+static bool path_next(pathIter_t *it){
+	it->name = it->next + strspn(it->next, "/");
+	if(*it->name == '\0'){
+		return false;
+	}
+	it->length = strcspn(it->name, "/");
+	it->next = it->name + it->length;
+	return true;
+}
+
+// a path resolved by resolve_path
+typedef struct {
+	size_t parent;	// inode of the directory the last name is in, SIZE_MAX if the path to it doesn't exist
+			//  (or there are no names, the path is the directory it starts from)
+	size_t inode;	// inode of the last name, SIZE_MAX if there is none (where it starts for no names)
+	char type;	// fileType of inode
+	bool tooLong;	// the last name has FS_FNAME_MAX characters or more, name has as many as fit
+	char name[FS_FNAME_MAX];	// the last name, "" without names
+} pathTarget_t;
+
+// walk a path once, looking each name up (through the dcache) in the directory named before it
+// the names past one that doesn't exist, or isn't a directory, are only parsed: the last one is still reported
+// \param start The directory inode a relative path starts from, absolute paths start from the root
+static void resolve_path(F17FS_t *fs, size_t start, const char *path, pathTarget_t *target){
+	pathIter_t it = {path, path, 0};
+	size_t current = *path == '/' ? 0 : start;
+	char type = 'd';
+	target->parent = SIZE_MAX;
+	target->tooLong = false;
+	target->name[0] = '\0';
+	while(path_next(&it)){
+		target->tooLong = it.length >= FS_FNAME_MAX;
+		size_t copied = target->tooLong ? FS_FNAME_MAX - 1 : it.length;
+		memcpy(target->name, it.name, copied);
+		target->name[copied] = '\0';
+		if(current == SIZE_MAX || type != 'd'){
+			target->parent = current = SIZE_MAX;
+			continue;
+		}
+		target->parent = current;
+		current = target->tooLong ? SIZE_MAX : dir_find(fs, current, target->name, &type);
+	}
+	target->inode = current;
+	target->type = current == SIZE_MAX ? 0 : type;
+}
+
+// fs_create and fs_createat: create a file at a valid path, relative paths starting from the directory inode start
+static int create_in(F17FS_t *fs, size_t start, const char *path, file_t type){
+	// path cannot end with "/"
+	char lastChar = path[strlen(path)-1];
+	//printf("path: %s\nlastChar: %c\n",path,lastChar);
+	if(lastChar == '/'){return -4;}
+	// one walk finds the parent directory and whether the name is in it already
+	pathTarget_t target;
+	resolve_path(fs,start,path,&target);
+	if(target.tooLong){return -5;}
+
+	// set fileType
+	char fileType = 'r';
+	if(type == FS_DIRECTORY){fileType = 'd';}
+
+	// the directories along the path have to exist
+	size_t iNum = target.parent; // inode number of the parent directory
+	if(iNum == SIZE_MAX){return -6;}
+
+	// file aready exists??
+	if(target.inode != SIZE_MAX){ return -7;}		
+	
+	// allocate a new inode for the new file and get its inode number
+	size_t newInodeID = allocate_inode(fs);
+	if(newInodeID == SIZE_MAX){
+		return -2;
+	}
+	// create a new inode for the file
+	inode_t newInode;
+	memset(&newInode, 0, sizeof(inode_t));
+	newInode.fileType = fileType;
+	if(fileType == 'd'){ // If create a directory
+		newInode.vacantFile = 0x00;
+		// allocate a block for the directory entries
+		size_t directoryBlockPointer = block_store_allocate(fs->BlockStore_whole);
+		if(SIZE_MAX == directoryBlockPointer){
+			release_inode(fs, newInodeID);
+			return -12;
+		} 
+		newInode.directPointer[0] = directoryBlockPointer;
+		directoryBlock_t newDirBlock = init_dirBlock();
+		write_directory(fs,newInode.directPointer[0],&newDirBlock);
+		newInode.fileSize = fs->blockSize;	
+	} else { // If to create a file
+		newInode.fileSize = 0;
+		int i=0;
+		for(;i<6;i++){
+			newInode.directPointer[i] = 0x0000;
+		}	
+		newInode.indirectPointer = 0x0000;
+		newInode.doubleIndirectPointer = 0x0000;
+		// Not need to allocate an empty data block for the file.
+		// map_file_blocks will take care of allocation of the data blocks when writing data to the file
+		
+	}
+	newInode.inodeNumber = newInodeID;
+	newInode.linkCount = 1;
+	// write the created inode to the inode table, then add a new entry of filename and inode number to the parent
+	int added = 64 != write_inode(fs,newInodeID,&newInode) ? -10 : dir_insert(fs,iNum,target.name,newInodeID,fileType);
+	if(added != 0){
+		if(fileType == 'd'){
+			block_store_release(fs->BlockStore_whole,newInode.directPointer[0]);
+		}
+		release_inode(fs,newInodeID);
+		return added == -1 ? -9 : added == -10 ? -10 : -11;
+	}
+	return 0;   
+}
+
+// the directory inode of an open directory handle, SIZE_MAX if it isn't one
+static size_t handle_inode(F17FS_t *fs, int dirfd){
+	if(fs == NULL || dirfd < 0 || dirfd >= DIR_HANDLES || !fs->dirHandles[dirfd].open){
+		return SIZE_MAX;
+	}
+	return fs->dirHandles[dirfd].inode;
+}
+
+///
+/// Creates a new file at the specified location
+///   Directories along the path that do not exist are not created
+/// \param fs The F17FS containing the file
+/// \param path Absolute path to file to create
+/// \param type Type of file to create (regular/directory)
+/// \return 0 on success, < 0 on failure
+//
+int fs_create(F17FS_t *fs, const char *path, file_t type){
+	if(fs == NULL || path == NULL || (type != FS_REGULAR && type != FS_DIRECTORY) || strlen(path) <= 1){
+		return -1;
+	}
+	// valid path must start with '/'
+	char firstChar = *path;
+	//printf("path: %s\nfirstChar: %c\n",path,firstChar);
+	if(firstChar != '/'){return -3;}
+	return create_in(fs,0,path,type);
+}
+
+///
+/// Creates a new file, fs_create with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the file to create, relative to the directory
+/// \param type Type of file to create (regular/directory)
+/// \return 0 on success, < 0 on failure
+///
+int fs_createat(F17FS_t *fs, int dirfd, const char *path, file_t type){
+	size_t start = handle_inode(fs,dirfd);
+	if(start == SIZE_MAX || path == NULL || (type != FS_REGULAR && type != FS_DIRECTORY) || strlen(path) == 0){
+		return -1;
+	}
+	return create_in(fs,start,path,type);
+}
+
+// fs_open and fs_openat: open the file at a valid path, relative paths starting from the directory inode start
+static int open_in(F17FS_t *fs, size_t start, const char *path){
+	// path cannot end with "/"
+	char lastChar = path[strlen(path)-1];
+	//printf("path: %s\nlastChar: %c\n",path,lastChar);
+	if(lastChar == '/'){return -3;}
+
+	pathTarget_t target;
+	resolve_path(fs,start,path,&target);
+	if(target.tooLong){return -4;}
+	if(target.parent == SIZE_MAX){return -5;} // No such path for the dir containing the requested file
+	size_t fileInodeID = target.inode;
+	if(fileInodeID == SIZE_MAX){return -6;} // No such file is found
+	if('d'==target.type){return -8;} // file can't be directory
 	size_t fd = block_store_sub_allocate(fs->BlockStore_fd); // file descriptor ID
 	fileDescriptor_t fd_t;
 	fd_t.inodeNum = fileInodeID;	
@@ -435,9 +1580,44 @@ int fs_open(F17FS_t *fs, const char *path){
 	fd_t.locate_order = 0;
 	fd_t.locate_offset = 0;
 	if(0 == block_store_fd_write(fs->BlockStore_fd,fd,&fd_t)){return -9;}			
+	memset(&fs->readahead[fd], 0, sizeof(readahead_t));	// a read from the start counts as sequential
 	return fd;
 }
 
+///
+/// Opens the specified file for use
+///   R/W position is set to the beginning of the file (BOF)
+///   Directories cannot be opened
+/// \param fs The F17FS containing the file
+/// \param path path to the requested file
+/// \return file descriptor to the requested file, < 0 on error
+///
+int fs_open(F17FS_t *fs, const char *path){
+	if(fs == NULL || path == NULL || strlen(path) <= 1){
+		return -1;
+	}
+	// valid path must start with '/'
+	char firstChar = *path;
+	//printf("path: %s\nfirstChar: %c\n",path,firstChar);
+	if(firstChar != '/'){return -2;}
+	return open_in(fs,0,path);
+}
+
+///
+/// Opens a file, fs_open with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the requested file, relative to the directory
+/// \return file descriptor to the requested file, < 0 on error
+///
+int fs_openat(F17FS_t *fs, int dirfd, const char *path){
+	size_t start = handle_inode(fs,dirfd);
+	if(start == SIZE_MAX || path == NULL || strlen(path) == 0){
+		return -1;
+	}
+	return open_in(fs,start,path);
+}
+
 ///
 /// Closes the given file descriptor
 /// \param fs The F17FS containing the file
@@ -448,234 +1628,583 @@ int fs_close(F17FS_t *fs, int fd){
 	if(fs == NULL || fd < 0){
 		return -1;
 	}
-	if(!block_store_sub_test(fs->BlockStore_fd,fd)){return -2;} // error if fd is not allocated
-	block_store_sub_release(fs->BlockStore_fd,fd); 
-	return 0;
+	if(!block_store_sub_test(fs->BlockStore_fd,fd)){return -2;} // error if fd is not allocated
+	block_store_sub_release(fs->BlockStore_fd,fd); 
+	return 0;
+}
+
+///
+/// Opens a directory as a handle for the *at calls, which look relative paths up from it
+///   The handle stays with the directory when it is moved, and is closed when it is removed
+/// \param fs The F17FS containing the directory
+/// \param path Absolute path to the directory
+/// \return directory handle, < 0 on error
+///
+int fs_opendir_handle(F17FS_t *fs, const char *path){
+	if(fs == NULL || path == NULL || *path != '/'){
+		return -1;
+	}
+	pathTarget_t target;
+	resolve_path(fs,0,path,&target);
+	if(target.inode == SIZE_MAX || target.type != 'd'){
+		return -2;	// no such directory
+	}
+	for(int dh = 0; dh < DIR_HANDLES; dh++){
+		if(!fs->dirHandles[dh].open){
+			fs->dirHandles[dh].open = true;
+			fs->dirHandles[dh].inode = target.inode;
+			return dh;
+		}
+	}
+	return -3;	// all handles are in use
+}
+
+///
+/// Closes a directory handle
+/// \param fs The F17FS containing the directory
+/// \param dirfd The handle to close
+/// \return 0 on success, < 0 on failure
+///
+int fs_closedir_handle(F17FS_t *fs, int dirfd){
+	if(SIZE_MAX == handle_inode(fs,dirfd)){
+		return -1;
+	}
+	fs->dirHandles[dirfd].open = false;
+	return 0;
+}
+
+// fs_get_dir and fs_get_dirat: list the directory at a valid path, relative paths starting from the directory inode start
+static dyn_array_t *get_dir_in(F17FS_t *fs, size_t start, const char *path){
+	// trace down to the directory, which is where the path starts for a path without names
+	pathTarget_t target;
+	resolve_path(fs,start,path,&target);
+	size_t dirInodeID = target.inode;
+	if(dirInodeID == SIZE_MAX || 'd'!=target.type){return NULL;} // No such directory
+	// get the inode block and data block of the directory
+	inode_t dirInode;
+	if(0 == read_inode(fs, dirInodeID, &dirInode)){ return NULL;}
+	
+	// create a dynamic array, data object size is sizeof(file_record_t)
+	dyn_array_t *list = dyn_array_create(15,sizeof(file_record_t),NULL);
+	if(list == NULL){
+		return NULL;
+	}
+	// list the entries a page at a time, their types come with them
+	uint64_t cursor = 0;
+	file_record_t page[16];
+	ssize_t filled;
+	while((filled = dir_read(fs,&dirInode,&cursor,page,16)) > 0){
+		for(ssize_t i = 0; i < filled; i++){
+			if(!dyn_array_push_back(list,&page[i])){
+				filled = -1;
+				break;
+			}
+		}
+		if(filled < 0){
+			break;
+		}
+	}
+	if(filled != 0){
+		dyn_array_destroy(list);
+		return NULL;
+	}
+	return list;
+}
+
+///
+/// Populates a dyn_array with information about the files in a directory
+///   Array contains a file_record_t per entry
+/// \param fs The F17FS containing the file
+/// \param path Absolute path to the directory to inspect
+/// \return dyn_array of file records, NULL on error
+///
+dyn_array_t *fs_get_dir(F17FS_t *fs, const char *path){
+	if(fs == NULL || path == NULL || strlen(path) < 1){
+		return NULL;
+	}
+
+	// validate the pathname
+	// valid path must start with '/'
+	char firstChar = *path;
+	if(firstChar != '/'){
+		return NULL;}
+	return get_dir_in(fs,0,path);
+}
+
+///
+/// Lists a directory, fs_get_dir with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the directory to inspect, relative to the directory; "" for the directory itself
+/// \return dyn_array of file records, NULL on error
+///
+dyn_array_t *fs_get_dirat(F17FS_t *fs, int dirfd, const char *path){
+	size_t start = handle_inode(fs,dirfd);
+	if(start == SIZE_MAX || path == NULL){
+		return NULL;
+	}
+	return get_dir_in(fs,start,path);
+}
+
+///
+/// Opens a directory to be listed with fs_readdir, from the start
+///   The listing holds a directory handle (see fs_opendir_handle) until fs_closedir
+/// \param fs The F17FS containing the directory
+/// \param path Absolute path to the directory
+/// \param dir Receives the listing
+/// \return 0 on success, < 0 on error
+///
+int fs_opendir(F17FS_t *fs, const char *path, fs_dir_t *dir){
+	if(dir == NULL){
+		return -1;
+	}
+	dir->handle = fs_opendir_handle(fs,path);
+	dir->cursor = 0;
+	return dir->handle < 0 ? dir->handle : 0;
+}
+
+///
+/// Lists the next entries of a directory into the caller's records, with no allocation and without reading
+///   the entries' inodes. Entries come in hash order; those added or removed meanwhile may or may not be
+///   listed, the others are listed once
+/// \param fs The F17FS containing the directory
+/// \param dir The listing, its cursor moves past the entries listed
+/// \param records Receives the entries
+/// \param count The number of records there's room for
+/// \return number of records filled, 0 at the end of the directory, < 0 on error
+///
+ssize_t fs_readdir(F17FS_t *fs, fs_dir_t *dir, file_record_t *records, size_t count){
+	size_t dirInodeID = dir != NULL ? handle_inode(fs,dir->handle) : SIZE_MAX;
+	inode_t dirInode;
+	if(dirInodeID == SIZE_MAX || records == NULL){
+		return -1;
+	}
+	if(0 == read_inode(fs,dirInodeID,&dirInode)){
+		return -2;
+	}
+	ssize_t filled = dir_read(fs,&dirInode,&dir->cursor,records,count);
+	return filled < 0 ? -2 : filled;
+}
+
+///
+/// Ends a listing, closing its directory handle
+/// \param fs The F17FS containing the directory
+/// \param dir The listing
+/// \return 0 on success, < 0 on error
+///
+int fs_closedir(F17FS_t *fs, fs_dir_t *dir){
+	if(dir == NULL || fs_closedir_handle(fs,dir->handle) < 0){
+		return -1;
+	}
+	dir->handle = -1;
+	return 0;
+}
+
+//
+// calculate the file size up until the location pointed by fileDescriptor usage, order and offset
+// return size of the file
+size_t getFileSize(F17FS_t *fs, fileDescriptor_t *fd_t){
+		if(fd_t->usage == 1){
+			return fs->blockSize * fd_t->locate_order + fd_t->locate_offset;
+		} else if(fd_t->usage == 2){
+			return fs->blockSize * (DIRECT_BLOCKS + fd_t->locate_order) + fd_t->locate_offset;	
+		} else {
+			return fs->blockSize * (DIRECT_BLOCKS + fs->tableEntries + fd_t->locate_order) + fd_t->locate_offset;
+		}
+} 
+
+
+// set usage, order and offset of the fileDescriptor so that it points at the given byte of the file
+// the inverse of getFileSize
+void setFileLocation(F17FS_t *fs, fileDescriptor_t *fd_t, size_t location){
+	size_t block = location / fs->blockSize;
+	fd_t->locate_offset = location % fs->blockSize;
+	if(block < DIRECT_BLOCKS){
+		fd_t->usage = 1;
+		fd_t->locate_order = block;
+	} else if(block < DIRECT_BLOCKS + fs->tableEntries){
+		fd_t->usage = 2;
+		fd_t->locate_order = block - DIRECT_BLOCKS;
+	} else {
+		fd_t->usage = 4;
+		fd_t->locate_order = block - DIRECT_BLOCKS - fs->tableEntries;
+	}
+}
+
+// a contiguous stretch of free blocks that map_file_blocks hands out one at a time
+typedef struct {
+	size_t next;	// next block id to hand out
+	size_t left;	// blocks left in the current run
+	size_t wanted;	// blocks the caller still expects to need, sizes the next run request
+	size_t hint;	// where to look for the next run: just past the last block of the file seen so far
+} blockRun_t;
+
+// take the next block from the run, grabbing a new contiguous run from the block store when it is used up
+// return the block id, or 0 when out of space
+uint32_t take_run_block(F17FS_t *fs, blockRun_t *run){
+	if(run->left == 0){
+		size_t want = run->wanted ? run->wanted : 1;
+		bool ok = run->hint ? block_store_allocate_run_near(fs->BlockStore_whole, run->hint, want, &run->next, &run->left)
+				: block_store_allocate_run(fs->BlockStore_whole, want, &run->next, &run->left);
+		if(!ok){
+			run->left = 0;
+			return 0;
+		}
+	}
+	run->left--;
+	if(run->wanted){
+		run->wanted--;
+	}
+	run->hint = run->next + 1;
+	return run->next++;
+}
+
+// give the unused tail of the run back to the block store
+void release_run(F17FS_t *fs, blockRun_t *run){
+	for(; run->left > 0; run->left--){
+		block_store_release(fs->BlockStore_whole, run->next++);
+	}
+}
+
+// pin the index table behind *pointer in place, or start a fresh one if it hasn't been allocated
+// the view is writable (and the table marked dirty) only when allocating, lookups never write through it
+// \param fresh Set when the table was just allocated
+// return the pinned table (entries read with get_entry), NULL if there is none or on error
+void *load_index_table(F17FS_t *fs, uint32_t *pointer, bool allocate, blockRun_t *run, bool *fresh){
+	*fresh = false;
+	if(0x0000 != *pointer){
+		run->hint = *pointer + 1;
+		return allocate ? block_store_view_mut(fs->BlockStore_whole, *pointer)
+				: (void *)block_store_view(fs->BlockStore_whole, *pointer);
+	}
+	if(!allocate || 0 == (*pointer = take_run_block(fs, run))){
+		return NULL;
+	}
+	void *table = block_store_view_mut(fs->BlockStore_whole, *pointer);
+	if(table == NULL){
+		block_store_release(fs->BlockStore_whole, *pointer);
+		*pointer = 0x0000;
+		return NULL;
+	}
+	memset(table, 0x0000, fs->blockSize);
+	*fresh = true;
+	return table;
+}
+
+// unpin an index table pinned by load_index_table (with the same allocate, the table was written then)
+// a freshly allocated table that ended up mapping nothing (out of space) is released as well
+void store_index_table(F17FS_t *fs, uint32_t *pointer, bool allocate, bool fresh, size_t entriesMapped){
+	if(allocate){
+		block_store_unpin_mut(fs->BlockStore_whole, *pointer, 1);
+	} else {
+		block_store_unpin(fs->BlockStore_whole, *pointer);
+	}
+	if(fresh && entriesMapped == 0){
+		block_store_release(fs->BlockStore_whole, *pointer);
+		*pointer = 0x0000;
+	}
+}
+
+// map entries [from, from+count) of an index table (or the direct pointers) to data block ids
+// \param wide Whether the entries are 32 bits (the direct pointers, or tables with wideIds) or 16
+// return the number of entries mapped, stops early on a hole when not allocating or when out of space
+size_t map_table_entries(F17FS_t *fs, void *table, bool wide, size_t from, size_t count, bool allocate, blockRun_t *run, uint32_t *ids){
+	size_t i = 0;
+	for(; i < count; i++){
+		uint32_t entry = get_entry(table, wide, from + i);
+		if(0x0000 == entry){
+			if(!allocate || 0 == (entry = take_run_block(fs, run))){
+				break;
+			}
+			set_entry(table, wide, from + i, entry);
+		} else {
+			run->hint = entry + 1;
+		}
+		ids[i] = entry;
+	}
+	return i;
+}
+
+// map the logical blocks [first, first+count) of a file (0 being directPointer[0]) to block ids
+// when allocating, missing data and index blocks are taken from contiguous runs; index tables
+// are walked in place through block views, nothing is copied in or out
+// \param fs The F17FS Filesystem
+// \param ino The file inode, pointers are updated in place; the caller writes it back
+// \param first The first logical block
+// \param count The number of logical blocks
+// \param allocate Whether to allocate missing blocks, or to stop at the first hole
+// \param ids Receives count block ids
+// return the number of blocks mapped (< count only when out of space, on a hole, or on error)
+size_t map_file_blocks(F17FS_t *fs, inode_t *ino, size_t first, size_t count, bool allocate, uint32_t *ids){
+	const size_t entries = fs->tableEntries;
+	blockRun_t run = {0, 0, allocate ? count + count / entries + 3 : 0, 0};
+	size_t mapped = 0, want = 0, got = 0;
+	bool fresh = false;
+	void *table;
+	if(first + count > max_file_blocks(fs)){
+		count = max_file_blocks(fs) - first;
+	}
+	// direct blocks live in the inode itself
+	if(first < DIRECT_BLOCKS){
+		want = (DIRECT_BLOCKS - first < count) ? DIRECT_BLOCKS - first : count;
+		got = map_table_entries(fs, ino->directPointer, true, first, want, allocate, &run, ids);
+		mapped += got;
+		if(got < want){
+			release_run(fs, &run);
+			return mapped;
+		}
+	}
+	// single indirect, one index table
+	if(mapped < count && first + mapped < DIRECT_BLOCKS + entries){
+		size_t from = first + mapped - DIRECT_BLOCKS;
+		want = (entries - from < count - mapped) ? entries - from : count - mapped;
+		got = 0;
+		if(NULL != (table = load_index_table(fs, &ino->indirectPointer, allocate, &run, &fresh))){
+			got = map_table_entries(fs, table, fs->wideIds, from, want, allocate, &run, ids + mapped);
+			store_index_table(fs, &ino->indirectPointer, allocate, fresh, got);
+		}
+		mapped += got;
+		if(got < want){
+			release_run(fs, &run);
+			return mapped;
+		}
+	}
+	// double indirect, an outer table of inner index tables
+	if(mapped < count){
+		void *outer;
+		bool outerFresh = false;
+		size_t innerMapped = 0;
+		if(NULL != (outer = load_index_table(fs, &ino->doubleIndirectPointer, allocate, &run, &outerFresh))){
+			while(mapped < count){
+				size_t rel = first + mapped - DIRECT_BLOCKS - entries;
+				size_t slot = rel / entries, from = rel % entries;
+				uint32_t inner = get_entry(outer, fs->wideIds, slot);
+				want = (entries - from < count - mapped) ? entries - from : count - mapped;
+				got = 0;
+				if(NULL != (table = load_index_table(fs, &inner, allocate, &run, &fresh))){
+					got = map_table_entries(fs, table, fs->wideIds, from, want, allocate, &run, ids + mapped);
+					store_index_table(fs, &inner, allocate, fresh, got);
+				}
+				if(allocate){	// the outer table is only writable then
+					set_entry(outer, fs->wideIds, slot, inner);
+				}
+				mapped += got;
+				innerMapped += got;
+				if(got < want){
+					break;
+				}
+			}
+			store_index_table(fs, &ino->doubleIndirectPointer, allocate, outerFresh, innerMapped);
+		}
+	}
+	release_run(fs, &run);
+	return mapped;
+}
+
+// pass an access hint for the blocks ids[0..count) to the block store, adjacent ones together
+void advise_blocks(F17FS_t *fs, const uint32_t *ids, size_t count, block_store_advice_t advice){
+	size_t runStart = 0;
+	for(size_t i = 1; i <= count; i++){
+		if(i == count || ids[i] != ids[i-1] + 1){
+			block_store_advise(fs->BlockStore_whole, ids[runStart], i - runStart, advice);
+			runStart = i;
+		}
+	}
+}
+
+// the index tables needed to map logical blocks [first, end) of a file: the indirect table, the double
+// indirect outer table and the inner tables under it (reading the outer table for their ids)
+// With only_inside, just the tables that map nothing outside the range (never the outer table)
+// ids needs room for tableEntries + 2, return the number of tables
+size_t index_tables(F17FS_t *fs, const inode_t *ino, size_t first, size_t end, bool only_inside, uint32_t *ids){
+	size_t count = 0;
+	const size_t entries = fs->tableEntries;
+	const size_t inner = DIRECT_BLOCKS + entries;	// first logical block under the double indirect table
+	if(ino->indirectPointer != 0x0000 && (only_inside ? first <= DIRECT_BLOCKS && end >= inner : first < inner && end > DIRECT_BLOCKS)){
+		ids[count++] = ino->indirectPointer;
+	}
+	if(end > inner && ino->doubleIndirectPointer != 0x0000){
+		if(!only_inside){
+			ids[count++] = ino->doubleIndirectPointer;
+		}
+		const void *outer = block_store_view(fs->BlockStore_whole, ino->doubleIndirectPointer);
+		if(outer == NULL){
+			return count;
+		}
+		size_t slot = first > inner ? (first - inner) / entries : 0;
+		size_t endSlot = (end - 1 - inner) / entries + 1;
+		if(only_inside){
+			slot = first > inner ? (first - inner + entries - 1) / entries : 0;
+			endSlot = (end - inner) / entries;
+		}
+		for(; slot < endSlot && slot < entries && get_entry(outer, fs->wideIds, slot) != 0x0000; slot++){
+			ids[count++] = get_entry(outer, fs->wideIds, slot);
+		}
+		block_store_unpin(fs->BlockStore_whole, ino->doubleIndirectPointer);
+	}
+	return count;
+}
+
+// hint the index tables a file needs to reach logical blocks [first, end) to the block store
+void prefetch_index_tables(F17FS_t *fs, const inode_t *ino, size_t first, size_t end){
+	uint32_t ids[fs->tableEntries + 2];
+	size_t count = index_tables(fs, ino, first, end, false, ids);
+	for(size_t i = 0; i < count; i++){
+		block_store_prefetch(fs->BlockStore_whole, ids[i], 1);
+	}
+}
+
+// qsort order for block ids
+int compare_block_ids(const void *a, const void *b){
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// the blocks behind logical blocks [first, end) of a file and the index tables in between, sorted, in
+//  a malloc'd array. The tables sit between the data runs, with them the runs join up
+// \param only_inside Leave out the tables still needed for blocks outside the range
+// \param count Set to the number of blocks
+// return the blocks, NULL on error
+uint32_t *file_blocks(F17FS_t *fs, inode_t *ino, size_t first, size_t end, bool only_inside, size_t *count){
+	*count = 0;
+	uint32_t *ids = malloc((end > first ? end - first : 0) * sizeof(uint32_t) + (fs->tableEntries + 2) * sizeof(uint32_t));
+	if(ids == NULL || first >= end){
+		return ids;
+	}
+	*count = map_file_blocks(fs, ino, first, end - first, false, ids);
+	if(*count > 0){
+		*count += index_tables(fs, ino, first, first + *count, only_inside, ids + *count);
+		qsort(ids, *count, sizeof(uint32_t), compare_block_ids);
+	}
+	return ids;
 }
 
-///
-/// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 15 file_record_t structures
-/// \param fs The F17FS containing the file
-/// \param path Absolute path to the directory to inspect
-/// \return dyn_array of file records, NULL on error
-///
-dyn_array_t *fs_get_dir(F17FS_t *fs, const char *path){
-	if(fs == NULL || path == NULL || strlen(path) < 1){
-		return NULL;
+// the same for the blocks of file_blocks
+void advise_file_blocks(F17FS_t *fs, inode_t *ino, size_t first, size_t end, block_store_advice_t advice){
+	size_t count;
+	uint32_t *ids = file_blocks(fs, ino, first, end, advice == BLOCK_STORE_ADVICE_DONTNEED, &count);
+	if(ids != NULL){
+		advise_blocks(fs, ids, count, advice);
+		free(ids);
 	}
+}
 
-	// validate the pathname
-	// valid path must start with '/'
-	char firstChar = *path;
-	if(firstChar != '/'){
-		return NULL;}
-	// parse the pathname
-	char dirc[strlen(path)+1]; 
-	char basec[strlen(path)+1];
-	strcpy(dirc,path);
-	strcpy(basec,path);
-	char *dirPath = dirname(dirc);
-	char *baseFileName = basename(basec);
-
-
-	size_t dirInodeID;
-	// if the directory is the root
-	if(strlen(path)==1 && 0==strncmp(path,"/",1)){
-		dirInodeID = 0; // set the inode number to 0 for root
-	} else{ // other wise, trace down from the root to look for the inode
-		// get the inode number of the target directory
-		size_t parentInodeID;
-		if((parentInodeID=searchPath(fs,dirPath)) == SIZE_MAX) {return NULL;}
-		dirInodeID = getFileInodeID(fs,parentInodeID,baseFileName);
-		if(dirInodeID == 0){return NULL;} // No such file is found, if it is not root, the inode number cannot be 0
+// called after fd read [offset, offset+nbyte): while reads stay sequential, keep a window of blocks
+// past the reader prefetched, doubling it each time the reader gets halfway through, and the index
+// tables for the window after that, so crossing into the indirect/double indirect blocks doesn't stall
+// a read that isn't where the last one ended starts over
+void readahead_after_read(F17FS_t *fs, int fd, inode_t *ino, size_t offset, size_t nbyte){
+	readahead_t *ra = &fs->readahead[fd];
+	bool sequential = (offset == ra->next);
+	bool enabled = ra->pattern == FS_ADVICE_SEQUENTIAL || (ra->pattern == FS_ADVICE_NORMAL && fs->readaheadOn);
+	ra->next = offset + nbyte;
+	if(!enabled || !sequential){
+		ra->window = 0;
+		ra->ahead = 0;
+		return;
 	}
-	// get the inode block and data block of the directory
-	inode_t dirInode;
-	directoryBlock_t dirBlock;
-	if((0 == block_store_inode_read(fs->BlockStore_inode, dirInodeID, &dirInode)) || (0 == block_store_read(fs->BlockStore_whole,dirInode.directPointer[0],&dirBlock))){ return NULL;}	
-	if('d'!=dirInode.fileType){return NULL;} // Should be directory
-	
-	// create a dynamic array, data object size is sizeof(file_record_t)
-	dyn_array_t *list = dyn_array_create(15,sizeof(file_record_t),NULL);
-	if(list == NULL){
-		return NULL;
+	size_t nextBlock = (offset + nbyte) / fs->blockSize;
+	size_t fileBlocks = (ino->fileSize + fs->blockSize - 1) / fs->blockSize;
+	if(ra->ahead > nextBlock + ra->window / 2 || nextBlock >= fileBlocks){
+		return;	// still well ahead, or nothing left
 	}
-	// loop through all the allocated entries in the data block in form of directoryBlock_t structure
-	// use bitmap to skip unused/uninitialized entires
-	bitmap_t * bmp = bitmap_overlay(8,&(dirInode.vacantFile));
-	int k = 0;
-	for(;k<7;k++){
-		if(bitmap_test(bmp,k)){
-			// add the entry name to the array 
-			file_record_t record;
-			strncpy(record.name,dirBlock.dentries[k].filename,FS_FNAME_MAX);
-			inode_t fileInode;
-			if(0==block_store_inode_read(fs->BlockStore_inode,dirBlock.dentries[k].inodeNumber,&fileInode)){
-				bitmap_destroy(bmp);
-				dyn_array_destroy(list);
-				return NULL;
-			}else {
-				if(fileInode.fileType == 'r'){
-					record.type = FS_REGULAR;
-				} else {
-					record.type = FS_DIRECTORY;
-				}
-				
-			}
-			if(!dyn_array_push_back(list,&record)){
-				bitmap_destroy(bmp);
-				dyn_array_destroy(list);
-				return NULL;
-			}
-			//printf("record name: %s\n",record.name);	
-		}	
+	if(ra->window == 0){
+		ra->window = bytes_to_blocks(fs, ra->pattern == FS_ADVICE_SEQUENTIAL ? READAHEAD_SEQ_BYTES : READAHEAD_MIN_BYTES);
+	} else {
+		size_t maxWindow = bytes_to_blocks(fs, READAHEAD_MAX_BYTES);
+		ra->window = ra->window * 2 > maxWindow ? maxWindow : ra->window * 2;
 	}
-	bitmap_destroy(bmp);	
-	return list;
+	size_t from = ra->ahead > nextBlock ? ra->ahead : nextBlock;
+	size_t to = nextBlock + ra->window < fileBlocks ? nextBlock + ra->window : fileBlocks;
+	if(from < to){
+		uint32_t ids[READAHEAD_MAX_BYTES / BLOCK_SIZE_BYTES];
+		advise_blocks(fs, ids, map_file_blocks(fs, ino, from, to - from, false, ids), BLOCK_STORE_ADVICE_WILLNEED);
+	}
+	if(to < fileBlocks){
+		prefetch_index_tables(fs, ino, to, to + ra->window < fileBlocks ? to + ra->window : fileBlocks);
+	}
+	ra->ahead = to;
 }
 
-// allocate and get the data block id
-// \param fs The F17FS Filesystem
-// \param fd_t The fileDescriptor object
-// \param fileInode Inode of the file
-// return the data block id, or 0 on error
-uint16_t get_data_block_id(F17FS_t *fs, fileDescriptor_t *fd_t){
-	if(fs==NULL || fd_t==NULL){
-		//printf("fs or fd_t == NULL\n");
-		return 0;
-	} else {
-		inode_t ino;
-		if(0==block_store_inode_read(fs->BlockStore_inode,fd_t->inodeNum,&ino)){
-			//printf("Cannot read inode\n");
-			return 0;
-		} else {
-			size_t order = fd_t->locate_order; 
-	
-			if(fd_t->usage == 1){ // the block to be used is pointed by directPointer
-				if(0x0000 == ino.directPointer[order]){ // if the block hasnt been allocated
-					if(1<=block_store_get_free_blocks(fs->BlockStore_whole)){
-						ino.directPointer[order] = block_store_allocate(fs->BlockStore_whole);
-						if(block_store_inode_write(fs->BlockStore_inode,fd_t->inodeNum,&ino)){
-							//printf("new, usage:%d, order:%lu,offset:%d\n",fd_t->usage,order,fd_t->locate_offset);
-							return ino.directPointer[order];
-						}
-					}
-				} else if(0x0000 != ino.directPointer[order] && block_store_test(fs->BlockStore_whole,ino.directPointer[order])){
-					//printf("existed\n");
-					return ino.directPointer[order]; // return the pointer, i.e., the address of the data block to write
-				}
-				//printf("error,order:%lu,offset:%d,direct addr:%d\n",order,fd_t->locate_offset,ino.directPointer[order]);
-				return 0;
-			} else if(fd_t->usage == 2){ // the block is pointed by indirectPointer
-				uint16_t table[256]; // the index table of the indirectPointer
-				memset(table,0x0000,2*256);
-				if(0 == order && 0x0000 == ino.indirectPointer){ // the block hasnt been allocated
-					// the block is the first indirectPointer pointed block
-					// allocate a block for the index table pointed by the indirectPointer in the inode 
-					if(2<=block_store_get_free_blocks(fs->BlockStore_whole)){
-						ino.indirectPointer = block_store_allocate(fs->BlockStore_whole);
-						table[0] = block_store_allocate(fs->BlockStore_whole); // allocate the data block pointed by an entry in the index table
-						if(0!=block_store_write(fs->BlockStore_whole,ino.indirectPointer,table) && 0!=block_store_inode_write(fs->BlockStore_inode,fd_t->inodeNum,&ino)){
-							return table[0]; 
-						}
-					} 
-				} else if(0x0000 != ino.indirectPointer && block_store_test(fs->BlockStore_whole,ino.indirectPointer)){
-				// when indirectPointer is alread allocated: (1) the the data block is not allocated (2) data block is allocated	
-					if(block_store_read(fs->BlockStore_whole,ino.indirectPointer,table)){
-						if(0x0000 == table[order]){
-							if(1<=block_store_get_free_blocks(fs->BlockStore_whole)){
-								table[order] = block_store_allocate(fs->BlockStore_whole);
-								if(block_store_write(fs->BlockStore_whole,ino.indirectPointer,table)){
-									return table[order];
-								}
-							}
-						} else if(0x0000 != table[order] && block_store_test(fs->BlockStore_whole,table[order])){
-							return table[order];
-						}
-					}
-					//printf("indirectPointer set but cannot access\n");
-				}
-				//printf("indirectPointer %d\n",ino.indirectPointer);
-				return 0;	
-			} else { // the block is pointed by a doubleIndiretPointer
-				uint16_t outerIndexTable[256];
-				memset(outerIndexTable,0x0000,2*256);
-				uint16_t innerIndexTable[256];
-				memset(innerIndexTable,0x0000,2*256);
-				//printf("order: %lu\n",order);
-				if(0x0000 == ino.doubleIndirectPointer){ //the block hasnt been allocated yet
-					//printf("outerIndexTable index: %lu,usedBlockCount: %lu\n",order/256,usedBlockCount);
-					if(3<=block_store_get_free_blocks(fs->BlockStore_whole)){
-						ino.doubleIndirectPointer = block_store_allocate(fs->BlockStore_whole);
-						outerIndexTable[0] = block_store_allocate(fs->BlockStore_whole);
-						innerIndexTable[0] = block_store_allocate(fs->BlockStore_whole);
-						if(block_store_write(fs->BlockStore_whole,ino.doubleIndirectPointer,outerIndexTable) &&	
-						   block_store_write(fs->BlockStore_whole,outerIndexTable[0],innerIndexTable) &&
-						   block_store_inode_write(fs->BlockStore_inode,fd_t->inodeNum,&ino)){
-							//printf("dbIndirect addr: %d, order: %lu\n",innerIndexTable[0],order);
-							return innerIndexTable[0];
-						}
-					} 	
-				} else if(0x0000 != ino.doubleIndirectPointer && block_store_test(fs->BlockStore_whole,ino.doubleIndirectPointer)){
-					if(block_store_read(fs->BlockStore_whole,ino.doubleIndirectPointer,outerIndexTable)){
-						if(0x0000 == outerIndexTable[order/256]){
-						// when the new block is the first entry of a new innerIndexTable
-							if(2<=block_store_get_free_blocks(fs->BlockStore_whole)){
-							//printf("outerIndexTable index: %lu,usedBlockCount: %lu\n",order/256,usedBlockCount);
-								outerIndexTable[order/256] = block_store_allocate(fs->BlockStore_whole);
-								innerIndexTable[order%256] = block_store_allocate(fs->BlockStore_whole);
-								if(0!=block_store_write(fs->BlockStore_whole,ino.doubleIndirectPointer,outerIndexTable) && 0!=block_store_write(fs->BlockStore_whole,outerIndexTable[order/256],innerIndexTable)){
-									//printf("? dbIndirect addr: %d, order: %lu\n",innerIndexTable[order%256],order);
- 									return innerIndexTable[order%256];
-								}
-							} 	
-						} else if(0x0000 != outerIndexTable[order/256] && block_store_test(fs->BlockStore_whole,outerIndexTable[order/256])){
-							if(block_store_read(fs->BlockStore_whole,outerIndexTable[order/256],innerIndexTable)){
-								//printf("innerIndex %lu addr: %d\n",order%256,innerIndexTable[order%256]);
-								if(0x0000 == innerIndexTable[order%256]){
-									if(1<=block_store_get_free_blocks(fs->BlockStore_whole)){
-										innerIndexTable[order%256] = block_store_allocate(fs->BlockStore_whole);
-										if(block_store_write(fs->BlockStore_whole,outerIndexTable[order/256],innerIndexTable)){
-											//printf("dbIndirect addr: %d, order: %lu\n",innerIndexTable[order%256],order);
-											return innerIndexTable[order%256];
-										}
-									}	
-								} else if(0x0000 != innerIndexTable[order%256] && block_store_test(fs->BlockStore_whole,innerIndexTable[order%256])){
-									//printf("dbIndirect addr: %d, order: %lu\n",innerIndexTable[order%256],order);
-									return innerIndexTable[order%256];
-								}	
-								//printf("Something happened to doubleIndirect 5");
-							}
-							//printf("Something happened to doubleIndirect 4");
-						}
-						//printf("Something happened to doubleIndirect 3");
-					}
-					//printf("Something happened to doubleIndirect 2");
-				}
-				//printf("Something happened to doubleIndirect");
-				return 0;
+// segments handed to block_store_readv/writev per call
+#define TRANSFER_BATCH 64
+
+// copy nbyte bytes from the blocks ids[0..] into dst, or when dst is NULL from src into them, starting
+//  offset bytes into ids[0]
+// blocks are batched into vectored block store calls, so physically adjacent blocks become one copy
+// return the number of bytes transferred
+size_t transfer_blocks(F17FS_t *fs, const uint32_t *ids, size_t offset, uint8_t *dst, const uint8_t *src, size_t nbyte){
+	block_store_segment_t segments[TRANSFER_BATCH];
+	size_t done = 0, i = 0;
+	while(done < nbyte){
+		size_t n = 0, batchBytes = 0;
+		for(; n < TRANSFER_BATCH && done + batchBytes < nbyte; n++, i++){
+			segments[n].block_id = ids[i];
+			segments[n].offset = offset;
+			segments[n].length = fs->blockSize - offset;
+			if(segments[n].length > nbyte - done - batchBytes){ // the last block
+				segments[n].length = nbyte - done - batchBytes;
 			}
-			//printf("Something happened to doubleIndirect -1");
-		}		
-		//printf("Something happened to doubleIndirect -2\n");
-	} 
-	//printf("Something happened to doubleIndirect -3\n");
+			if(dst != NULL){
+				segments[n].buffer = dst + done + batchBytes;
+			} else {
+				segments[n].source = src + done + batchBytes;
+			}
+			batchBytes += segments[n].length;
+			offset = 0;
+		}
+		size_t moved = dst == NULL ? block_store_writev(fs->BlockStore_whole, segments, n) : block_store_readv(fs->BlockStore_whole, segments, n);
+		done += moved;
+		if(moved < batchBytes){
+			break;
+		}
+	}
+	return done;
 }
 
-//
-// calculate the file size up until the location pointed by fileDescriptor usage, order and offset
-// return size of the file
-size_t getFileSize(fileDescriptor_t *fd_t){
-		if(fd_t->usage == 1){
-			return 512 * fd_t->locate_order + fd_t->locate_offset;
-		} else if(fd_t->usage == 2){
-			return 512 * (6 + fd_t->locate_order) + fd_t->locate_offset;	
-		} else {
-			return 512 * (6 + 256 + fd_t->locate_order) + fd_t->locate_offset;
+// FS_ADVICE_NOREUSE: once a batch of whole blocks behind the transfer [offset, offset + nbyte) has
+//  piled up, drop it from the cache (dirty ones are only queued for writeback). The kernel only drops
+//  folios wholly inside the range, so batches end where an index table starts and the last run of the
+//  batch before goes again with the first run of this one
+void drop_behind(F17FS_t *fs, int fd, inode_t *ino, size_t offset, size_t nbyte){
+	readahead_t *ra = &fs->readahead[fd];
+	const size_t entries = fs->tableEntries, inner = DIRECT_BLOCKS + entries;
+	size_t end = (offset + nbyte) / fs->blockSize;
+	if(end < ra->dropped){	// went back, start over from here
+		ra->dropped = offset / fs->blockSize;
+		ra->tailStart = ra->tailEnd = 0;
+		return;
+	}
+	if(end - ra->dropped < bytes_to_blocks(fs, DROP_BEHIND_BYTES)){
+		return;
+	}
+	end = end > inner ? inner + (end - inner) / entries * entries : (end > DIRECT_BLOCKS ? DIRECT_BLOCKS : end);
+	size_t count;
+	uint32_t *ids = file_blocks(fs, ino, ra->dropped, end, true, &count);
+	if(ids == NULL){
+		return;
+	}
+	size_t run = 1;
+	while(run < count && ids[run] == ids[run-1] + 1){
+		run++;
+	}
+	if(count > 0 && ra->tailEnd == ids[0]){
+		block_store_advise(fs->BlockStore_whole, ra->tailStart, ids[run-1] + 1 - ra->tailStart, BLOCK_STORE_ADVICE_DONTNEED);
+		advise_blocks(fs, ids + run, count - run, BLOCK_STORE_ADVICE_DONTNEED);
+	} else {
+		advise_blocks(fs, ids, count, BLOCK_STORE_ADVICE_DONTNEED);
+	}
+	if(count > 0){
+		size_t last = count - 1;
+		while(last > 0 && ids[last-1] + 1 == ids[last]){
+			last--;
 		}
-} 
-
+		ra->tailStart = ids[last];
+		ra->tailEnd = ids[count-1] + 1;
+	}
+	ra->dropped = end;
+	free(ids);
+}
 
 /// Writes data from given buffer to the file linked to the descriptor
 ///   Writing past EOF extends the file
@@ -690,252 +2219,185 @@ ssize_t fs_write(F17FS_t *fs, int fd, const void *src, size_t nbyte){
 	// check if fs,fd,src are valid
 	if(fs==NULL || fd < 0 || !block_store_sub_test(fs->BlockStore_fd,fd) || src == NULL){
 		return -1;
-	} else {
-		// if 0 byte is needed to write
-		if(nbyte==0){
-			return 0;
-		} else {
-			// get fd's corresponding fileDescriptor structure 
-			// get inode number, usage, order and offset
-			fileDescriptor_t fd_t;
-			if(0==block_store_fd_read(fs->BlockStore_fd,fd,&fd_t)){
-				return -2;
-			} else {
-				//printf("Free blocks: %lu\n",block_store_get_free_blocks(fs->BlockStore_whole));
-				size_t locSize = getFileSize(&fd_t); 
-				size_t writtenBytes = 0;
-				//printf("start writing:\n");
-				// write data to the first block starting where the current fd pointer is at	
-				while(nbyte - writtenBytes > 0){
-					uint16_t blockID = get_data_block_id(fs,&fd_t); 
-					//printf("Free blocks: %lu\n",block_store_get_free_blocks(fs->BlockStore_whole));
-					//printf("blockID: %d\n",blockID);
-					if(0 < blockID){
-						if(fd_t.locate_offset + nbyte - writtenBytes < BLOCK_SIZE_BYTES){ // the last block to write 
-							if(0!=block_store_n_write(fs->BlockStore_whole,blockID,fd_t.locate_offset,src+writtenBytes,nbyte-writtenBytes)){
-								fd_t.locate_offset += (nbyte - writtenBytes); // update locate_offset
-								writtenBytes = nbyte;		
-								break; // finish writing
-							}
-							//printf("blockID: %d,offset: %d, nbyte: %lu, writtenBytes: %lu\n",blockID,fd_t.locate_offset,nbyte,writtenBytes); 
-							return -5;
-						} else { 
-							if(0!=block_store_n_write(fs->BlockStore_whole,blockID,fd_t.locate_offset,src+writtenBytes,BLOCK_SIZE_BYTES-fd_t.locate_offset)){
-								writtenBytes += (BLOCK_SIZE_BYTES - fd_t.locate_offset);
-								fd_t.locate_offset = 0;//update locate_offset
-								// update locate_order
-								if(fd_t.usage==1&&fd_t.locate_order== (DIRECT_BLOCKS-1)){ // directPointer space is full
-									fd_t.locate_order = 0;
-									fd_t.usage = 2;
-									//printf("dip into indirect blocks\n");
-								} else if(fd_t.usage==2&&fd_t.locate_order== (INDIRECT_BLOCKS-1)){ // indirectPointer space is full
-									fd_t.locate_order = 0;
-									fd_t.usage = 4;
-									//printf("dip into double indirect blocks\n");
-								} else { // as long as not exceeding the double inidirect max, unlikely
-									fd_t.locate_order += 1;
-								}
-								/*if(fd_t.locate_order >= 2559){
-									printf("blockID: %d,offset: %d, nbyte: %lu, writtenBytes: %lu\n",blockID,fd_t.locate_offset,nbyte,writtenBytes); 
-								}*/
-								continue;
+	}
+	// if 0 byte is needed to write
+	if(nbyte==0){
+		return 0;
+	}
+	// get fd's corresponding fileDescriptor structure and the file inode
+	fileDescriptor_t fd_t;
+	inode_t fileInode;
+	if(0==block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) || 0==read_inode(fs,fd_t.inodeNum,&fileInode)){
+		return -2;
+	}
+	size_t locSize = getFileSize(fs,&fd_t);
+	const size_t maxFileSize = max_file_blocks(fs) * fs->blockSize;
+	if(locSize >= maxFileSize){
+		return 0;
+	}
+	if(nbyte > maxFileSize - locSize){
+		nbyte = maxFileSize - locSize;
+	}
+	// map (and allocate) every block the write touches up front,
+	// so the inode and each index table are only updated once for the whole call
+	size_t firstBlock = locSize / fs->blockSize;
+	size_t blockCount = (locSize + nbyte - 1) / fs->blockSize - firstBlock + 1;
+	uint32_t *blockIDs = malloc(blockCount * sizeof(uint32_t));
+	if(blockIDs == NULL){
+		return -3;
+	}
+	size_t mapped = map_file_blocks(fs,&fileInode,firstBlock,blockCount,true,blockIDs);
+	if(mapped < blockCount){ // out of space, write what fits in the blocks we got
+		nbyte = mapped == 0 ? 0 : mapped * fs->blockSize - fd_t.locate_offset;
+	}
+	size_t writtenBytes = transfer_blocks(fs,blockIDs,fd_t.locate_offset,NULL,src,nbyte);
+	free(blockIDs);
+	setFileLocation(fs,&fd_t, locSize + writtenBytes);
+	if(fileInode.fileSize < locSize + writtenBytes){ // Need to recalculate
+		fileInode.fileSize = locSize + writtenBytes;
+	}
+	if(0!=block_store_fd_write(fs->BlockStore_fd,fd,&fd_t) && 0!=write_inode(fs,fd_t.inodeNum,&fileInode)){
+		if(fs->readahead[fd].noreuse){
+			drop_behind(fs,fd,&fileInode,locSize,writtenBytes);
+		}
+		return writtenBytes;
+	}
+	return -8;
+}
+
+// release the data and index blocks of a file (or the blocks of a directory)
+// return 0 on success, < 0 if an index table can't be read
+static int release_file_blocks(F17FS_t *fs, const inode_t *ino){
+	int i=0;
+	for(; i<6; i++){ // if the directPointer is allocated, release those memory addresses first
+		if(0x0000 != ino->directPointer[i] && block_store_test(fs->BlockStore_whole,ino->directPointer[i])){
+			block_store_release(fs->BlockStore_whole,ino->directPointer[i]);	
+		}	
+	}
+	if(0x0000 != ino->indirectPointer && block_store_test(fs->BlockStore_whole,ino->indirectPointer)){// if the indirectPointer is allocated, 
+		uint8_t indexTable[fs->blockSize];
+		memset(indexTable,0x0000,sizeof(indexTable));
+		if(block_store_read(fs->BlockStore_whole,ino->indirectPointer,indexTable)){
+			size_t j=0;
+			for(; j<fs->tableEntries; j++){ // release all the secondary memory addresses 
+				uint32_t id = get_entry(indexTable,fs->wideIds,j);
+				if(0x0000 != id && block_store_test(fs->BlockStore_whole,id)){
+					block_store_release(fs->BlockStore_whole,id);	
+				}	
+			}
+		} else {return -11;}
+		block_store_release(fs->BlockStore_whole,ino->indirectPointer);	
+	}
+	if(0x0000 != ino->doubleIndirectPointer && block_store_test(fs->BlockStore_whole,ino->doubleIndirectPointer)){// if the doubleIndirectPointer is allocated, 
+		uint8_t outerIndexTable[fs->blockSize];
+		memset(outerIndexTable,0x0000,sizeof(outerIndexTable));
+		uint8_t innerIndexTable[fs->blockSize];
+		memset(innerIndexTable,0x0000,sizeof(innerIndexTable));
+		if(block_store_read(fs->BlockStore_whole,ino->doubleIndirectPointer,outerIndexTable)){
+			size_t j=0;
+			for(; j<fs->tableEntries; j++){ // release all the secondary memory addresses 
+				uint32_t innerID = get_entry(outerIndexTable,fs->wideIds,j);
+				if(innerID!=0x0000 && block_store_test(fs->BlockStore_whole,innerID)){			
+					if(block_store_read(fs->BlockStore_whole,innerID,innerIndexTable)){
+						size_t k=0;
+						for(; k<fs->tableEntries; k++){ // release all the secondary memory addresses 
+							uint32_t id = get_entry(innerIndexTable,fs->wideIds,k);
+							if(id!=0x0000 && block_store_test(fs->BlockStore_whole,id)){
+								block_store_release(fs->BlockStore_whole,id);	
 							} 
-							//printf("offset: %d, bytes: %d\n",fd_t.locate_offset,512-fd_t.locate_offset);
-							//printf("freeBlocks: %lu\n",block_store_get_free_blocks(fs->BlockStore_whole));
-							//printf("blockID: %d,offset: %d, nbyte: %lu, writtenBytes: %lu\n",blockID,fd_t.locate_offset,nbyte,writtenBytes); 
-							//printf("Used blocks: %lu\n",block_store_get_used_blocks(fs->BlockStore_whole));
-							return -6; 
 						}
-					} else {
-					//printf("error on getting block id: %d,order:%d\n",blockID,fd_t.locate_order);
-					break;
-					}	
-				} 
-				inode_t fileInode;
-				block_store_inode_read(fs->BlockStore_inode,fd_t.inodeNum,&fileInode);
-				if(fileInode.fileSize < locSize + writtenBytes){ // Need to recalculate
-					fileInode.fileSize = locSize + writtenBytes;
-				}
-				if(0!=block_store_fd_write(fs->BlockStore_fd,fd,&fd_t) && 0!=block_store_inode_write(fs->BlockStore_inode,fd_t.inodeNum,&fileInode)){
-					//printf("Finish writing: %lu\n",writtenBytes);
-					return writtenBytes;
-				} else {return -8;}							
-	
+					} else {return -10;}
+					block_store_release(fs->BlockStore_whole,innerID);	
+				} 	
 			}
-		}
+		} else {return -9;}
+		block_store_release(fs->BlockStore_whole,ino->doubleIndirectPointer);	
 	}
+	return 0;
 }
 
-//
-// Deletes the specified file and closes all open descriptors to the file
-//   Directories can only be removed when empty
-// \param fs The F17FS containing the file
-// \param path Absolute path to file to remove
-// \return 0 on success, < 0 on error
-//
-int fs_remove(F17FS_t *fs, const char *path) {
-	if(fs == NULL || path == NULL || strlen(path) == 0){
-		return -1;
-	}
-	// Validate the path
-	char firstChar = *path;
-	if(firstChar != '/'){return -2;}
-	char dirc[strlen(path)+1];
-	char basec[strlen(path)+1];
-	strcpy(dirc,path);
-	strcpy(basec,path);
-	char *dirPath =  dirname(dirc);
-	char *baseFileName = basename(basec);
-
-	size_t dirInodeID = searchPath(fs,dirPath);
-	size_t fileInodeID;
-	if(dirInodeID != SIZE_MAX){
-		if(0==strcmp(baseFileName,"/") && 0==strcmp(dirPath,"/") ){// Cannot remove root directory
+// fs_remove and fs_removeat: remove the file at a valid path, relative paths starting from the directory inode start
+static int remove_in(F17FS_t *fs, size_t start, const char *path){
+	pathTarget_t target;
+	resolve_path(fs,start,path,&target);
+	char *baseFileName = target.name;
+
+	size_t dirInodeID = target.parent;
+	size_t fileInodeID = target.inode;
+	if(dirInodeID != SIZE_MAX || fileInodeID == 0){
+		// Cannot remove root directory, and the file has to exist
+		if(fileInodeID == 0 || fileInodeID == SIZE_MAX){
 			return -4;
-		} else { // If not root, need to validate the file's inode ID
-			fileInodeID = getFileInodeID(fs,dirInodeID,baseFileName);
-			if(fileInodeID == 0){
-				//printf("dirInodeID: %lu\n",dirInodeID);
-				//printf("invalid fileInodeID %lu for dir: %s file: %s\n",fileInodeID,dirPath,baseFileName);
-				return -4;
-			}
 		}
 		inode_t fileInode;
-		block_store_inode_read(fs->BlockStore_inode,fileInodeID,&fileInode);
+		read_inode(fs,fileInodeID,&fileInode);
 		if(fileInode.fileType=='d'){
-		// If the file is a dir, delete it only if it is empty, meaning vacantFile == 0x00
-			if(fileInode.vacantFile == 0x00 || fileInode.linkCount > 1){
-				// To delete a dir, remove its entry from the directory block of its parent inode, or the number of hardlinks > 1
-				inode_t dirInode; // Parent directoy inode
-				block_store_inode_read(fs->BlockStore_inode,dirInodeID,&dirInode);
-				//printf("Dir %s before clear file,vacantFile: %d\n",path,dirInode.vacantFile); 
-				bitmap_t *bmp = bitmap_overlay(8, &(dirInode.vacantFile));
-				directoryBlock_t db_t;
-				block_store_read(fs->BlockStore_whole,dirInode.directPointer[0],&db_t); 	
-				int m=0;
-				for(;m<7; m++){
-					if(bitmap_test(bmp,m)){
-						if(0 == strncmp(db_t.dentries[m].filename,baseFileName,FS_FNAME_MAX) /* && 0 < parentDir.dentries[k].inodeNumber*/){
-							memset(db_t.dentries[m].filename,'\0',FS_FNAME_MAX);
-							db_t.dentries[m].inodeNumber = 0x00;
-							bitmap_reset(bmp,m);	
-							break;
-						}
-					}	
+			// If the file is a dir, delete it only if it is empty, or the number of hardlinks > 1
+			if(!dir_is_empty(fs,&fileInode) && fileInode.linkCount <= 1){
+				return -5;
+			}
+			// To delete a dir, remove its entry from its parent directory
+			if(SIZE_MAX == dir_remove(fs,dirInodeID,baseFileName)){
+				return -8;
+			}
+			// If the directory file inode is not hardlinked to any other file
+			if(fileInode.linkCount <= 1) {
+				// Remove its blocks (the one it starts with, or all of a hashed directory), then its inode
+				int released = release_file_blocks(fs,&fileInode);
+				if(released < 0){
+					return released;
 				}
-				//printf("Dir %s after clear file,vacantFile: %d\n",path,dirInode.vacantFile); 
-				bitmap_destroy(bmp);
-				block_store_inode_write(fs->BlockStore_inode,dirInodeID,&dirInode);
-				block_store_write(fs->BlockStore_whole,dirInode.directPointer[0],&db_t);
-				// If the directory file inode is not hardlinked to any other file
-				if(fileInode.linkCount <= 1) {
-					// Remove its file block pointed by directPointer[0], then remove its inode from inode table
-					block_store_release(fs->BlockStore_whole,fileInode.directPointer[0]);
-					block_store_sub_release(fs->BlockStore_inode,fileInodeID);
-					//printf("Success Dir %s not empty,vacantFile: %d\n",path,dirInode.vacantFile); 
-					return 0;
-				} else {
-					fileInode.linkCount -= 1;
-					if(block_store_inode_write(fs->BlockStore_inode,fileInodeID,&fileInode)){
-						//printf("Success Dir %s not empty,vacantFile: %d\n",path,dirInode.vacantFile); 
-						return 0;
+				release_inode(fs,fileInodeID);
+				// and close the directory handles to it
+				for(size_t dh = 0; dh < DIR_HANDLES; dh++){
+					if(fs->dirHandles[dh].open && fs->dirHandles[dh].inode == fileInodeID){
+						fs->dirHandles[dh].open = false;
 					}
 				}
-				return -8;
+				return 0;
+			}
+			// read it again, a directory linked into itself was its own parent
+			if(read_inode(fs,fileInodeID,&fileInode)){
+				fileInode.linkCount -= 1;
+				if(write_inode(fs,fileInodeID,&fileInode)){
+					return 0;
+				}
 			}
-			//printf("ErrorDir %s not empty,vacantFile: %d\n",path,fileInode.vacantFile); 
-			return -5;
+			return -8;
 		} else if(fileInode.fileType=='r') { // if the file to remove is file
+			// Remove the file entry from the parent directory first, nothing is released if it isn't there
+			if(SIZE_MAX == dir_remove(fs,dirInodeID,baseFileName)){
+				return -12;
+			}
 			if(fileInode.linkCount > 1){ 
 				// If the file inode is referenced by more than one link, then just decrement the linkCount by 1 and update the inode 
 				fileInode.linkCount -= 1;
 				// Update the file inode
-				if(0 == block_store_inode_write(fs->BlockStore_inode,fileInodeID,&fileInode)){
+				if(0 == write_inode(fs,fileInodeID,&fileInode)){
 					return -11;
 				}	
 			} else { // If the file inode is only referened by one link, delete the content of the inode
-				int i=0;
-				for(; i<6; i++){ // if the directPointer is allocated, release those memory addresses first
-					if(0x0000 != fileInode.directPointer[i] && block_store_test(fs->BlockStore_whole,fileInode.directPointer[i])){
-						block_store_release(fs->BlockStore_whole,fileInode.directPointer[i]);	
-					}	
+				int released = release_file_blocks(fs,&fileInode);
+				if(released < 0){
+					return released;
 				}
-				if(0x0000 != fileInode.indirectPointer && block_store_test(fs->BlockStore_whole,fileInode.indirectPointer)){// if the indirectPointer is allocated, 
-					uint16_t indexTable[256];
-					memset(indexTable,0x0000,512);
-					if(block_store_read(fs->BlockStore_whole,fileInode.indirectPointer,indexTable)){
-						int j=0;
-						for(; j<256; j++){ // release all the secondary memory addresses 
-							if(0x0000 != indexTable[j] && block_store_test(fs->BlockStore_whole,indexTable[j])){
-								block_store_release(fs->BlockStore_whole,indexTable[j]);	
-							}	
-						}
-					} else {return -11;}
-					block_store_release(fs->BlockStore_whole,fileInode.indirectPointer);	
-				}
-				if(0x0000 != fileInode.doubleIndirectPointer && block_store_test(fs->BlockStore_whole,fileInode.doubleIndirectPointer)){// if the doubleIndirectPointer is allocated, 
-					uint16_t outerIndexTable[256];
-					memset(outerIndexTable,0x0000,512);
-					uint16_t innerIndexTable[256];
-					memset(innerIndexTable,0x0000,512);
-					if(block_store_read(fs->BlockStore_whole,fileInode.doubleIndirectPointer,outerIndexTable)){
-						int j=0;
-						for(; j<256; j++){ // release all the secondary memory addresses 
-							if(outerIndexTable[j]!=0x0000 && block_store_test(fs->BlockStore_whole,outerIndexTable[j])){			
-								if(block_store_read(fs->BlockStore_whole,outerIndexTable[j],innerIndexTable)){
-									int k=0;
-									for(; k<256; k++){ // release all the secondary memory addresses 
-										if(innerIndexTable[k]!=0x0000 && block_store_test(fs->BlockStore_whole,innerIndexTable[k])){
-											block_store_release(fs->BlockStore_whole,innerIndexTable[k]);	
-										} 
-									}
-								} else {return -10;}
-								block_store_release(fs->BlockStore_whole,outerIndexTable[j]);	
-							} 	
-						}
-					} else {return -9;}
-					block_store_release(fs->BlockStore_whole,fileInode.doubleIndirectPointer);	
-				}
-				int fd_count=0;
-				for(;fd_count<256;fd_count++){ // close all fd pointing to the file
+				int fd_count=0, stillOpen=0;
+				for(;fd_count<256;fd_count++){ // close all fd pointing to the file, and only those
 					if(block_store_sub_test(fs->BlockStore_fd,fd_count)){
 						fileDescriptor_t fd_t;
-						if(block_store_fd_read(fs->BlockStore_fd,fd_count,&fd_t)){
-							if(fd_t.inodeNum==fileInodeID){
-								fs_close(fs,fd_count);
-							}
+						if(block_store_fd_read(fs->BlockStore_fd,fd_count,&fd_t) && fd_t.inodeNum==fileInodeID
+								&& 0 != fs_close(fs,fd_count)){
+							stillOpen++;
 						}
-						return -7;
 					}
 				}
-				block_store_sub_release(fs->BlockStore_inode,fileInodeID);
-			}
-			// Remove the file entry in the parent directory data block by reducing one bit from vacantFile
-			inode_t dirInode; // The inode for the parent directory containing the file
-			block_store_inode_read(fs->BlockStore_inode,dirInodeID,&dirInode);
-			//dirInode.vacantFile >>= 1 ; // Cannot do this, would mess up the directory file block
-			//printf("Dir %s before clear file,vacantFile: %d\n",path,dirInode.vacantFile); 
-			bitmap_t *bmp = bitmap_overlay(8, &(dirInode.vacantFile));
-			directoryBlock_t db_t;
-			block_store_read(fs->BlockStore_whole,dirInode.directPointer[0],&db_t); 	
-			int m=0;
-			for(;m<7; m++){
-				if(bitmap_test(bmp,m)){
-					if(0 == strncmp(db_t.dentries[m].filename,baseFileName,FS_FNAME_MAX) /* && 0 < parentDir.dentries[k].inodeNumber*/){
-						bitmap_reset(bmp,m);	
-						strncmp(db_t.dentries[m].filename,"\0",FS_FNAME_MAX);
-						db_t.dentries[m].inodeNumber = 0x0000;
-						break;
-					}
+				// the inode isn't released while a descriptor still points to it
+				if(stillOpen){
+					return -7;
 				}
+				release_inode(fs,fileInodeID);
 			}
-			//printf("Dir %s after clear file,vacantFile: %d\n",path,dirInode.vacantFile); 
-			bitmap_destroy(bmp);
-			if(block_store_write(fs->BlockStore_whole,dirInode.directPointer[0],&db_t) &&	block_store_inode_write(fs->BlockStore_inode,dirInodeID,&dirInode)) {
-				//printf("Success Dir %s not empty,vacantFile: %d\n",path,dirInode.vacantFile); 
-				return 0;
-			}
-			return -12;
+			return 0;
 		}
 		return -6;	
 	}
@@ -943,6 +2405,38 @@ int fs_remove(F17FS_t *fs, const char *path) {
 	// To delete a file, you need to search all the data blocks allocated to it, including direct, indirect and dbindirect blocks.
 }
 
+//
+// Deletes the specified file and closes all open descriptors to the file
+//   Directories can only be removed when empty
+// \param fs The F17FS containing the file
+// \param path Absolute path to file to remove
+// \return 0 on success, < 0 on error
+//
+int fs_remove(F17FS_t *fs, const char *path) {
+	if(fs == NULL || path == NULL || strlen(path) == 0){
+		return -1;
+	}
+	// Validate the path
+	char firstChar = *path;
+	if(firstChar != '/'){return -2;}
+	return remove_in(fs,0,path);
+}
+
+///
+/// Deletes a file, fs_remove with a path relative to a directory handle (or an absolute one)
+/// \param fs The F17FS containing the file
+/// \param dirfd Directory handle from fs_opendir_handle
+/// \param path Path to the file to remove, relative to the directory
+/// \return 0 on success, < 0 on error
+///
+int fs_removeat(F17FS_t *fs, int dirfd, const char *path){
+	size_t start = handle_inode(fs,dirfd);
+	if(start == SIZE_MAX || path == NULL || strlen(path) == 0){
+		return -1;
+	}
+	return remove_in(fs,start,path);
+}
+
 ///
 /// Moves the R/W position of the given descriptor to the given location
 ///   Files cannot be seeked past EOF or before BOF (beginning of file or offset==0)
@@ -957,8 +2451,8 @@ off_t fs_seek(F17FS_t *fs, int fd, off_t offset, seek_t whence){
 	if(fs !=NULL && fd >= 0 && block_store_sub_test(fs->BlockStore_fd,fd)){
 		fileDescriptor_t fd_t;
 		inode_t fileInode;
-		if(0 !=block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) && 0 != block_store_inode_read(fs->BlockStore_inode,fd_t.inodeNum,&fileInode)){
-			ssize_t currentOffset = getFileSize(&fd_t);
+		if(0 !=block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) && 0 != read_inode(fs,fd_t.inodeNum,&fileInode)){
+			ssize_t currentOffset = getFileSize(fs,&fd_t);
 			ssize_t fileSize = fileInode.fileSize;
 			off_t stdOffset; // Standardized offset, starting from BOF
 			// Standardize the offset against the BOF from the three cases: FS_SEEK_SET, FS_SEEK_CUR, and FS_SEEK_END
@@ -990,19 +2484,7 @@ off_t fs_seek(F17FS_t *fs, int fd, off_t offset, seek_t whence){
 				return -4;
 			}	
 			// Calculate the relative offset, order, and usage	
-			if((stdOffset/BLOCK_SIZE_BYTES) >= DIRECT_BLOCKS + INDIRECT_BLOCKS) {
-				fd_t.usage = 4;
-				fd_t.locate_offset = stdOffset % BLOCK_SIZE_BYTES;
-				fd_t.locate_order = (stdOffset/BLOCK_SIZE_BYTES) - (DIRECT_BLOCKS + INDIRECT_BLOCKS);
-			} else if (ceil(1.0*stdOffset/BLOCK_SIZE_BYTES) >= DIRECT_BLOCKS){
-				fd_t.usage = 2;
-				fd_t.locate_offset = stdOffset % BLOCK_SIZE_BYTES;
-				fd_t.locate_order = (stdOffset/BLOCK_SIZE_BYTES) - DIRECT_BLOCKS; 
-			} else {
-				fd_t.usage = 1;
-                		fd_t.locate_offset = stdOffset % BLOCK_SIZE_BYTES;
-                		fd_t.locate_order = stdOffset/BLOCK_SIZE_BYTES;
-			}
+			setFileLocation(fs,&fd_t,stdOffset);
 			if(0 != block_store_fd_write(fs->BlockStore_fd,fd,&fd_t)){
 				return stdOffset;
 			} 
@@ -1030,52 +2512,41 @@ ssize_t fs_read(F17FS_t *fs, int fd, void *dst, size_t nbyte){
 			// Open the fileDescriptor and file inode
 			fileDescriptor_t fd_t;
 			inode_t fileInode;
-			if(0 != block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) && 0 != block_store_inode_read(fs->BlockStore_inode,fd_t.inodeNum,&fileInode)){
+			if(0 != block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) && 0 != read_inode(fs,fd_t.inodeNum,&fileInode)){
 				// Get the current offset and the file size
 				size_t fileSize =  fileInode.fileSize;
-				size_t currentOffset = getFileSize(&fd_t);
+				size_t currentOffset = getFileSize(fs,&fd_t);
 				// Calculate the maximum of bytes it can read (fileSize - current offset)
 				size_t leftBytes = fileSize - currentOffset;
 				// If the maximum of bytes to read is smaller than nbyte, then set nbyte to  maximum of bytes 
 				if(nbyte > leftBytes){
 					nbyte =  leftBytes;
 				}
-				size_t readBytes = 0;
-				while(nbyte - readBytes > 0){
-					uint16_t blockID = get_data_block_id(fs,&fd_t); // Get the data block to read	
-					if(blockID > 0){
-						if(fd_t.locate_offset + nbyte - readBytes < BLOCK_SIZE_BYTES){
-							// Need a special read method here to write less than BLOCK_SIZE_BYTES
-							if(0 != block_store_n_read(fs->BlockStore_whole,blockID,fd_t.locate_offset,dst+readBytes,nbyte-readBytes)){
-								fd_t.locate_offset = fd_t.locate_offset + nbyte - readBytes;
-								readBytes = nbyte;
-								continue;
-							}
-							return -4;
-						} else {
-							if(0 != block_store_n_read(fs->BlockStore_whole,blockID,fd_t.locate_offset,dst+readBytes,BLOCK_SIZE_BYTES-fd_t.locate_offset)){
-								readBytes += (BLOCK_SIZE_BYTES-fd_t.locate_offset);
-								// increment usage and locate_order
-								if(fd_t.usage==1&&fd_t.locate_order== (DIRECT_BLOCKS-1)){ // directPointer space is full
-									fd_t.locate_order = 0;
-									fd_t.usage = 2;
-									//printf("dip into indirect blocks\n");
-								} else if(fd_t.usage==2&&fd_t.locate_order== (INDIRECT_BLOCKS-1)){ // indirectPointer space is full
-									fd_t.locate_order = 0;
-									fd_t.usage = 4;
-									//printf("dip into double indirect blocks\n");
-								} else { // as long as not exceeding the double inidirect max, unlikely
-									fd_t.locate_order += 1;
-								}
-								fd_t.locate_offset = 0;
-								continue;
-							}
-							return -5;	
-						}
-					}
+				if(nbyte == 0){
+					return 0;
+				}
+				// look up every block the read touches, then copy them with vectored reads
+				size_t firstBlock = currentOffset / fs->blockSize;
+				size_t blockCount = (currentOffset + nbyte - 1) / fs->blockSize - firstBlock + 1;
+				uint32_t *blockIDs = malloc(blockCount * sizeof(uint32_t));
+				if(blockIDs == NULL){
 					return -3;
 				}
+				if(map_file_blocks(fs,&fileInode,firstBlock,blockCount,false,blockIDs) < blockCount){
+					free(blockIDs);
+					return -3;
+				}
+				size_t readBytes = transfer_blocks(fs,blockIDs,fd_t.locate_offset,dst,NULL,nbyte);
+				free(blockIDs);
+				if(readBytes < nbyte){
+					return -4;
+				}
+				setFileLocation(fs,&fd_t, currentOffset + readBytes);
 				if(0 != block_store_fd_write(fs->BlockStore_fd,fd,&fd_t)){ // update the fd
+					readahead_after_read(fs,fd,&fileInode,currentOffset,readBytes);
+					if(fs->readahead[fd].noreuse){
+						drop_behind(fs,fd,&fileInode,currentOffset,readBytes);
+					}
 					return readBytes;
 				}
 				return -6;					
@@ -1088,6 +2559,169 @@ ssize_t fs_read(F17FS_t *fs, int fd, void *dst, size_t nbyte){
 }
 
 
+///
+/// Gets every change made to the file system onto the disk
+/// \param fs The F17FS to sync
+/// \return 0 on success, < 0 on error
+///
+int fs_sync(F17FS_t *fs){
+	if(fs == NULL){
+		return -1;
+	}
+	return block_store_sync(fs->BlockStore_whole) ? 0 : -2;
+}
+
+///
+/// Gets the changes to one file onto the disk: its data and index blocks, its inode and the
+///   allocation bitmaps
+/// \param fs The F17FS containing the file
+/// \param fd The file to sync
+/// \return 0 on success, < 0 on error
+///
+int fs_fsync(F17FS_t *fs, int fd){
+	if(fs == NULL || fd < 0 || !block_store_sub_test(fs->BlockStore_fd,fd)){
+		return -1;
+	}
+	fileDescriptor_t fd_t;
+	inode_t fileInode;
+	if(0 == block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) || 0 == read_inode(fs,fd_t.inodeNum,&fileInode)){
+		return -2;
+	}
+	// data blocks, then the index tables (at most one indirect, one outer and tableEntries inner), and the blocks
+	//  of the inode's bit and its 64 bytes (with the superblock, which maps the inode file, past the inode table)
+	size_t dataBlocks = (fileInode.fileSize + fs->blockSize - 1) / fs->blockSize;
+	size_t *blockIDs = malloc((dataBlocks + fs->tableEntries + 5) * sizeof(size_t));
+	uint32_t *dataIDs = malloc((dataBlocks ? dataBlocks : 1) * sizeof(uint32_t));
+	if(blockIDs == NULL || dataIDs == NULL){
+		free(blockIDs);
+		free(dataIDs);
+		return -3;
+	}
+	size_t count = map_file_blocks(fs,&fileInode,0,dataBlocks,false,dataIDs);
+	for(size_t i = 0; i < count; i++){
+		blockIDs[i] = dataIDs[i];
+	}
+	free(dataIDs);
+	if(fileInode.indirectPointer != 0x0000){
+		blockIDs[count++] = fileInode.indirectPointer;
+	}
+	if(fileInode.doubleIndirectPointer != 0x0000){
+		blockIDs[count++] = fileInode.doubleIndirectPointer;
+		const void *outer = block_store_view(fs->BlockStore_whole, fileInode.doubleIndirectPointer);
+		if(outer == NULL){
+			free(blockIDs);
+			return -4;
+		}
+		for(size_t slot = 0; slot < fs->tableEntries && get_entry(outer, fs->wideIds, slot) != 0x0000; slot++){
+			blockIDs[count++] = get_entry(outer, fs->wideIds, slot);
+		}
+		block_store_unpin(fs->BlockStore_whole, fileInode.doubleIndirectPointer);
+	}
+	if(fd_t.inodeNum < INODE_COUNT){
+		blockIDs[count++] = fs->inodeBitmapBlock;
+		blockIDs[count++] = fs->inodeTableBlock + fd_t.inodeNum * sizeof(inode_t) / fs->blockSize;
+	} else {
+		size_t slot = fd_t.inodeNum - INODE_COUNT, offset;
+		blockIDs[count++] = 0;
+		blockIDs[count++] = locate_in(fs, &fs->super.inodeMapFile, slot / 8, &offset);
+		blockIDs[count++] = locate_in(fs, &fs->super.inodeFile, slot * sizeof(inode_t), &offset);
+	}
+	bool synced = block_store_sync_blocks(fs->BlockStore_whole, blockIDs, count);
+	free(blockIDs);
+	return synced ? 0 : -5;
+}
+
+///
+/// Gives a hint about how a file will be accessed
+/// \param fs The F17FS containing the file
+/// \param fd The file
+/// \param offset Start of the range
+/// \param len Length of the range, 0 for up to the end of the file
+/// \param advice The hint
+/// \return 0 on success, < 0 on error
+///
+int fs_advise(F17FS_t *fs, int fd, off_t offset, size_t len, fs_advice_t advice){
+	if(fs == NULL || fd < 0 || !block_store_sub_test(fs->BlockStore_fd,fd) || offset < 0 || (unsigned)advice > FS_ADVICE_NOREUSE){
+		return -1;
+	}
+	fileDescriptor_t fd_t;
+	inode_t fileInode;
+	if(0 == block_store_fd_read(fs->BlockStore_fd,fd,&fd_t) || 0 == read_inode(fs,fd_t.inodeNum,&fileInode)){
+		return -2;
+	}
+	// the range in logical blocks, cut off at the end of the file
+	size_t fileBlocks = (fileInode.fileSize + fs->blockSize - 1) / fs->blockSize;
+	size_t first = (size_t)offset / fs->blockSize;
+	size_t end = (len == 0 || len > fileInode.fileSize) ? fileBlocks : ((size_t)offset + len + fs->blockSize - 1) / fs->blockSize;
+	end = end < fileBlocks ? end : fileBlocks;
+	readahead_t *ra = &fs->readahead[fd];
+	switch(advice){
+		case FS_ADVICE_NORMAL:
+		case FS_ADVICE_SEQUENTIAL:
+		case FS_ADVICE_RANDOM:
+			ra->pattern = advice;
+			ra->noreuse = false;
+			ra->window = 0;
+			ra->ahead = 0;
+			advise_file_blocks(fs, &fileInode, first, end,
+					advice == FS_ADVICE_SEQUENTIAL ? BLOCK_STORE_ADVICE_SEQUENTIAL : advice == FS_ADVICE_RANDOM ? BLOCK_STORE_ADVICE_RANDOM : BLOCK_STORE_ADVICE_NORMAL);
+			break;
+		case FS_ADVICE_WILLNEED:
+			advise_file_blocks(fs, &fileInode, first, end, BLOCK_STORE_ADVICE_WILLNEED);
+			break;
+		case FS_ADVICE_DONTNEED:
+			advise_file_blocks(fs, &fileInode, first, end, BLOCK_STORE_ADVICE_DONTNEED);
+			ra->ahead = 0;	// whatever was read ahead is gone
+			break;
+		case FS_ADVICE_NOREUSE:
+			ra->noreuse = true;
+			ra->dropped = first;
+			ra->tailStart = ra->tailEnd = 0;
+			break;
+	}
+	return 0;
+}
+
+///
+/// Reads the background flusher's counters (all zero when it was never started)
+/// \param fs The F17FS
+/// \param stats Receives the counters
+/// \return 0 on success, < 0 on error
+///
+int fs_get_flush_stats(F17FS_t *fs, fs_flush_stats_t *stats){
+	block_store_flush_stats_t bsStats;
+	if(fs == NULL || stats == NULL || !block_store_get_flush_stats(fs->BlockStore_whole, &bsStats)){
+		return -1;
+	}
+	stats->flushes = bsStats.flushes;
+	stats->flushed_blocks = bsStats.flushed_blocks;
+	stats->failures = bsStats.failures;
+	stats->flush_ns_total = bsStats.flush_ns_total;
+	stats->flush_ns_max = bsStats.flush_ns_max;
+	return 0;
+}
+
+///
+/// Reads the geometry and counts of the file system
+/// \param fs The F17FS
+/// \param info Receives them
+/// \return 0 on success, < 0 on error
+///
+int fs_get_info(F17FS_t *fs, fs_info_t *info){
+	if(fs == NULL || info == NULL){
+		return -1;
+	}
+	info->block_size = fs->blockSize;
+	info->blocks = block_store_get_block_count(fs->BlockStore_whole);
+	info->free_blocks = block_store_get_free_blocks(fs->BlockStore_whole);
+	info->inodes = fs->super.inodeCount;
+	info->free_inodes = free_inodes(fs);
+	info->features = fs->super.features;
+	info->mounted_clean = fs->mountedClean;
+	info->mount_count = fs->super.mountCount;
+	return 0;
+}
+
 /// Moves the file from one location to the other
 ///   Moving files does not affect open descriptors
 /// \param fs The F17FS containing the file
@@ -1102,105 +2736,31 @@ int fs_move(F17FS_t *fs, const char *src, const char *dst){
 		char firstChar_src = *src;
 		char firstChar_dst = *dst;
 		if(0 != strcmp(src,"/") && 0 != strcmp(dst,"/") && firstChar_src == '/' && firstChar_dst == '/'){
-			// Get the dirname and basename of src
-			char src_dirc[strlen(src)+1];
-			char src_basec[strlen(src)+1];
-			strcpy(src_dirc,src);
-			strcpy(src_basec,src);
-			char *src_dir = dirname(src_dirc);
-			char *src_base = basename(src_basec);
-			// Get the dirname and basename of dst
-			char dst_dirc[strlen(dst)+1];				
-			char dst_basec[strlen(dst)+1];
-			strcpy(dst_dirc,dst);
-			strcpy(dst_basec,dst);
-			char *dst_dir = dirname(dst_dirc);
-			char *dst_base = basename(dst_basec);
-			
-			size_t src_parentDirInodeID = searchPath(fs,src_dir);// src parent dir inode number 
-			size_t dst_parentDirInodeID = searchPath(fs,dst_dir);// dst parent dir inode numbeir
+			// Resolve both paths: the parent directories, and the names in them
+			pathTarget_t srcTarget, dstTarget;
+			resolve_path(fs,0,src,&srcTarget);
+			resolve_path(fs,0,dst,&dstTarget);
+			size_t src_parentDirInodeID = srcTarget.parent;// src parent dir inode number 
+			size_t dst_parentDirInodeID = dstTarget.parent;// dst parent dir inode number
+			char *src_base = srcTarget.name;
+			char *dst_base = dstTarget.name;
 			// Parent directories of both src and dst must exist
 			// Make sure the src basename is not one of the parent dir names of the dst
 			// src cannot be the parent directory or above of dst
 			if((!(strlen(src) < strlen(dst) && 0 == strncmp(src,dst,strlen(src)))) && src_parentDirInodeID != SIZE_MAX && dst_parentDirInodeID != SIZE_MAX){
-				size_t src_inodeID = getFileInodeID(fs,src_parentDirInodeID,src_base);
-				size_t dst_inodeID = getFileInodeID(fs,dst_parentDirInodeID,dst_base);
+				size_t src_inodeID = srcTarget.inode;
 				// src inode must exist, but dst inode must not
-				if(src_inodeID != 0 && dst_inodeID == 0){
-					// If src and dst under same parent dir, just change the entry name of the src to dst_base
-					if(src_parentDirInodeID == dst_parentDirInodeID){
-						inode_t src_parentDirInode;
-						directoryBlock_t src_parentDirBlock;
-						if(block_store_inode_read(fs->BlockStore_inode,src_parentDirInodeID,&src_parentDirInode) && 
-							block_store_read(fs->BlockStore_whole,src_parentDirInode.directPointer[0],&src_parentDirBlock))
-						{	 
-							size_t i=0;
-							for(;i<7;i++){
-								// If the entry name and inode number match those of the src, change the name of src to that of the dst
-								if(src_parentDirBlock.dentries[i].inodeNumber == src_inodeID && 0 == strcmp(src_parentDirBlock.dentries[i].filename,src_base)){
-									// Change the file name but not the inode number
-									strcpy(src_parentDirBlock.dentries[i].filename,dst_base);
-									if(block_store_write(fs->BlockStore_whole,src_parentDirInode.directPointer[0],&src_parentDirBlock)){
-										return 0;// Success	
-									}
-								}
-							}
-							return -6;	
-						}		
-						return -5;
-					} else {
-						// ...If not under the same directory, add the src file or dir under the parent directory of dst
-						// ...and remove the src file or dir entry from the parent directory of src
-						// Since we rule out the possibility of src being parent of the dst, no worries about that
-						// First, check if the dst parent directory is full
-						inode_t dst_parentDirInode;
-						inode_t src_parentDirInode;
-						directoryBlock_t dst_parentDirBlock;	
-						directoryBlock_t src_parentDirBlock;	
-						if(block_store_inode_read(fs->BlockStore_inode,dst_parentDirInodeID,&dst_parentDirInode) && block_store_read(fs->BlockStore_whole,dst_parentDirInode.directPointer[0],&dst_parentDirBlock) && block_store_inode_read(fs->BlockStore_inode,src_parentDirInodeID,&src_parentDirInode) && block_store_read(fs->BlockStore_whole,src_parentDirInode.directPointer[0],&src_parentDirBlock))
-						{
-							bitmap_t *dst_bmp = bitmap_overlay(8,&(dst_parentDirInode.vacantFile));
-							bitmap_t *src_bmp = bitmap_overlay(8,&(src_parentDirInode.vacantFile));
-							if(dst_bmp && src_bmp){
-								size_t i=0;
-								for(;i<7;i++){
-									// Select an empty entry, and set it to the name of dst and inode number of the src
-									if(!bitmap_test(dst_bmp,i)){
-										bitmap_set(dst_bmp,i);
-										strcpy(dst_parentDirBlock.dentries[i].filename,dst_base);
-										dst_parentDirBlock.dentries[i].inodeNumber = src_inodeID;
-										size_t j=0;
-										for(;j<7;j++){
-											// Remove the src file entry from its parent dir file block
-											if(src_parentDirBlock.dentries[j].inodeNumber == src_inodeID){
-												bitmap_reset(src_bmp,j);
-												memset(src_parentDirBlock.dentries[j].filename,'\0',FS_FNAME_MAX) ;
-												src_parentDirBlock.dentries[j].inodeNumber = 0x00;
-												// Update the parent directory inodes and file blocks of both dst and src
-												if(block_store_write(fs->BlockStore_whole,dst_parentDirInode.directPointer[0],&dst_parentDirBlock)
-												&& block_store_write(fs->BlockStore_whole,src_parentDirInode.directPointer[0],&src_parentDirBlock)
-												&& block_store_inode_write(fs->BlockStore_inode,dst_parentDirInodeID,&dst_parentDirInode)
-												&& block_store_inode_write(fs->BlockStore_inode,src_parentDirInodeID,&src_parentDirInode)) {
-													bitmap_destroy(dst_bmp);
-													bitmap_destroy(src_bmp);
-													return 0;
-												}
-												bitmap_destroy(dst_bmp);
-												bitmap_destroy(src_bmp);
-												return -10;	
-											}
-										}
-										
-									}
-								}
-								bitmap_destroy(dst_bmp);
-								bitmap_destroy(src_bmp);
-								return -9;	
-							}	
-							return -8;
-						}
-						return -7;
+				if(src_inodeID != 0 && src_inodeID != SIZE_MAX && dstTarget.inode == SIZE_MAX && !dstTarget.tooLong){
+					// Add the entry under the dst parent first (the same directory for a rename), so a failure
+					// leaves src where it was, then remove the src entry; the inode itself doesn't change
+					int added = dir_insert(fs,dst_parentDirInodeID,dst_base,src_inodeID,srcTarget.type);
+					if(added != 0){
+						return added == -1 ? -9 : -7;
 					}
+					if(SIZE_MAX == dir_remove(fs,src_parentDirInodeID,src_base)){
+						return -10;
+					}
+					return 0;
 				}
 				//printf("src_base:%s, dst_base:%s\n",src_base,dst_base);
 				//printf("srcInodeID:%lu, dstInodeID:%lu\n",src_inodeID,dst_inodeID);
@@ -1222,72 +2782,34 @@ int fs_link(F17FS_t *fs, const char *src, const char *dst){
 		char firstChar_src = *src;
 		char firstChar_dst = *dst;
 		if(0 != strcmp(dst,"/") && firstChar_src == '/' && firstChar_dst == '/'){
-      		 // Get the dirname and basename of src
-       		char src_dirc[strlen(src)+1];
-	    	char src_basec[strlen(src)+1];
-	    	strcpy(src_dirc,src);
-			strcpy(src_basec,src);
-			char *src_dir = dirname(src_dirc);
-			char *src_base = basename(src_basec);
-			// Get the dirname and basename of dst
-			char dst_dirc[strlen(dst)+1];				
-			char dst_basec[strlen(dst)+1];
-			strcpy(dst_dirc,dst);
-			strcpy(dst_basec,dst);
-			char *dst_dir = dirname(dst_dirc);
-			char *dst_base = basename(dst_basec);
-		
-			size_t src_parentDirInodeID = searchPath(fs,src_dir);// src parent dir inode number 
-			size_t dst_parentDirInodeID = searchPath(fs,dst_dir);// dst parent dir inode numbeir
+			// Resolve both paths: the parent directories, and the names in them
+			pathTarget_t srcTarget, dstTarget;
+			resolve_path(fs,0,src,&srcTarget);
+			resolve_path(fs,0,dst,&dstTarget);
+			size_t dst_parentDirInodeID = dstTarget.parent;// dst parent dir inode number
+			char *dst_base = dstTarget.name;
 			// Parent directories of both src and dst must exist
-			// Make sure the src basename is not one of the parent dir names of the dst
-			// src cannot be the parent directory or above of dst
-			if(src_parentDirInodeID != SIZE_MAX && dst_parentDirInodeID != SIZE_MAX){
-				size_t src_inodeID = getFileInodeID(fs,src_parentDirInodeID,src_base);
-				size_t dst_inodeID = getFileInodeID(fs,dst_parentDirInodeID,dst_base);
+			if(srcTarget.parent != SIZE_MAX && dst_parentDirInodeID != SIZE_MAX){
+				size_t src_inodeID = srcTarget.inode;
 				// src inode must exist, but dst inode must not
-				if(src_inodeID != 0 && dst_inodeID == 0){
-					// Check if the dst parent dir is full	
-					inode_t dst_parentDirInode;
+				if(src_inodeID != 0 && src_inodeID != SIZE_MAX && dstTarget.inode == SIZE_MAX && !dstTarget.tooLong){
 					inode_t src_inode;
-					directoryBlock_t dst_parentDirBlock;
-					if(block_store_inode_read(fs->BlockStore_inode,dst_parentDirInodeID,&dst_parentDirInode) && block_store_inode_read(fs->BlockStore_inode,src_inodeID,&src_inode) && block_store_read(fs->BlockStore_whole,dst_parentDirInode.directPointer[0],&dst_parentDirBlock) && src_inode.linkCount < 255) {
-						bitmap_t *bmp = bitmap_overlay(8,&(dst_parentDirInode.vacantFile));
-						if(bmp){
-							//printf("dst path: %s\n",dst);
-							size_t i = 0;
-							for(;i<7;i++){
-								// Find an empty entry and set filename to the dst_base and inodeNumber to src_inodeID
-								if(!bitmap_test(bmp,i)){
-									strncpy(dst_parentDirBlock.dentries[i].filename,dst_base,FS_FNAME_MAX);
-									//printf("index: %lu,dst_base: %s\n",i,dst_parentDirBlock.dentries[i].filename);
-									dst_parentDirBlock.dentries[i].inodeNumber = src_inodeID;
-									// Increment linkCount by 1
-									src_inode.linkCount += 1;
-									if(src_inodeID == dst_parentDirInodeID){
-										dst_parentDirInode.linkCount += 1;
-									}
-									bitmap_set(bmp,i);
-									// Have to update the src inode first, in case src_inodeID == dst_parentDirInodeID, ie, link to yourself
-									if(block_store_inode_write(fs->BlockStore_inode,src_inodeID,&src_inode) && block_store_inode_write(fs->BlockStore_inode,dst_parentDirInodeID,&dst_parentDirInode) && block_store_write(fs->BlockStore_whole,dst_parentDirInode.directPointer[0],&dst_parentDirBlock)){
-										bitmap_destroy(bmp);
-										return 0;
-									}
-									//printf("Error: -9\n");
-									bitmap_destroy(bmp);
-									return -9;	
-								}
-								//printf("index: %lu,dst_base: %s\n",i,dst_parentDirBlock.dentries[i].filename);
-							}
-							//printf("Error: -8\n");
-							bitmap_destroy(bmp);
-							return -7;	
+					if(0 == read_inode(fs,src_inodeID,&src_inode) || src_inode.linkCount >= 255){
+						return -5;
+					}
+					// Add an entry with dst_base and src_inodeID to the dst parent dir
+					int added = dir_insert(fs,dst_parentDirInodeID,dst_base,src_inodeID,src_inode.fileType);
+					if(added != 0){
+						return added == -1 ? -7 : -6;
+					}
+					// Increment linkCount by 1, reading the inode again in case src_inodeID == dst_parentDirInodeID, ie, link to yourself
+					if(read_inode(fs,src_inodeID,&src_inode)){
+						src_inode.linkCount += 1;
+						if(write_inode(fs,src_inodeID,&src_inode)){
+							return 0;
 						}
-						//printf("Error: -6\n");
-						return -6;
 					}
-					//printf("Error: -5\n");
-					return -5;	
+					return -9;
 				}
 				//printf("Error: -4\n");
 				return -4;
@@ -1,15 +1,36 @@
 #include "bitmap.h"
 #include <string.h>
 
+// SSE2 is baseline on x86-64, so this is the common path there.
+// Define BITMAP_NO_SIMD and/or BITMAP_NO_BUILTINS to force the portable scalar code.
+#if defined(__SSE2__) && !defined(BITMAP_NO_SIMD)
+#include <emmintrin.h>
+#define BITMAP_USE_SSE2 1
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BITMAP_NO_BUILTINS)
+#define BITMAP_USE_BUILTINS 1
+#endif
+
 // Just the one for now. Indicates we're an overlay and should not free
 // (also, make sure that ALL is as wide as ll of the flags)
 typedef enum { NONE = 0x00, OVERLAY = 0x01, ALL = 0xFF } BITMAP_FLAGS;
 
+// Enough summary levels for 2^54 bits, each level is 64 times smaller than the one below
+#define SUMMARY_MAX_LEVELS 8
+
 struct bitmap {
     unsigned leftover_bits;  // Packing will increase this to an int anyway
     BITMAP_FLAGS flags;      // Generic place to store flags. Not enough flags to worry about width yet.
     uint8_t *data;
     size_t bit_count, byte_count;
+    // optional summary levels (summary_levels is 0 if disabled): bit n of level 0 is set when 64-bit word n
+    //  has a zero bit (a set bit for a set summary), bit n of level k when word n of level k - 1 isn't 0.
+    //  The top level is a single word
+    uint64_t *summary[SUMMARY_MAX_LEVELS];
+    size_t summary_bits[SUMMARY_MAX_LEVELS];
+    size_t summary_levels;
+    bool summary_set;        // the summary tracks set bits (ffs searches) rather than zero bits
+    bool summary_stale;      // the levels aren't built yet (bitmap_build_summary), searches scan the map
 };
 
 
@@ -23,9 +44,6 @@ struct bitmap {
 //  Won't help until bitmap uses native width for the array
 static const uint8_t mask[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
 
-// Mask for all bits at index i and lower
-static const uint8_t mask_down_inclusive[8] = {0x01, 0x03, 0x07, 0x0F, 0x1F, 0x3F, 0x7F, 0xFF};
-
 // Inverted mask
 static const uint8_t invert_mask[8] = {0xFE, 0xFD, 0xFB, 0xF7, 0xEF, 0xDF, 0xBF, 0x7F};
 
@@ -34,7 +52,9 @@ static const uint8_t invert_mask[8] = {0xFE, 0xFD, 0xFB, 0xF7, 0xEF, 0xDF, 0xBF,
 // Since the data store is uint8_t, we already get punished for our bad alignment
 // so this doesn't really matter until everything gets moved to generic int
 
+#ifndef BITMAP_USE_BUILTINS
 // Total bits set in the given byte in a handy lookup table
+// (only needed by the scalar popcount fallback now)
 // Macros, man...
 // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetTable
 #define B2(n) n, n + 1, n + 1, n + 2
@@ -44,6 +64,7 @@ static const uint8_t bit_totals[256] = {B6(0), B6(1), B6(1), B6(2)};
 #undef B6
 #undef B4
 #undef B2
+#endif
 // There is an alternative for getting bit count that only loops as many times as there are bits set
 // but that's still a loop and this table is 256B.
 /*
@@ -59,12 +80,36 @@ static const uint8_t bit_totals[256] = {B6(0), B6(1), B6(1), B6(2)};
 // A place to generalize the creation process and setup
 bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags);
 
+// Word-parallel helpers, see the bottom of the file
+static size_t bitmap_scan(const bitmap_t *const bitmap, const size_t start, const bool find_zero);
+static uint64_t bitmap_load_word(const bitmap_t *const bitmap, const size_t word);
+static size_t bitmap_ctz64(const uint64_t word);
+static size_t bitmap_popcount64(const uint64_t word);
+static void bitmap_summary_update(bitmap_t *const bitmap, const size_t word);
+static void bitmap_summary_mark(bitmap_t *const bitmap, size_t idx, const bool on);
+static void bitmap_summary_rebuild(bitmap_t *const bitmap);
+static void bitmap_summary_free(bitmap_t *const bitmap);
+
 void bitmap_set(bitmap_t *const bitmap, const size_t bit) {
     bitmap->data[bit >> 3] |= mask[bit & 0x07];
+    if (bitmap->summary_levels && !bitmap->summary_stale) {
+        if (bitmap->summary_set) {
+            bitmap_summary_mark(bitmap, bit >> 6, true);  // definitely has a set bit now
+        } else {
+            bitmap_summary_update(bitmap, bit >> 6);  // the word may have just filled up
+        }
+    }
 }
 
 void bitmap_reset(bitmap_t *const bitmap, const size_t bit) {
     bitmap->data[bit >> 3] &= invert_mask[bit & 0x07];
+    if (bitmap->summary_levels && !bitmap->summary_stale) {
+        if (bitmap->summary_set) {
+            bitmap_summary_update(bitmap, bit >> 6);  // the word may have just emptied
+        } else {
+            bitmap_summary_mark(bitmap, bit >> 6, true);  // definitely has a zero now
+        }
+    }
 }
 
 bool bitmap_test(const bitmap_t *const bitmap, const size_t bit) {
@@ -73,30 +118,44 @@ bool bitmap_test(const bitmap_t *const bitmap, const size_t bit) {
 
 void bitmap_flip(bitmap_t *const bitmap, const size_t bit) {
     bitmap->data[bit >> 3] ^= mask[bit & 0x07];
+    if (bitmap->summary_levels && !bitmap->summary_stale) {
+        bitmap_summary_update(bitmap, bit >> 6);
+    }
 }
 
 void bitmap_invert(bitmap_t *const bitmap) {
     for (size_t byte = 0; byte < bitmap->byte_count; ++byte) {
         bitmap->data[byte] = ~bitmap->data[byte];
     }
+    if (bitmap->summary_levels) {
+        bitmap_summary_rebuild(bitmap);
+    }
 }
 
 size_t bitmap_ffs(const bitmap_t *const bitmap) {
     if (bitmap) {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && !bitmap_test(bitmap, result); ++result) {
-        }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
+        return bitmap_scan(bitmap, 0, false);
     }
     return SIZE_MAX;
 }
 
 size_t bitmap_ffz(const bitmap_t *const bitmap) {
     if (bitmap) {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && bitmap_test(bitmap, result); ++result) {
-        }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
+        return bitmap_scan(bitmap, 0, true);
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_ffs_from(const bitmap_t *const bitmap, const size_t start) {
+    if (bitmap) {
+        return bitmap_scan(bitmap, start, false);
+    }
+    return SIZE_MAX;
+}
+
+size_t bitmap_ffz_from(const bitmap_t *const bitmap, const size_t start) {
+    if (bitmap) {
+        return bitmap_scan(bitmap, start, true);
     }
     return SIZE_MAX;
 }
@@ -104,17 +163,11 @@ size_t bitmap_ffz(const bitmap_t *const bitmap) {
 size_t bitmap_total_set(const bitmap_t *const bitmap) {
     size_t total = 0;
     if (bitmap) {
-        // If we have leftover, stop a byte early because we have to handle it differently.
-        size_t stop = bitmap->leftover_bits ? bitmap->byte_count - 1 : bitmap->byte_count;
-        for (size_t idx = 0; idx < stop; ++idx) {
-            total += bit_totals[bitmap->data[idx]];
-        }
-        if (bitmap->leftover_bits) {
-            // haha, this is readable
-            // get the byte at the end of the bitmap, mask it so we're only looking at the bits in use
-            // then feed that to the bit_total lookup so we don't count the bits past our bit total
-            // (which whould be considered undetermined)
-            total += bit_totals[bitmap->data[bitmap->byte_count - 1] & mask_down_inclusive[bitmap->leftover_bits - 1]];
+        // Words past the end are zero padded and the tail is masked by bitmap_load_word,
+        // so no special leftover handling is needed anymore
+        const size_t words = (bitmap->bit_count + 63) >> 6;
+        for (size_t idx = 0; idx < words; ++idx) {
+            total += bitmap_popcount64(bitmap_load_word(bitmap, idx));
         }
     }
     return total;
@@ -122,9 +175,12 @@ size_t bitmap_total_set(const bitmap_t *const bitmap) {
 
 void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *), void *arg) {
     if (bitmap && func) {
-        for (size_t idx = 0; idx < bitmap->bit_count; ++idx) {
-            if (bitmap_test(bitmap, idx)) {
-                func(idx, arg);
+        const size_t words = (bitmap->bit_count + 63) >> 6;
+        for (size_t idx = 0; idx < words; ++idx) {
+            uint64_t word = bitmap_load_word(bitmap, idx);
+            while (word) {
+                func((idx << 6) + bitmap_ctz64(word), arg);
+                word &= word - 1;  // clear lowest set bit
             }
         }
     }
@@ -132,6 +188,50 @@ void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *),
 
 void bitmap_format(bitmap_t *const bitmap, const uint8_t pattern) {
     memset(bitmap->data, pattern, bitmap->byte_count);
+    if (bitmap->summary_levels) {
+        bitmap_summary_rebuild(bitmap);
+    }
+}
+
+// Sets up the summary levels for zero (set == false) or set searches, to be built by bitmap_build_summary
+//  that uses them: enabling stays cheap for a big map that may not be searched for a while
+static bool bitmap_summary_enable(bitmap_t *const bitmap, const bool set) {
+    if (!bitmap) {
+        return false;
+    }
+    if (!bitmap->summary_levels) {
+        size_t bits = (bitmap->bit_count + 63) >> 6;  // one per word of the map
+        for (size_t level = 0; level < SUMMARY_MAX_LEVELS; ++level) {
+            bitmap->summary[level]      = (uint64_t *) calloc((bits + 63) >> 6, sizeof(uint64_t));
+            bitmap->summary_bits[level] = bits;
+            if (!bitmap->summary[level]) {
+                bitmap_summary_free(bitmap);
+                return false;
+            }
+            if (bits <= 64) {
+                bitmap->summary_levels = level + 1;
+                break;
+            }
+            bits = (bits + 63) >> 6;
+        }
+    }
+    bitmap->summary_set = set;
+    bitmap->summary_stale = true;
+    return true;
+}
+
+bool bitmap_enable_summary(bitmap_t *const bitmap) {
+    return bitmap_summary_enable(bitmap, false);
+}
+
+bool bitmap_enable_set_summary(bitmap_t *const bitmap) {
+    return bitmap_summary_enable(bitmap, true);
+}
+
+void bitmap_build_summary(bitmap_t *const bitmap) {
+    if (bitmap && bitmap->summary_levels && bitmap->summary_stale) {
+        bitmap_summary_rebuild(bitmap);
+    }
 }
 
 size_t bitmap_get_bits(const bitmap_t *const bitmap) {
@@ -178,6 +278,7 @@ void bitmap_destroy(bitmap_t *bitmap) {
             // don't free memory that isn't ours!
             free(bitmap->data);
         }
+        bitmap_summary_free(bitmap);  // the summary is always ours
         free(bitmap);
     }
 }
@@ -193,6 +294,10 @@ bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags) {
         bitmap_t *bitmap = (bitmap_t *) malloc(sizeof(bitmap_t));
         if (bitmap) {
             bitmap->flags         = flags;
+            memset(bitmap->summary, 0, sizeof(bitmap->summary));
+            bitmap->summary_levels = 0;
+            bitmap->summary_set    = false;
+            bitmap->summary_stale  = false;
             bitmap->bit_count     = n_bits;
             bitmap->byte_count    = n_bits >> 3;
             bitmap->leftover_bits = n_bits & 0x07;
@@ -220,3 +325,215 @@ bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags) {
     }
     return NULL;
 }
+
+
+// Assembles 64 bits starting at bit (word * 64) into a little-endian word,
+//  so bit n of the bitmap is bit (n & 63) of the word regardless of host byte order.
+// The storage is a byte array that may be an overlay at any alignment (or only a byte long),
+//  hence the memcpy, which the compiler turns into a single unaligned load.
+// Bits past bit_count are always returned as zero.
+static uint64_t bitmap_load_word(const bitmap_t *const bitmap, const size_t word) {
+    uint64_t result     = 0;
+    const size_t offset = word << 3;
+    if (offset + 8 <= bitmap->byte_count) {
+        memcpy(&result, bitmap->data + offset, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        result = __builtin_bswap64(result);
+#endif
+    } else {
+        for (size_t byte = offset; byte < bitmap->byte_count; ++byte) {
+            result |= (uint64_t) bitmap->data[byte] << ((byte - offset) << 3);
+        }
+    }
+    const size_t remaining = bitmap->bit_count - (word << 6);
+    if (remaining < 64) {
+        result &= (UINT64_C(1) << remaining) - 1;
+    }
+    return result;
+}
+
+#ifdef BITMAP_USE_BUILTINS
+
+static size_t bitmap_ctz64(const uint64_t word) {
+    return (size_t) __builtin_ctzll(word);
+}
+
+static size_t bitmap_popcount64(const uint64_t word) {
+    return (size_t) __builtin_popcountll(word);
+}
+
+#else
+
+// Scalar fallbacks
+// http://graphics.stanford.edu/~seander/bithacks.html#ZerosOnRightMultLookup (64-bit de Bruijn)
+static size_t bitmap_ctz64(const uint64_t word) {
+    static const uint8_t debruijn_index[64] = {
+        0,  1,  2,  53, 3,  7,  54, 27, 4,  38, 41, 8,  34, 55, 48, 28, 62, 5,  39, 46, 44, 42,
+        22, 9,  24, 35, 59, 56, 49, 18, 29, 11, 63, 52, 6,  26, 37, 40, 33, 47, 61, 45, 43, 21,
+        23, 58, 17, 10, 51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12};
+    return debruijn_index[((word & -word) * UINT64_C(0x022FDD63CC95386D)) >> 58];
+}
+
+static size_t bitmap_popcount64(uint64_t word) {
+    size_t total = 0;
+    for (int byte = 0; byte < 8; ++byte, word >>= 8) {
+        total += bit_totals[word & 0xFF];
+    }
+    return total;
+}
+
+#endif
+
+// True if 64-bit word has a zero bit inside the bitmap (padding past bit_count doesn't count)
+static bool bitmap_word_has_zero(const bitmap_t *const bitmap, const size_t word) {
+    const size_t remaining = bitmap->bit_count - (word << 6);
+    const uint64_t valid   = remaining < 64 ? (UINT64_C(1) << remaining) - 1 : ~UINT64_C(0);
+    return (~bitmap_load_word(bitmap, word) & valid) != 0;
+}
+
+// True if the word counts for the summary: it has a zero bit, or a set bit for a set summary
+static bool bitmap_summary_wants(const bitmap_t *const bitmap, const size_t word) {
+    return bitmap->summary_set ? bitmap_load_word(bitmap, word) != 0 : bitmap_word_has_zero(bitmap, word);
+}
+
+// Sets (on) or clears bit idx of summary level 0 and carries the change up: a level k word going
+//  from 0 to non-zero or back is the only thing level k + 1 sees
+static void bitmap_summary_mark(bitmap_t *const bitmap, size_t idx, const bool on) {
+    for (size_t level = 0; level < bitmap->summary_levels; ++level, idx >>= 6) {
+        uint64_t *const word = &bitmap->summary[level][idx >> 6];
+        const uint64_t bit   = UINT64_C(1) << (idx & 63);
+        const bool was_empty = *word == 0;
+        if (on) {
+            if (*word & bit) {
+                return;
+            }
+            *word |= bit;
+            if (!was_empty) {
+                return;
+            }
+        } else {
+            if (!(*word & bit)) {
+                return;
+            }
+            *word &= ~bit;
+            if (*word) {
+                return;
+            }
+        }
+    }
+}
+
+static void bitmap_summary_update(bitmap_t *const bitmap, const size_t word) {
+    bitmap_summary_mark(bitmap, word, bitmap_summary_wants(bitmap, word));
+}
+
+static void bitmap_summary_rebuild(bitmap_t *const bitmap) {
+    bitmap->summary_stale = false;
+    for (size_t level = 0; level < bitmap->summary_levels; ++level) {
+        memset(bitmap->summary[level], 0, ((bitmap->summary_bits[level] + 63) >> 6) * sizeof(uint64_t));
+    }
+    for (size_t word = 0; word < bitmap->summary_bits[0]; ++word) {
+        if (bitmap_summary_wants(bitmap, word)) {
+            bitmap->summary[0][word >> 6] |= UINT64_C(1) << (word & 63);
+        }
+    }
+    for (size_t level = 1; level < bitmap->summary_levels; ++level) {
+        for (size_t idx = 0; idx < bitmap->summary_bits[level]; ++idx) {
+            if (bitmap->summary[level - 1][idx]) {
+                bitmap->summary[level][idx >> 6] |= UINT64_C(1) << (idx & 63);
+            }
+        }
+    }
+}
+
+static void bitmap_summary_free(bitmap_t *const bitmap) {
+    for (size_t level = 0; level < SUMMARY_MAX_LEVELS; ++level) {
+        free(bitmap->summary[level]);
+        bitmap->summary[level] = NULL;
+    }
+    bitmap->summary_levels = 0;
+}
+
+// First set bit at or after pos in a summary level, SIZE_MAX if none. A word with nothing left in it
+//  is passed up to the next level, so the walk costs a word per level rather than a scan
+static size_t bitmap_summary_next(const bitmap_t *const bitmap, const size_t level, const size_t pos) {
+    if (pos >= bitmap->summary_bits[level]) {
+        return SIZE_MAX;
+    }
+    const uint64_t word = bitmap->summary[level][pos >> 6] & (~UINT64_C(0) << (pos & 63));
+    if (word) {
+        return (pos & ~(size_t) 63) + bitmap_ctz64(word);
+    }
+    if (level + 1 == bitmap->summary_levels) {
+        return SIZE_MAX;  // the top level is a single word
+    }
+    const size_t next = bitmap_summary_next(bitmap, level + 1, (pos >> 6) + 1);
+    return next == SIZE_MAX ? SIZE_MAX : (next << 6) + bitmap_ctz64(bitmap->summary[level][next]);
+}
+
+// Search through the summary levels: whatever the size or fill of the map, only the word holding
+//  start, one word per level and the word with the match are looked at
+static size_t bitmap_scan_summary(const bitmap_t *const bitmap, const size_t start) {
+    const bool find_zero = !bitmap->summary_set;
+    size_t idx           = start >> 6;
+
+    // the word holding start is special, bits before start don't count
+    uint64_t word = bitmap_load_word(bitmap, idx);
+    word          = (find_zero ? ~word : word) & (~UINT64_C(0) << (start & 63));
+    if (!word) {
+        if ((idx = bitmap_summary_next(bitmap, 0, idx + 1)) == SIZE_MAX) {
+            return SIZE_MAX;
+        }
+        word = bitmap_load_word(bitmap, idx);
+        word = find_zero ? ~word : word;
+    }
+    const size_t result = (idx << 6) + bitmap_ctz64(word);
+    return result < bitmap->bit_count ? result : SIZE_MAX;
+}
+
+// Finds the first bit at or after start that is clear (find_zero) or set (!find_zero)
+//  A word at a time: inverting the word for zero searches turns both into "find first set",
+//  and whole words that can't contain a match are skipped with a single compare.
+// \return The bit address, SIZE_MAX if not found
+static size_t bitmap_scan(const bitmap_t *const bitmap, const size_t start, const bool find_zero) {
+    if (start >= bitmap->bit_count) {
+        return SIZE_MAX;
+    }
+    if (bitmap->summary_levels && !bitmap->summary_stale && find_zero != bitmap->summary_set) {
+        return bitmap_scan_summary(bitmap, start);
+    }
+    const size_t words = (bitmap->bit_count + 63) >> 6;
+    size_t idx         = start >> 6;
+
+    uint64_t word = bitmap_load_word(bitmap, idx);
+    if (find_zero) {
+        word = ~word;
+    }
+    word &= ~UINT64_C(0) << (start & 63);  // ignore the bits before start
+
+    while (!word) {
+        ++idx;
+#ifdef BITMAP_USE_SSE2
+        // Skip 16 bytes of all-ones (zero search) or all-zeros (set search) per compare
+        // Only whole, in-range chunks are looked at, the tail falls through to the word loop
+        const __m128i skip = find_zero ? _mm_set1_epi8((char) 0xFF) : _mm_setzero_si128();
+        while (((idx + 2) << 6) <= bitmap->bit_count) {
+            const __m128i chunk = _mm_loadu_si128((const __m128i *) (bitmap->data + (idx << 3)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, skip)) != 0xFFFF) {
+                break;
+            }
+            idx += 2;
+        }
+#endif
+        if (idx >= words) {
+            return SIZE_MAX;
+        }
+        word = bitmap_load_word(bitmap, idx);
+        if (find_zero) {
+            word = ~word;
+        }
+    }
+    // Inverted padding in the last word looks like free bits, the range check drops those
+    const size_t result = (idx << 6) + bitmap_ctz64(word);
+    return result < bitmap->bit_count ? result : SIZE_MAX;
+}
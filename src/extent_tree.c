@@ -0,0 +1,272 @@
+#include "extent_tree.h"
+#include <stdlib.h>
+
+// Two treaps over the same nodes: one ordered by start, one by (length, start)
+// Each node carries both sets of links, so an extent is allocated once and lives in both indices.
+enum { BY_START = 0, BY_LENGTH = 1 };
+
+typedef struct extent {
+    size_t start, length;
+    uint32_t priority;
+    struct extent *child[2][2];  // [index][0 = left, 1 = right]
+} extent_t;
+
+struct extent_tree {
+    extent_t *root[2];
+    size_t count, total;
+    uint32_t seed;  // for node priorities
+};
+
+// True if node orders strictly before the key (start, length) in the given index
+static bool extent_before(const int index, const extent_t *const node, const size_t start, const size_t length) {
+    if (index == BY_START) {
+        return node->start < start;
+    }
+    return node->length < length || (node->length == length && node->start < start);
+}
+
+// xorshift32, treap priorities only need to look random
+static uint32_t extent_priority(extent_tree_t *const tree) {
+    tree->seed ^= tree->seed << 13;
+    tree->seed ^= tree->seed >> 17;
+    tree->seed ^= tree->seed << 5;
+    return tree->seed;
+}
+
+// Splits root into the nodes ordered before the key (left) and the rest (right)
+static void extent_split(const int index, extent_t *root, const size_t start, const size_t length, extent_t **left,
+                         extent_t **right) {
+    if (!root) {
+        *left = *right = NULL;
+    } else if (extent_before(index, root, start, length)) {
+        extent_split(index, root->child[index][1], start, length, &root->child[index][1], right);
+        *left = root;
+    } else {
+        extent_split(index, root->child[index][0], start, length, left, &root->child[index][0]);
+        *right = root;
+    }
+}
+
+// Joins two treaps, everything in left orders before everything in right
+static extent_t *extent_merge(const int index, extent_t *left, extent_t *right) {
+    if (!left || !right) {
+        return left ? left : right;
+    }
+    if (left->priority > right->priority) {
+        left->child[index][1] = extent_merge(index, left->child[index][1], right);
+        return left;
+    }
+    right->child[index][0] = extent_merge(index, left, right->child[index][0]);
+    return right;
+}
+
+static extent_t *extent_link(const int index, extent_t *root, extent_t *node) {
+    if (!root) {
+        return node;
+    }
+    if (node->priority > root->priority) {
+        extent_split(index, root, node->start, node->length, &node->child[index][0], &node->child[index][1]);
+        return node;
+    }
+    const int side              = extent_before(index, root, node->start, node->length) ? 1 : 0;
+    root->child[index][side] = extent_link(index, root->child[index][side], node);
+    return root;
+}
+
+static extent_t *extent_unlink(const int index, extent_t *root, const extent_t *const node) {
+    if (!root) {
+        return NULL;
+    }
+    if (root == node) {
+        return extent_merge(index, root->child[index][0], root->child[index][1]);
+    }
+    const int side              = extent_before(index, root, node->start, node->length) ? 1 : 0;
+    root->child[index][side] = extent_unlink(index, root->child[index][side], node);
+    return root;
+}
+
+// (Re)inserts a detached node into both indices
+static void extent_attach(extent_tree_t *const tree, extent_t *const node) {
+    node->child[BY_START][0] = node->child[BY_START][1] = NULL;
+    node->child[BY_LENGTH][0] = node->child[BY_LENGTH][1] = NULL;
+    tree->root[BY_START]  = extent_link(BY_START, tree->root[BY_START], node);
+    tree->root[BY_LENGTH] = extent_link(BY_LENGTH, tree->root[BY_LENGTH], node);
+    tree->count++;
+    tree->total += node->length;
+}
+
+// Removes a node from both indices without freeing it
+static void extent_detach(extent_tree_t *const tree, extent_t *const node) {
+    tree->root[BY_START]  = extent_unlink(BY_START, tree->root[BY_START], node);
+    tree->root[BY_LENGTH] = extent_unlink(BY_LENGTH, tree->root[BY_LENGTH], node);
+    tree->count--;
+    tree->total -= node->length;
+}
+
+static bool extent_add(extent_tree_t *const tree, const size_t start, const size_t length) {
+    extent_t *node = (extent_t *) malloc(sizeof(extent_t));
+    if (node) {
+        node->start    = start;
+        node->length   = length;
+        node->priority = extent_priority(tree);
+        extent_attach(tree, node);
+        return true;
+    }
+    return false;
+}
+
+// The extent with the largest start <= unit, NULL if none
+static extent_t *extent_floor(const extent_tree_t *const tree, const size_t unit) {
+    extent_t *node = tree->root[BY_START], *best = NULL;
+    while (node) {
+        if (node->start <= unit) {
+            best = node;
+            node = node->child[BY_START][1];
+        } else {
+            node = node->child[BY_START][0];
+        }
+    }
+    return best;
+}
+
+// The extent with the smallest start >= unit, NULL if none
+static extent_t *extent_ceiling(const extent_tree_t *const tree, const size_t unit) {
+    extent_t *node = tree->root[BY_START], *best = NULL;
+    while (node) {
+        if (node->start >= unit) {
+            best = node;
+            node = node->child[BY_START][0];
+        } else {
+            node = node->child[BY_START][1];
+        }
+    }
+    return best;
+}
+
+static void extent_free_all(extent_t *node) {
+    if (node) {
+        extent_free_all(node->child[BY_START][0]);
+        extent_free_all(node->child[BY_START][1]);
+        free(node);
+    }
+}
+
+extent_tree_t *extent_tree_create(void) {
+    extent_tree_t *tree = (extent_tree_t *) calloc(1, sizeof(extent_tree_t));
+    if (tree) {
+        tree->seed = 0x9E3779B9u;
+    }
+    return tree;
+}
+
+void extent_tree_destroy(extent_tree_t *tree) {
+    if (tree) {
+        extent_free_all(tree->root[BY_START]);
+        free(tree);
+    }
+}
+
+bool extent_tree_insert(extent_tree_t *tree, const size_t start, const size_t length) {
+    if (!tree || !length || start + length < start) {
+        return false;
+    }
+    extent_t *before = extent_floor(tree, start);
+    extent_t *after  = extent_ceiling(tree, start);
+    if ((before && before->start + before->length > start) || (after && after->start < start + length)) {
+        return false;  // overlap
+    }
+    const bool join_before = before && before->start + before->length == start;
+    const bool join_after  = after && after->start == start + length;
+    if (join_before) {
+        // grow the extent in front, pulling in the one behind if it now touches
+        extent_detach(tree, before);
+        before->length += length;
+        if (join_after) {
+            extent_detach(tree, after);
+            before->length += after->length;
+            free(after);
+        }
+        extent_attach(tree, before);
+        return true;
+    }
+    if (join_after) {
+        extent_detach(tree, after);
+        after->start = start;
+        after->length += length;
+        extent_attach(tree, after);
+        return true;
+    }
+    return extent_add(tree, start, length);
+}
+
+bool extent_tree_remove(extent_tree_t *tree, const size_t start, const size_t length) {
+    if (!tree || !length) {
+        return false;
+    }
+    extent_t *holder = extent_floor(tree, start);
+    if (!holder || start + length > holder->start + holder->length || start + length < start) {
+        return false;
+    }
+    const size_t tail_start  = start + length;
+    const size_t tail_length = holder->start + holder->length - tail_start;
+    extent_detach(tree, holder);
+    if (holder->start < start) {
+        // keep the node for the piece in front
+        holder->length = start - holder->start;
+        extent_attach(tree, holder);
+    } else if (tail_length) {
+        holder->start  = tail_start;
+        holder->length = tail_length;
+        extent_attach(tree, holder);
+        return true;
+    } else {
+        free(holder);
+        return true;
+    }
+    return tail_length ? extent_add(tree, tail_start, tail_length) : true;
+}
+
+bool extent_tree_best_fit(const extent_tree_t *tree, const size_t length, size_t *start, size_t *found_length) {
+    if (!tree || !start || !found_length || !tree->root[BY_LENGTH]) {
+        return false;
+    }
+    extent_t *node = tree->root[BY_LENGTH], *best = NULL;
+    while (node) {
+        if (node->length >= length) {
+            best = node;
+            node = node->child[BY_LENGTH][0];
+        } else {
+            node = node->child[BY_LENGTH][1];
+        }
+    }
+    if (!best) {
+        // nothing long enough, hand out the largest
+        best = tree->root[BY_LENGTH];
+        while (best->child[BY_LENGTH][1]) {
+            best = best->child[BY_LENGTH][1];
+        }
+    }
+    *start        = best->start;
+    *found_length = best->length;
+    return true;
+}
+
+bool extent_tree_find(const extent_tree_t *tree, const size_t unit, size_t *start, size_t *length) {
+    if (tree && start && length) {
+        extent_t *holder = extent_floor(tree, unit);
+        if (holder && unit < holder->start + holder->length) {
+            *start  = holder->start;
+            *length = holder->length;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t extent_tree_count(const extent_tree_t *tree) {
+    return tree ? tree->count : 0;
+}
+
+size_t extent_tree_total(const extent_tree_t *tree) {
+    return tree ? tree->total : 0;
+}
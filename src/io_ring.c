@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include "io_ring.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IO_RING_AVAILABLE
+#endif
+#endif
+
+void io_ring_iov_copy(const struct iovec *iov, const int iovcnt, size_t skip, uint8_t *flat, size_t bytes, const bool to_iov) {
+    for (int i = 0; i < iovcnt && bytes; ++i) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        size_t n = iov[i].iov_len - skip;
+        n = n < bytes ? n : bytes;
+        if (to_iov) {
+            memcpy((uint8_t *) iov[i].iov_base + skip, flat, n);
+        } else {
+            memcpy(flat, (uint8_t *) iov[i].iov_base + skip, n);
+        }
+        flat += n;
+        bytes -= n;
+        skip = 0;
+    }
+}
+
+#ifdef IO_RING_AVAILABLE
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define IO_RING_MAX_DEPTH 256
+
+// What a slot buffer is doing: piece seq, length bytes at offset into runs[run]
+typedef struct {
+    size_t seq;
+    size_t run, offset, length;
+} slot_t;
+
+struct io_ring {
+    int ring_fd;
+    unsigned depth;
+    bool broken;  // a submit failed with pieces possibly still in flight, refuse further transfers
+    // submission queue
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    // completion queue
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_bytes, cq_ring_bytes, sqes_bytes;
+    uint8_t *buffers;  // depth registered slots of IO_RING_SLOT_BYTES
+    slot_t *slots;
+    unsigned *free_slots, free_count;
+};
+
+// Kernel ring indices are shared with the kernel: acquire what it publishes, release what we publish
+static unsigned load_acquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned *p, const unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static size_t run_length(const io_ring_run_t *run) {
+    size_t total = 0;
+    for (int i = 0; i < run->iovcnt; ++i) {
+        total += run->iov[i].iov_len;
+    }
+    return total;
+}
+
+static void io_ring_unmap(io_ring_t *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_bytes);
+    }
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_bytes);
+    }
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_bytes);
+    }
+}
+
+static bool io_ring_map(io_ring_t *ring, const struct io_uring_params *params) {
+    ring->sq_ring_bytes = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    ring->cq_ring_bytes = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_bytes > ring->sq_ring_bytes) {
+            ring->sq_ring_bytes = ring->cq_ring_bytes;
+        }
+        ring->cq_ring_bytes = ring->sq_ring_bytes;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                         IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        return false;
+    }
+    ring->cq_ring = (params->features & IORING_FEAT_SINGLE_MMAP)
+                        ? ring->sq_ring
+                        : mmap(NULL, ring->cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               ring->ring_fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+        return false;
+    }
+    ring->sqes_bytes = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                              ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        return false;
+    }
+    uint8_t *sq = (uint8_t *) ring->sq_ring, *cq = (uint8_t *) ring->cq_ring;
+    ring->sq_tail  = (unsigned *) (sq + params->sq_off.tail);
+    ring->sq_mask  = (unsigned *) (sq + params->sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params->sq_off.array);
+    ring->cq_head  = (unsigned *) (cq + params->cq_off.head);
+    ring->cq_tail  = (unsigned *) (cq + params->cq_off.tail);
+    ring->cq_mask  = (unsigned *) (cq + params->cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+    return true;
+}
+
+io_ring_t *io_ring_create(const int fd, const unsigned depth) {
+    if (fd < 0 || depth == 0 || depth > IO_RING_MAX_DEPTH) {
+        return NULL;
+    }
+    io_ring_t *ring = (io_ring_t *) calloc(1, sizeof(io_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->depth   = depth;
+    ring->ring_fd = (int) syscall(__NR_io_uring_setup, depth, &params);
+    ring->slots      = (slot_t *) calloc(depth, sizeof(slot_t));
+    ring->free_slots = (unsigned *) calloc(depth, sizeof(unsigned));
+    if (ring->ring_fd >= 0 && ring->slots && ring->free_slots && io_ring_map(ring, &params)
+        && posix_memalign((void **) &ring->buffers, 4096, (size_t) depth * IO_RING_SLOT_BYTES) == 0) {
+        struct iovec *registered = (struct iovec *) calloc(depth, sizeof(struct iovec));
+        for (unsigned i = 0; registered && i < depth; ++i) {
+            registered[i].iov_base = ring->buffers + (size_t) i * IO_RING_SLOT_BYTES;
+            registered[i].iov_len  = IO_RING_SLOT_BYTES;
+            ring->free_slots[ring->free_count++] = i;
+        }
+        const bool ok = registered
+                        && syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_FILES, &fd, 1) == 0
+                        && syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_BUFFERS, registered, depth) == 0;
+        free(registered);
+        if (ok) {
+            return ring;
+        }
+    }
+    io_ring_destroy(ring);
+    return NULL;
+}
+
+void io_ring_destroy(io_ring_t *ring) {
+    if (ring) {
+        io_ring_unmap(ring);
+        if (ring->ring_fd >= 0) {
+            close(ring->ring_fd);  // also drops the registered file and buffers
+        }
+        free(ring->buffers);
+        free(ring->slots);
+        free(ring->free_slots);
+        free(ring);
+    }
+}
+
+size_t io_ring_transfer(io_ring_t *ring, const io_ring_run_t *runs, const size_t count, const bool write) {
+    if (!ring || ring->broken || (!runs && count)) {
+        return 0;
+    }
+    size_t run = 0, offset = 0, seq = 0, failed = SIZE_MAX;
+    unsigned queued = 0, in_flight = 0;
+    unsigned tail = *ring->sq_tail;
+    for (;;) {
+        // fill every free slot with the next piece
+        while (failed == SIZE_MAX && ring->free_count && run < count) {
+            const size_t length_left = run_length(&runs[run]) - offset;
+            if (length_left == 0) {
+                run++;
+                offset = 0;
+                continue;
+            }
+            const unsigned index = ring->free_slots[--ring->free_count];
+            slot_t *slot = &ring->slots[index];
+            uint8_t *buffer = ring->buffers + (size_t) index * IO_RING_SLOT_BYTES;
+            slot->seq    = seq++;
+            slot->run    = run;
+            slot->offset = offset;
+            slot->length = length_left < IO_RING_SLOT_BYTES ? length_left : IO_RING_SLOT_BYTES;
+            if (write) {
+                io_ring_iov_copy(runs[run].iov, runs[run].iovcnt, offset, buffer, slot->length, false);
+            }
+            struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode    = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->flags     = IOSQE_FIXED_FILE;
+            sqe->fd        = 0;  // index into the registered files
+            sqe->off       = runs[run].pos + offset;
+            sqe->addr      = (uint64_t) (uintptr_t) buffer;
+            sqe->len       = (uint32_t) slot->length;
+            sqe->buf_index = (uint16_t) index;
+            sqe->user_data = index;
+            ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+            tail++;
+            queued++;
+            offset += slot->length;
+        }
+        if (queued == 0 && in_flight == 0) {
+            break;
+        }
+        store_release(ring->sq_tail, tail);
+        const int submitted = (int) syscall(__NR_io_uring_enter, ring->ring_fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            ring->broken = true;
+            return 0;
+        }
+        queued -= (unsigned) submitted;
+        in_flight += (unsigned) submitted;
+        // reap whatever has completed
+        unsigned head = *ring->cq_head;
+        for (; head != load_acquire(ring->cq_tail); ++head) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            const unsigned index = (unsigned) cqe->user_data;
+            const slot_t *slot = &ring->slots[index];
+            if (cqe->res < 0 || (size_t) cqe->res != slot->length) {
+                failed = slot->seq < failed ? slot->seq : failed;
+            } else if (!write) {
+                io_ring_iov_copy(runs[slot->run].iov, runs[slot->run].iovcnt, slot->offset,
+                                 ring->buffers + (size_t) index * IO_RING_SLOT_BYTES, slot->length, true);
+            }
+            ring->free_slots[ring->free_count++] = index;
+            in_flight--;
+        }
+        store_release(ring->cq_head, head);
+    }
+    // bytes in the pieces before the first failure
+    size_t total = 0;
+    seq = 0;
+    for (run = 0; run < count && seq < failed; ++run) {
+        const size_t length = run_length(&runs[run]);
+        for (offset = 0; offset < length && seq < failed; offset += IO_RING_SLOT_BYTES, ++seq) {
+            total += length - offset < IO_RING_SLOT_BYTES ? length - offset : IO_RING_SLOT_BYTES;
+        }
+    }
+    return total;
+}
+
+unsigned io_ring_depth(const io_ring_t *ring) {
+    return ring ? ring->depth : 0;
+}
+
+#else  // no io_uring here, io_ring_create always fails and callers fall back
+
+io_ring_t *io_ring_create(const int fd, const unsigned depth) {
+    (void) fd;
+    (void) depth;
+    return NULL;
+}
+
+void io_ring_destroy(io_ring_t *ring) {
+    (void) ring;
+}
+
+size_t io_ring_transfer(io_ring_t *ring, const io_ring_run_t *runs, const size_t count, const bool write) {
+    (void) ring;
+    (void) runs;
+    (void) count;
+    (void) write;
+    return 0;
+}
+
+unsigned io_ring_depth(const io_ring_t *ring) {
+    (void) ring;
+    return 0;
+}
+
+#endif
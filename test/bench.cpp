@@ -0,0 +1,1030 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+extern "C" {
+#include "F17FS.h"
+#include "bitmap.h"
+#include "block_store.h"
+}
+
+// Microbenchmarks, not tests. Numbers are printed, nothing is asserted.
+// Run from the build directory: ./fs_bench
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ns(bench_clock::time_point start, bench_clock::time_point stop) {
+    return std::chrono::duration<double, std::nano>(stop - start).count();
+}
+
+// What bitmap_ffz used to be, one bitmap_test per bit
+static size_t reference_ffz(const bitmap_t *const bitmap) {
+    size_t result = 0;
+    for (; result < bitmap_get_bits(bitmap) && bitmap_test(bitmap, result); ++result) {
+    }
+    return (result == bitmap_get_bits(bitmap) ? SIZE_MAX : result);
+}
+
+// Same size as the block_store free block map
+static const size_t FBM_BITS = 65536;
+
+// Fills the map the way a long-lived image looks: a dense used prefix
+//  with the remaining free bits scattered through the tail
+static void fill_bitmap(bitmap_t *bitmap, double fill, std::mt19937 &rng) {
+    bitmap_format(bitmap, 0x00);
+    const size_t used = (size_t)(FBM_BITS * fill);
+    for (size_t bit = 0; bit < used; ++bit) {
+        bitmap_set(bitmap, bit);
+    }
+    // sprinkle a few holes near the end so the scan has somewhere to stop
+    std::uniform_int_distribution<size_t> tail(used, FBM_BITS - 1);
+    for (size_t i = 0; i < 8 && used < FBM_BITS; ++i) {
+        bitmap_set(bitmap, tail(rng));
+    }
+}
+
+static void bench_bitmap_search() {
+    std::printf("== bitmap_ffz on a %zu bit map (ns per call) ==\n", FBM_BITS);
+    std::printf("%8s %14s %14s %8s\n", "fill", "bit-by-bit", "word-parallel", "speedup");
+    bitmap_t *bitmap = bitmap_create(FBM_BITS);
+    std::mt19937 rng(42);
+    const double fills[] = {0.0, 0.5, 0.9, 0.99, 0.999};
+    for (double fill : fills) {
+        fill_bitmap(bitmap, fill, rng);
+        const int iterations = 2000;
+        volatile size_t sink = 0;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            sink = sink + reference_ffz(bitmap);
+        }
+        const double ref_ns = elapsed_ns(start, bench_clock::now()) / iterations;
+
+        start = bench_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            sink = sink + bitmap_ffz(bitmap);
+        }
+        const double fast_ns = elapsed_ns(start, bench_clock::now()) / iterations;
+
+        if (reference_ffz(bitmap) != bitmap_ffz(bitmap)) {
+            std::printf("MISMATCH at fill %.3f\n", fill);
+        }
+        std::printf("%7.1f%% %14.1f %14.1f %7.1fx\n", fill * 100, ref_ns, fast_ns, ref_ns / fast_ns);
+    }
+
+    std::printf("== bitmap_total_set / bitmap_for_each at 50%% random fill (ns per call) ==\n");
+    bitmap_format(bitmap, 0x00);
+    for (size_t bit = 0; bit < FBM_BITS; ++bit) {
+        if (rng() & 1) {
+            bitmap_set(bitmap, bit);
+        }
+    }
+    const int iterations = 2000;
+    volatile size_t sink = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        sink = sink + bitmap_total_set(bitmap);
+    }
+    std::printf("%-24s %10.1f\n", "bitmap_total_set", elapsed_ns(start, bench_clock::now()) / iterations);
+    size_t visited = 0;
+    start = bench_clock::now();
+    for (int i = 0; i < iterations / 10; ++i) {
+        bitmap_for_each(bitmap, [](size_t, void *arg) { ++*(size_t *) arg; }, &visited);
+    }
+    std::printf("%-24s %10.1f\n", "bitmap_for_each", elapsed_ns(start, bench_clock::now()) / (iterations / 10));
+    bitmap_destroy(bitmap);
+}
+
+// Next-fit style searches (ffz_from a moving start) on a nearly full, fragmented map,
+//  with and without the summary level
+static void bench_bitmap_summary() {
+    std::printf("== bitmap_ffz_from with random starts, scattered free bits (ns per call) ==\n");
+    std::printf("%10s %8s %14s %14s %8s\n", "bits", "fill", "flat", "summary", "speedup");
+    std::mt19937 rng(7);
+    const size_t sizes[] = {FBM_BITS, FBM_BITS * 16, FBM_BITS * 256};
+    const double fills[] = {0.9, 0.99, 0.999, 0.99999};
+    for (size_t bits : sizes) {
+        for (double fill : fills) {
+            bitmap_t *flat = bitmap_create(bits);
+            bitmap_format(flat, 0xFF);
+            std::uniform_int_distribution<size_t> pick(0, bits - 1);
+            for (size_t i = 0; i < (size_t)(bits * (1.0 - fill)); ++i) {
+                bitmap_reset(flat, pick(rng));
+            }
+            bitmap_t *summary = bitmap_import(bits, bitmap_export(flat));
+            bitmap_enable_summary(summary);
+            std::vector<size_t> starts(4096);
+            for (size_t &start : starts) {
+                start = pick(rng);
+            }
+            volatile size_t sink = 0;
+            bench_clock::time_point begin = bench_clock::now();
+            for (size_t start : starts) {
+                sink = sink + bitmap_ffz_from(flat, start);
+            }
+            const double flat_ns = elapsed_ns(begin, bench_clock::now()) / starts.size();
+            begin = bench_clock::now();
+            for (size_t start : starts) {
+                sink = sink + bitmap_ffz_from(summary, start);
+            }
+            const double summary_ns = elapsed_ns(begin, bench_clock::now()) / starts.size();
+            for (size_t start : starts) {
+                if (bitmap_ffz_from(flat, start) != bitmap_ffz_from(summary, start)) {
+                    std::printf("MISMATCH at start %zu\n", start);
+                    break;
+                }
+            }
+            std::printf("%10zu %7.3f%% %14.1f %14.1f %7.1fx\n", bits, fill * 100, flat_ns, summary_ns,
+                        flat_ns / summary_ns);
+            bitmap_destroy(flat);
+            bitmap_destroy(summary);
+        }
+    }
+}
+
+// Run allocation under churn: fill to ~90% with random-length runs, then keep freeing a random
+//  run and allocating a new one. Compares first-fit bitmap runs with best-fit extent tree runs.
+static void bench_run_allocator(const char *label, bool extents) {
+    block_store_t *bs = block_store_create("bench_extents.bs");
+    if (!bs || (extents && !block_store_enable_extents(bs))) {
+        std::printf("%s: setup failed\n", label);
+        block_store_destroy(bs);
+        return;
+    }
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<size_t> length(1, 128);
+    // every live request, as the runs it was satisfied with
+    std::vector<std::vector<std::pair<size_t, size_t>>> live;
+    size_t calls = 0, requests = 0;
+    double alloc_ns = 0;
+    auto allocate = [&](size_t want) {
+        ++requests;
+        live.emplace_back();
+        while (want) {
+            size_t start, got;
+            bench_clock::time_point begin = bench_clock::now();
+            bool ok = block_store_allocate_run(bs, want, &start, &got);
+            alloc_ns += elapsed_ns(begin, bench_clock::now());
+            ++calls;
+            if (!ok) {
+                return false;
+            }
+            live.back().push_back({start, got});
+            want -= got;
+        }
+        return true;
+    };
+    while (block_store_get_free_blocks(bs) > 65536 / 10 && allocate(length(rng))) {
+    }
+    for (int i = 0; i < 20000; ++i) {
+        size_t pick = rng() % live.size();
+        for (const std::pair<size_t, size_t> &run : live[pick]) {
+            for (size_t id = run.first; id < run.first + run.second; ++id) {
+                block_store_release(bs, id);
+            }
+        }
+        live[pick].swap(live.back());
+        live.pop_back();
+        if (!allocate(length(rng))) {
+            break;
+        }
+    }
+    std::printf("%-18s %12.1f %14.2f %14zu\n", label, alloc_ns / calls, (double) calls / requests,
+                block_store_get_free_extents(bs));
+    block_store_destroy(bs);
+}
+
+static void bench_run_allocators() {
+    std::printf("== block_store_allocate_run under churn at ~90%% full ==\n");
+    std::printf("%-18s %12s %14s %14s\n", "allocator", "ns/call", "calls/request", "free extents");
+    bench_run_allocator("first-fit bitmap", false);
+    bench_run_allocator("best-fit extents", true);
+}
+
+// Images of 2^16 to 2^24 blocks (32 MB to 8 GB, sparse), filled up except for scattered free blocks:
+//  how long opening takes (the FBM counted and summarized) and allocating near a random hint,
+//  which has to stay flat as the free block map grows from 8 KB to 2 MB
+static void bench_large_images() {
+    std::printf("== block store size scaling, 99.9%% full (open in ms, allocate_near in ns per call) ==\n");
+    std::printf("%10s %10s %14s\n", "blocks", "open", "allocate_near");
+    const size_t sizes[] = {65536, 65536 * 16, 65536 * 256};
+    for (size_t blocks : sizes) {
+        block_store_options_t options = {};
+        options.blocks = blocks;
+        block_store_t *bs = block_store_create_with("bench_large.bs", &options);
+        if (!bs) {
+            std::printf("%10zu setup failed\n", blocks);
+            continue;
+        }
+        size_t start, got;
+        while (block_store_allocate_run(bs, blocks, &start, &got)) {
+        }
+        std::mt19937 rng(5);
+        std::uniform_int_distribution<size_t> pick(0, block_store_get_block_count(bs) - blocks / 4096 - 1);
+        for (size_t i = 0; i < blocks / 1000; ++i) {
+            block_store_release(bs, pick(rng));
+        }
+        block_store_destroy(bs);
+        bench_clock::time_point begin = bench_clock::now();
+        bs = block_store_open("bench_large.bs");
+        const double open_ms = elapsed_ns(begin, bench_clock::now()) / 1e6;
+        std::vector<size_t> hints(20000), ids(hints.size());
+        for (size_t &hint : hints) {
+            hint = pick(rng);
+        }
+        begin = bench_clock::now();
+        for (size_t i = 0; i < hints.size(); ++i) {
+            ids[i] = block_store_allocate_near(bs, hints[i]);
+            block_store_release(bs, ids[i]);  // keeps the fill, the next call looks for the same holes
+        }
+        const double alloc_ns = elapsed_ns(begin, bench_clock::now()) / hints.size();
+        std::printf("%10zu %10.2f %14.1f\n", blocks, open_ms, alloc_ns);
+        block_store_destroy(bs);
+    }
+    unlink("bench_large.bs");
+}
+
+// fs_mount of a cleanly unmounted image, which takes its counts from the superblock, against one without
+//  a superblock (as images from before it), which recounts; then the first write, which builds the
+//  allocation summary either way
+static void bench_mount_clean() {
+    std::printf("== fs_mount with and without the superblock's counts (ms) ==\n");
+    std::printf("%10s %12s %12s %12s %12s\n", "blocks", "clean mount", "first write", "recount", "first write");
+    const size_t sizes[] = {65536, 65536 * 16, 65536 * 256};
+    const char *image = "bench_mount.F17FS";
+    std::vector<uint8_t> byte(1, 0x6D), zeros(256, 0);
+    for (size_t blocks : sizes) {
+        fs_options_t options = {};
+        options.blocks = blocks;
+        F17FS_t *fs = fs_format_with(image, &options);
+        if (!fs) {
+            std::printf("%10zu setup failed\n", blocks);
+            continue;
+        }
+        fs_unmount(fs);
+        double ms[4] = {0, 0, 0, 0};
+        for (int recount = 0; recount < 2; ++recount) {
+            if (recount) {
+                block_store_options_t bs_options = {};
+                block_store_t *bs = block_store_open_with(image, &bs_options);
+                block_store_n_write(bs, 0, 256, zeros.data(), zeros.size());  // the superblock
+                block_store_destroy(bs);
+            }
+            bench_clock::time_point begin = bench_clock::now();
+            fs = fs_mount(image);
+            ms[recount * 2] = elapsed_ns(begin, bench_clock::now()) / 1e6;
+            begin = bench_clock::now();
+            const char *name = recount ? "/b" : "/a";
+            fs_create(fs, name, FS_REGULAR);
+            int fd = fs_open(fs, name);
+            fs_write(fs, fd, byte.data(), byte.size());
+            ms[recount * 2 + 1] = elapsed_ns(begin, bench_clock::now()) / 1e6;
+            fs_close(fs, fd);
+            fs_unmount(fs);
+        }
+        std::printf("%10zu %12.2f %12.2f %12.2f %12.2f\n", blocks, ms[0], ms[1], ms[2], ms[3]);
+    }
+    unlink(image);
+}
+
+// fs_create past the 256 inodes of the table: a tree of 7-entry directories, a level at a time, files
+//  at the bottom. Costs per create should only grow with the path depth, not with the inodes in use
+static void bench_inodes() {
+    std::printf("== fs_create beyond the inode table (7-ary tree, files on level 5) ==\n");
+    std::printf("%6s %10s %10s %12s\n", "level", "creates", "inodes", "us/create");
+    const char *image = "bench_inodes.F17FS";
+    F17FS_t *fs = fs_format(image);
+    if (!fs) {
+        std::printf("setup failed\n");
+        return;
+    }
+    std::vector<std::string> parents{""}, next;
+    for (int level = 1; level <= 5; ++level) {
+        next.clear();
+        bench_clock::time_point start = bench_clock::now();
+        for (const std::string &parent : parents) {
+            for (int i = 0; i < 7; ++i) {
+                std::string path = parent + "/" + std::to_string(i);
+                if (fs_create(fs, path.c_str(), level < 5 ? FS_DIRECTORY : FS_REGULAR) == 0) {
+                    next.push_back(path);
+                }
+            }
+        }
+        double ns = elapsed_ns(start, bench_clock::now());
+        fs_info_t info;
+        fs_get_info(fs, &info);
+        std::printf("%6d %10zu %10zu %12.2f\n", level, next.size(), info.inodes - info.free_inodes,
+                    next.empty() ? 0.0 : ns / next.size() / 1e3);
+        parents.swap(next);
+    }
+    fs_unmount(fs);
+    unlink(image);
+}
+
+// One directory grown to a million names on a 4 KB-block image: the cost of a create and of a lookup
+//  (fs_open and fs_close of a random name already there) as the directory grows
+static void bench_directories() {
+    std::printf("== one directory of 1M names (4 KB blocks) ==\n");
+    std::printf("%10s %12s %12s\n", "names", "us/create", "us/lookup");
+    const char *image = "bench_directories.F17FS";
+    fs_options_t options = {};
+    options.block_size = 4096;
+    options.blocks = 131072;
+    F17FS_t *fs = fs_format_with(image, &options);
+    if (!fs || fs_create(fs, "/d", FS_DIRECTORY) != 0) {
+        std::printf("setup failed\n");
+        if (fs) {
+            fs_unmount(fs);
+        }
+        unlink(image);
+        return;
+    }
+    std::mt19937 rng(11);
+    char path[32];
+    size_t names = 0;
+    for (size_t target = 1000; target <= 1000000; target *= 10) {
+        bench_clock::time_point start = bench_clock::now();
+        size_t created = 0, first = names;
+        for (; names < target; ++names) {
+            std::snprintf(path, sizeof(path), "/d/name%zu", names);
+            created += fs_create(fs, path, FS_REGULAR) == 0;
+        }
+        double create_ns = elapsed_ns(start, bench_clock::now());
+        const size_t lookups = 10000;
+        std::uniform_int_distribution<size_t> pick(0, names - 1);
+        size_t found = 0;
+        start = bench_clock::now();
+        for (size_t i = 0; i < lookups; ++i) {
+            std::snprintf(path, sizeof(path), "/d/name%zu", pick(rng));
+            int fd = fs_open(fs, path);
+            if (fd >= 0) {
+                fs_close(fs, fd);
+                ++found;
+            }
+        }
+        double lookup_ns = elapsed_ns(start, bench_clock::now());
+        if (created != target - first || found != lookups) {
+            std::printf("%10zu failed (%zu created, %zu found)\n", names, created, found);
+            break;
+        }
+        std::printf("%10zu %12.2f %12.2f\n", names, create_ns / created / 1e3, lookup_ns / lookups / 1e3);
+    }
+    fs_unmount(fs);
+    unlink(image);
+}
+
+// fs_open and fs_close of the same file over and over, at the end of paths of depth 1 to 32, and fs_open
+//  of a name that isn't there (the parent is resolved all the same)
+static void bench_deep_opens() {
+    std::printf("== repeated opens of one path ==\n");
+    std::printf("%6s %12s %12s\n", "depth", "us/open", "us/miss");
+    const char *image = "bench_opens.F17FS";
+    F17FS_t *fs = fs_format(image);
+    if (!fs) {
+        std::printf("setup failed\n");
+        return;
+    }
+    std::string dir;
+    for (int depth = 1; depth <= 32; depth *= 2) {
+        while (std::count(dir.begin(), dir.end(), '/') < depth - 1) {
+            dir += "/directory" + std::to_string(std::count(dir.begin(), dir.end(), '/'));
+            fs_create(fs, dir.c_str(), FS_DIRECTORY);
+        }
+        std::string path = dir + "/file", missing = dir + "/missing";
+        fs_create(fs, path.c_str(), FS_REGULAR);
+        const size_t opens = 100000;
+        size_t done = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < opens; ++i) {
+            int fd = fs_open(fs, path.c_str());
+            if (fd >= 0) {
+                fs_close(fs, fd);
+                ++done;
+            }
+        }
+        double ns = elapsed_ns(start, bench_clock::now());
+        start = bench_clock::now();
+        for (size_t i = 0; i < opens; ++i) {
+            done += fs_open(fs, missing.c_str()) == -6;
+        }
+        double miss_ns = elapsed_ns(start, bench_clock::now());
+        if (done != 2 * opens) {
+            std::printf("%6d failed\n", depth);
+            break;
+        }
+        std::printf("%6d %12.3f %12.3f\n", depth, ns / opens / 1e3, miss_ns / opens / 1e3);
+    }
+    fs_unmount(fs);
+    unlink(image);
+}
+
+// Creating and opening files in a directory 8 levels down, by absolute path and relative to a
+//  directory handle
+static void bench_openat() {
+    std::printf("== files in one directory, 8 levels down: absolute paths vs a directory handle ==\n");
+    std::printf("%10s %12s %12s\n", "paths", "us/create", "us/open");
+    const char *image = "bench_openat.F17FS";
+    F17FS_t *fs = fs_format(image);
+    if (!fs) {
+        std::printf("setup failed\n");
+        return;
+    }
+    std::string dir;
+    for (int depth = 0; depth < 8; ++depth) {
+        dir += "/directory" + std::to_string(depth);
+        fs_create(fs, dir.c_str(), FS_DIRECTORY);
+    }
+    int dh = fs_opendir_handle(fs, dir.c_str());
+    const size_t files = 5000;
+    for (int relative = 0; relative < 2; ++relative) {
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < files; ++i) {
+            std::string name = (relative ? "r" : "a") + std::to_string(i);
+            paths.push_back(relative ? name : dir + "/" + name);
+        }
+        size_t done = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (const std::string &path : paths) {
+            done += (relative ? fs_createat(fs, dh, path.c_str(), FS_REGULAR) : fs_create(fs, path.c_str(), FS_REGULAR)) == 0;
+        }
+        double create_ns = elapsed_ns(start, bench_clock::now());
+        start = bench_clock::now();
+        for (const std::string &path : paths) {
+            int fd = relative ? fs_openat(fs, dh, path.c_str()) : fs_open(fs, path.c_str());
+            if (fd >= 0) {
+                fs_close(fs, fd);
+                ++done;
+            }
+        }
+        double open_ns = elapsed_ns(start, bench_clock::now());
+        if (done != 2 * files) {
+            std::printf("%10s failed\n", relative ? "handle" : "absolute");
+            break;
+        }
+        std::printf("%10s %12.3f %12.3f\n", relative ? "handle" : "absolute", create_ns / files / 1e3, open_ns / files / 1e3);
+    }
+    fs_closedir_handle(fs, dh);
+    fs_unmount(fs);
+    unlink(image);
+}
+
+// Listing a directory of 20000 entries: fs_get_dir into a dyn_array, and fs_readdir a page at a time
+static void bench_readdir() {
+    std::printf("== listing a directory of 20000 entries ==\n");
+    std::printf("%12s %12s\n", "call", "ns/entry");
+    const char *image = "bench_readdir.F17FS";
+    F17FS_t *fs = fs_format(image);
+    if (!fs || fs_create(fs, "/d", FS_DIRECTORY) != 0) {
+        std::printf("setup failed\n");
+        if (fs) {
+            fs_unmount(fs);
+        }
+        unlink(image);
+        return;
+    }
+    const size_t entries = 20000, rounds = 10;
+    char path[32];
+    for (size_t i = 0; i < entries; ++i) {
+        std::snprintf(path, sizeof(path), "/d/entry%zu", i);
+        fs_create(fs, path, i % 2 ? FS_REGULAR : FS_DIRECTORY);
+    }
+    size_t listed = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        dyn_array_t *records = fs_get_dir(fs, "/d");
+        if (records) {
+            listed += dyn_array_size(records);
+            dyn_array_destroy(records);
+        }
+    }
+    double get_dir_ns = elapsed_ns(start, bench_clock::now());
+    file_record_t page[64];
+    start = bench_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        fs_dir_t dir;
+        if (fs_opendir(fs, "/d", &dir) == 0) {
+            ssize_t filled;
+            while ((filled = fs_readdir(fs, &dir, page, 64)) > 0) {
+                listed += filled;
+            }
+            fs_closedir(fs, &dir);
+        }
+    }
+    double readdir_ns = elapsed_ns(start, bench_clock::now());
+    if (listed != 2 * rounds * entries) {
+        std::printf("failed (%zu listed)\n", listed);
+    } else {
+        std::printf("%12s %12.1f\n", "fs_get_dir", get_dir_ns / rounds / entries);
+        std::printf("%12s %12.1f\n", "fs_readdir", readdir_ns / rounds / entries);
+    }
+    fs_unmount(fs);
+    unlink(image);
+}
+
+// fs_open and fs_close of each of 7 files whose names share a long prefix, in a directory of its own
+//  (one directory block), and fs_open of names that aren't there; the dentry cache is kept from
+//  answering by giving each round's directory a new inode
+static void bench_small_dir_lookups() {
+    std::printf("== lookups in a directory of 7 names sharing a prefix ==\n");
+    std::printf("%12s %12s\n", "us/open", "us/miss");
+    const char *image = "bench_small_dirs.F17FS";
+    F17FS_t *fs = fs_format(image);
+    if (!fs) {
+        std::printf("setup failed\n");
+        return;
+    }
+    const size_t rounds = 2000;
+    const std::string prefix = "a_rather_long_common_prefix_for_every_name_";
+    size_t done = 0;
+    double open_ns = 0, miss_ns = 0;
+    for (size_t round = 0; round < rounds; ++round) {
+        const std::string dir = "/d" + std::to_string(round % 16);
+        fs_create(fs, dir.c_str(), FS_DIRECTORY);
+        for (int i = 0; i < 7; ++i) {
+            fs_create(fs, (dir + "/" + prefix + std::to_string(i)).c_str(), FS_REGULAR);
+        }
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < 7; ++i) {
+            int fd = fs_open(fs, (dir + "/" + prefix + std::to_string(i)).c_str());
+            if (fd >= 0) {
+                fs_close(fs, fd);
+                ++done;
+            }
+        }
+        open_ns += elapsed_ns(start, bench_clock::now());
+        start = bench_clock::now();
+        for (int i = 7; i < 14; ++i) {
+            done += fs_open(fs, (dir + "/" + prefix + std::to_string(i)).c_str()) == -6;
+        }
+        miss_ns += elapsed_ns(start, bench_clock::now());
+        for (int i = 0; i < 7; ++i) {
+            fs_remove(fs, (dir + "/" + prefix + std::to_string(i)).c_str());
+        }
+        fs_remove(fs, dir.c_str());
+    }
+    if (done != 14 * rounds) {
+        std::printf("failed (%zu done)\n", done);
+    } else {
+        std::printf("%12.3f %12.3f\n", open_ns / (7 * rounds) / 1e3, miss_ns / (7 * rounds) / 1e3);
+    }
+    fs_unmount(fs);
+    unlink(image);
+}
+
+// Random 4 KB reads straight through block_store_readv, one call per batch of queue_depth reads,
+//  on an image that was written in full first (so this measures submission cost over the page cache)
+static void bench_random_reads(const char *label, block_store_backend_t backend, unsigned queue_depth) {
+    block_store_options_t options = {};
+    options.backend = backend;
+    options.queue_depth = queue_depth;
+    block_store_t *bs = block_store_create_with("bench_random.bs", &options);
+    if (!bs) {
+        std::printf("%s: setup failed\n", label);
+        return;
+    }
+    if (block_store_get_backend(bs) != backend) {
+        std::printf("%s: not available here, fell back to pread\n", label);
+    }
+    const size_t io_blocks = 8, ios = 16384;
+    std::vector<uint8_t> buffer(queue_depth * io_blocks * 512, 0x3C);
+    std::vector<block_store_segment_t> segments(queue_depth * io_blocks);
+    for (size_t block = 0; block + io_blocks <= 65520; block += io_blocks * queue_depth) {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            segments[i] = {block + i < 65520 ? block + i : 65519, 0, 512, &buffer[i * 512]};
+        }
+        block_store_writev(bs, segments.data(), segments.size());
+    }
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<size_t> pick(0, 65520 / io_blocks - 1);
+    std::vector<double> latencies;
+    double total_ns = 0;
+    for (size_t done = 0; done < ios; done += queue_depth) {
+        for (size_t io = 0; io < queue_depth; ++io) {
+            const size_t first = pick(rng) * io_blocks;
+            for (size_t b = 0; b < io_blocks; ++b) {
+                segments[io * io_blocks + b] = {first + b, 0, 512, &buffer[(io * io_blocks + b) * 512]};
+            }
+        }
+        bench_clock::time_point begin = bench_clock::now();
+        block_store_readv(bs, segments.data(), segments.size());
+        const double ns = elapsed_ns(begin, bench_clock::now());
+        latencies.push_back(ns);
+        total_ns += ns;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%-10s %4u %12.0f %12.1f %12.1f\n", label, queue_depth, ios / (total_ns / 1e9),
+                latencies[latencies.size() / 2] / 1e3, latencies[latencies.size() * 99 / 100] / 1e3);
+    block_store_destroy(bs);
+}
+
+static void bench_random_read_depths() {
+    std::printf("== random 4 KB reads, one readv per queue_depth reads ==\n");
+    std::printf("%-10s %4s %12s %12s %12s\n", "backend", "qd", "IOPS", "p50 us/call", "p99 us/call");
+    const unsigned depths[] = {1, 2, 4, 8, 16, 32, 64};
+    for (unsigned depth : depths) {
+        bench_random_reads("pread", BLOCK_STORE_PREAD, depth);
+        bench_random_reads("io_uring", BLOCK_STORE_URING, depth);
+    }
+}
+
+// Sequential write/read throughput through the public API, in chunk_size pieces
+static void bench_fs_stream(const char *label, const fs_options_t &options, size_t total, size_t chunk_size) {
+    const char *image = "bench_stream.F17FS";
+    F17FS_t *fs = fs_format_with(image, &options);
+    if (!fs || fs_create(fs, "/stream", FS_REGULAR) != 0) {
+        std::printf("%s: setup failed\n", label);
+        fs_unmount(fs);
+        return;
+    }
+    std::vector<uint8_t> chunk(chunk_size, 0x5A);
+    int fd = fs_open(fs, "/stream");
+    size_t written = 0;
+    bench_clock::time_point start = bench_clock::now();
+    while (written < total) {
+        ssize_t n = fs_write(fs, fd, chunk.data(), chunk_size);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    const double write_ns = elapsed_ns(start, bench_clock::now());
+    fs_seek(fs, fd, 0, FS_SEEK_SET);
+    size_t read = 0;
+    start = bench_clock::now();
+    while (read < written) {
+        ssize_t n = fs_read(fs, fd, chunk.data(), chunk_size);
+        if (n <= 0) {
+            break;
+        }
+        read += n;
+    }
+    const double read_ns = elapsed_ns(start, bench_clock::now());
+    std::printf("%-28s write %8.1f MB/s   read %8.1f MB/s   (%zu bytes)\n", label, written / (write_ns / 1e3),
+                read / (read_ns / 1e3), written);
+    fs_close(fs, fd);
+    fs_unmount(fs);
+}
+
+static void bench_fs_streams() {
+    const struct {
+        const char *name;
+        fs_backend_t backend;
+    } backends[] = {{"mmap", FS_BACKEND_MMAP}, {"pread", FS_BACKEND_PREAD}, {"O_DIRECT", FS_BACKEND_DIRECT}, {"io_uring", FS_BACKEND_URING}};
+    for (const auto &backend : backends) {
+        std::printf("== sequential fs_write/fs_read, %s backend ==\n", backend.name);
+        fs_options_t options = {};
+        options.backend = backend.backend;
+        bench_fs_stream("16 MB in 512 B writes", options, 16u << 20, 512);
+        bench_fs_stream("16 MB in 64 KB writes", options, 16u << 20, 64u << 10);
+        bench_fs_stream("32 MB in 1 MB writes", options, 32u << 20, 1u << 20);
+    }
+}
+
+// The same streams on images formatted with bigger blocks: fewer, bigger segments per call and fewer
+//  index tables to walk
+static void bench_block_sizes() {
+    const size_t block_sizes[] = {512, 4096, 65536};
+    const struct {
+        const char *name;
+        fs_backend_t backend;
+    } backends[] = {{"mmap", FS_BACKEND_MMAP}, {"pread", FS_BACKEND_PREAD}};
+    for (const auto &backend : backends) {
+        std::printf("== sequential fs_write/fs_read by block size, %s backend ==\n", backend.name);
+        for (size_t block_size : block_sizes) {
+            fs_options_t options = {};
+            options.backend = backend.backend;
+            options.block_size = block_size;
+            char label[64];
+            std::snprintf(label, sizeof(label), "%5zu B blocks, 4 KB writes", block_size);
+            bench_fs_stream(label, options, 24u << 20, 4u << 10);
+            std::snprintf(label, sizeof(label), "%5zu B blocks, 1 MB writes", block_size);
+            bench_fs_stream(label, options, 24u << 20, 1u << 20);
+        }
+    }
+}
+
+// Durability cost of small appends: each round dirties 64 KB of an unrelated file, appends 100 B to a log
+//  and flushes, either just the log (fs_fsync) or everything (fs_sync)
+static void bench_fsync_round(const char *label, const fs_options_t &options, bool whole) {
+    F17FS_t *fs = fs_format_with("bench_fsync.F17FS", &options);
+    if (!fs || fs_create(fs, "/log", FS_REGULAR) != 0 || fs_create(fs, "/bulk", FS_REGULAR) != 0) {
+        std::printf("%s: setup failed\n", label);
+        fs_unmount(fs);
+        return;
+    }
+    const int log = fs_open(fs, "/log"), bulk = fs_open(fs, "/bulk");
+    std::vector<uint8_t> record(100, 0x4C), noise(64u << 10, 0x4E);
+    std::vector<double> latencies;
+    for (size_t round = 0; round < 200; ++round) {
+        if (fs_write(fs, bulk, noise.data(), noise.size()) <= 0 || fs_write(fs, log, record.data(), record.size()) <= 0) {
+            break;
+        }
+        bench_clock::time_point begin = bench_clock::now();
+        const int synced = whole ? fs_sync(fs) : fs_fsync(fs, log);
+        latencies.push_back(elapsed_ns(begin, bench_clock::now()));
+        if (synced != 0) {
+            std::printf("%s: sync failed\n", label);
+            break;
+        }
+    }
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("%-10s %-9s %12.1f %12.1f\n", label, whole ? "fs_sync" : "fs_fsync", latencies[latencies.size() / 2] / 1e3,
+                    latencies[latencies.size() * 99 / 100] / 1e3);
+    }
+    fs_unmount(fs);
+}
+
+static void bench_fsync() {
+    std::printf("== flush after a 100 B append (with 64 KB of other dirty data per round) ==\n");
+    std::printf("%-10s %-9s %12s %12s\n", "backend", "call", "p50 us", "p99 us");
+    const struct {
+        const char *name;
+        fs_backend_t backend;
+    } backends[] = {{"mmap", FS_BACKEND_MMAP}, {"pread", FS_BACKEND_PREAD}, {"O_DIRECT", FS_BACKEND_DIRECT}, {"io_uring", FS_BACKEND_URING}};
+    for (const auto &backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend.backend;
+        bench_fsync_round(backend.name, options, false);
+        bench_fsync_round(backend.name, options, true);
+    }
+}
+
+// Streams 32 MB into a file with and without the background flusher, then fs_sync: the flusher
+//  moves writeback off the final sync, at some cost to the writes (the final sync also waits for the
+//  flush in progress, if any)
+static void bench_flusher_run(const char *label, fs_options_t options) {
+    F17FS_t *fs = fs_format_with("bench_flusher.F17FS", &options);
+    if (!fs || fs_create(fs, "/stream", FS_REGULAR) != 0) {
+        std::printf("%s: setup failed\n", label);
+        fs_unmount(fs);
+        return;
+    }
+    const int fd = fs_open(fs, "/stream");
+    std::vector<uint8_t> chunk(64u << 10, 0x46);
+    size_t written = 0;
+    bench_clock::time_point start = bench_clock::now();
+    while (written < (32u << 20)) {
+        const ssize_t n = fs_write(fs, fd, chunk.data(), chunk.size());
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    const double write_ns = elapsed_ns(start, bench_clock::now());
+    start = bench_clock::now();
+    fs_sync(fs);  // waits for a flush in progress too
+    const double final_ns = elapsed_ns(start, bench_clock::now());
+    fs_flush_stats_t stats = {};
+    fs_get_flush_stats(fs, &stats);
+    fs_unmount(fs);
+    std::printf("%-22s %10.1f %14.2f %8zu %12.2f %12.2f\n", label, written / (write_ns / 1e3), final_ns / 1e6, stats.flushes,
+                stats.flushes ? stats.flush_ns_total / 1e6 / stats.flushes : 0.0, stats.flush_ns_max / 1e6);
+}
+
+static void bench_flusher() {
+    std::printf("== 32 MB in 64 KB writes, then fs_sync ==\n");
+    std::printf("%-22s %10s %14s %8s %12s %12s\n", "", "MB/s", "final sync ms", "flushes", "avg ms", "max ms");
+    const struct {
+        const char *name;
+        fs_backend_t backend;
+    } backends[] = {{"mmap", FS_BACKEND_MMAP}, {"pread", FS_BACKEND_PREAD}};
+    for (const auto &backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend.backend;
+        char label[64];
+        std::snprintf(label, sizeof(label), "%s, no flusher", backend.name);
+        bench_flusher_run(label, options);
+        options.flusher = true;
+        options.flush_dirty_bytes = 1u << 20;
+        std::snprintf(label, sizeof(label), "%s, flusher 1 MB", backend.name);
+        bench_flusher_run(label, options);
+    }
+}
+
+// Drops the image's pages from the page cache (it must not be mapped or dirty), so the next read is cold
+static void evict_image(const char *image) {
+    const int fd = open(image, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Sequential fs_read of a 24 MB file in 16 KB calls from a cold page cache
+// \return MB/s, 0 on error
+static double bench_cold_read(const fs_options_t &options) {
+    const size_t total = 24u << 20;
+    std::vector<uint8_t> chunk(16u << 10, 0x52);
+    evict_image("bench_cold.F17FS");
+    F17FS_t *fs = fs_mount_with("bench_cold.F17FS", &options);
+    const int fd = fs ? fs_open(fs, "/big") : -1;
+    if (fd < 0) {
+        fs_unmount(fs);
+        return 0;
+    }
+    size_t read = 0;
+    bench_clock::time_point start = bench_clock::now();
+    while (read < total) {
+        const ssize_t n = fs_read(fs, fd, chunk.data(), chunk.size());
+        if (n <= 0) {
+            break;
+        }
+        read += n;
+    }
+    const double read_ns = elapsed_ns(start, bench_clock::now());
+    fs_unmount(fs);
+    return read == total ? read / (read_ns / 1e3) : 0;
+}
+
+// With and without readahead, alternating which goes first (ABBA) since whichever run comes second
+//  tends to find more of the image cached below the guest; medians of 8 runs each
+static void bench_cold_reads() {
+    std::printf("== cold sequential fs_read, 24 MB in 16 KB calls, median MB/s of 8 ==\n");
+    std::printf("%-10s %12s %12s\n", "backend", "readahead", "none");
+    F17FS_t *fs = fs_format("bench_cold.F17FS");
+    const int fd = (fs && fs_create(fs, "/big", FS_REGULAR) == 0) ? fs_open(fs, "/big") : -1;
+    std::vector<uint8_t> chunk(1u << 20, 0x43);
+    for (size_t written = 0; fd >= 0 && written < (24u << 20); written += chunk.size()) {
+        fs_write(fs, fd, chunk.data(), chunk.size());
+    }
+    fs_unmount(fs);
+    const struct {
+        const char *name;
+        fs_backend_t backend;
+    } backends[] = {{"mmap", FS_BACKEND_MMAP}, {"pread", FS_BACKEND_PREAD}, {"io_uring", FS_BACKEND_URING}};
+    for (const auto &backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend.backend;
+        std::vector<double> on, off;
+        for (int round = 0; round < 8; ++round) {
+            const bool readahead_first = round % 4 == 0 || round % 4 == 3;
+            for (int turn = 0; turn < 2; ++turn) {
+                options.readahead = (turn == 0) == readahead_first;
+                (options.readahead ? on : off).push_back(bench_cold_read(options));
+            }
+        }
+        std::sort(on.begin(), on.end());
+        std::sort(off.begin(), off.end());
+        std::printf("%-10s %12.1f %12.1f\n", backend.name, on[on.size() / 2], off[off.size() / 2]);
+    }
+}
+
+// Pages of the image in the page cache, in MB
+static double resident_mb(const char *image) {
+    const int fd = open(image, O_RDONLY);
+    const off_t size = fd >= 0 ? lseek(fd, 0, SEEK_END) : 0;
+    void *map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    double mb = 0;
+    if (map != MAP_FAILED) {
+        const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        std::vector<unsigned char> pages((size + page - 1) / page);
+        if (mincore(map, size, pages.data()) == 0) {
+            mb = std::count_if(pages.begin(), pages.end(), [](unsigned char p) { return p & 1; }) * (double) page / (1 << 20);
+        }
+        munmap(map, size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return mb;
+}
+
+// Streams the 24 MB file left by bench_cold_reads with and without FS_ADVICE_NOREUSE: how much of it is
+//  still cached afterwards, and what dropping it behind the reader costs
+static void bench_noreuse() {
+    std::printf("== streaming fs_read of 24 MB, 16 KB calls: MB/s and MB left in the page cache ==\n");
+    std::printf("%-10s %10s %10s %10s %10s\n", "backend", "normal", "cached", "noreuse", "cached");
+    const struct {
+        const char *name;
+        fs_backend_t backend;
+    } backends[] = {{"mmap", FS_BACKEND_MMAP}, {"pread", FS_BACKEND_PREAD}};
+    for (const auto &backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend.backend;
+        double rate[2] = {0, 0}, cached[2] = {0, 0};
+        for (int noreuse = 0; noreuse < 2; ++noreuse) {
+            evict_image("bench_cold.F17FS");
+            F17FS_t *fs = fs_mount_with("bench_cold.F17FS", &options);
+            const int fd = fs ? fs_open(fs, "/big") : -1;
+            if (fd < 0 || (noreuse && fs_advise(fs, fd, 0, 0, FS_ADVICE_NOREUSE) != 0)) {
+                fs_unmount(fs);
+                continue;
+            }
+            std::vector<uint8_t> chunk(16u << 10);
+            size_t read = 0;
+            ssize_t n;
+            bench_clock::time_point start = bench_clock::now();
+            while ((n = fs_read(fs, fd, chunk.data(), chunk.size())) > 0) {
+                read += n;
+            }
+            rate[noreuse] = read / (elapsed_ns(start, bench_clock::now()) / 1e3);
+            cached[noreuse] = resident_mb("bench_cold.F17FS");
+            fs_unmount(fs);
+        }
+        std::printf("%-10s %10.1f %10.1f %10.1f %10.1f\n", backend.name, rate[0], cached[0], rate[1], cached[1]);
+    }
+}
+
+// FilePmdMapped of this process, in MB: file pages mapped as huge pages
+static double pmd_mapped_mb() {
+    FILE *smaps = std::fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    double kb = 0;
+    while (smaps && std::fgets(line, sizeof(line), smaps)) {
+        if (std::sscanf(line, "FilePmdMapped: %lf kB", &kb) == 1) {
+            break;
+        }
+    }
+    if (smaps) {
+        std::fclose(smaps);
+    }
+    return kb / 1024;
+}
+
+// Mounts the image left by bench_cold_reads with the given mapping options and reads the 24 MB file twice
+//  in 64 KB calls. Adds mount, first and second pass times (ms) to times and the huge-mapped MB seen
+//  during the first pass to pmd
+static void bench_mapping_run(const fs_options_t &options, bool cold, double *times, double *pmd) {
+    if (cold) {
+        evict_image("bench_cold.F17FS");
+    }
+    std::vector<uint8_t> chunk(64u << 10);
+    bench_clock::time_point start = bench_clock::now();
+    F17FS_t *fs = fs_mount_with("bench_cold.F17FS", &options);
+    times[0] += elapsed_ns(start, bench_clock::now()) / 1e6;
+    const int fd = fs ? fs_open(fs, "/big") : -1;
+    for (int pass = 1; fd >= 0 && pass <= 2; ++pass) {
+        fs_seek(fs, fd, 0, FS_SEEK_SET);
+        start = bench_clock::now();
+        while (fs_read(fs, fd, chunk.data(), chunk.size()) > 0) {
+        }
+        times[pass] += elapsed_ns(start, bench_clock::now()) / 1e6;
+        if (pass == 1) {
+            *pmd += pmd_mapped_mb();
+        }
+    }
+    fs_unmount(fs);
+}
+
+static void bench_mapping() {
+    const int rounds = 5;
+    const struct {
+        const char *name;
+        bool populate, hugepages, lock;
+    } modes[] = {{"lazy", false, false, false},
+                 {"populate", true, false, false},
+                 {"hugepages", false, true, false},
+                 {"huge+populate", true, true, false},
+                 {"populate+mlock", true, false, true}};
+    for (int cold = 1; cold >= 0; --cold) {
+        std::printf("== mount + first/second pass over 24 MB with the image %s, mmap, mean ms of %d ==\n",
+                    cold ? "not cached" : "cached", rounds);
+        std::printf("%-15s %8s %8s %8s %8s %8s\n", "mapping", "mount", "first", "second", "total", "pmd MB");
+        for (const auto &mode : modes) {
+            fs_options_t options = {};
+            options.map_populate = mode.populate;
+            options.map_hugepages = mode.hugepages;
+            options.map_lock = mode.lock;
+            double times[3] = {0, 0, 0}, pmd = 0;
+            bench_mapping_run(options, cold, times, &pmd);  // warm up the code paths
+            times[0] = times[1] = times[2] = pmd = 0;
+            for (int round = 0; round < rounds; ++round) {
+                bench_mapping_run(options, cold, times, &pmd);
+            }
+            std::printf("%-15s %8.2f %8.2f %8.2f %8.2f %8.1f\n", mode.name, times[0] / rounds, times[1] / rounds,
+                        times[2] / rounds, (times[0] + times[1]) / rounds, pmd / rounds);
+        }
+    }
+}
+
+int main() {
+    bench_bitmap_search();
+    bench_bitmap_summary();
+    bench_run_allocators();
+    bench_large_images();
+    bench_mount_clean();
+    bench_inodes();
+    bench_directories();
+    bench_deep_opens();
+    bench_openat();
+    bench_readdir();
+    bench_small_dir_lookups();
+    bench_random_read_depths();
+    bench_fs_streams();
+    bench_block_sizes();
+    bench_fsync();
+    bench_flusher();
+    bench_cold_reads();
+    bench_noreuse();
+    bench_mapping();
+    return 0;
+}
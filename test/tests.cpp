@@ -1,12 +1,16 @@
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <new>
+#include <thread>
 #include <vector>
 using std::vector;
 using std::string;
 #include <gtest/gtest.h>
 extern "C" {
 #include "F17FS.h"
+#include "bitmap.h"
+#include "block_store.h"
 }
 
 unsigned int score;
@@ -210,7 +214,9 @@ TEST(b_tests, file_creation_two) {
     score += 5;
     
     // CREATE_FILE 19
-    ASSERT_LT(fs_create(fs, "/a/z", FS_REGULAR), 0);
+    // An eighth entry no longer fills the directory, it becomes hashed
+    ASSERT_EQ(fs_create(fs, "/a/z", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/a/z"), 0);
     // Start making files
     // this should fill out /[a-d]/[a-e]/[a-e] which is 196 down ()
     fname[2] = '/';
@@ -250,15 +256,20 @@ TEST(b_tests, file_creation_two) {
         // printf("File: %s\n", fname);
         ASSERT_EQ(fs_create(fs, fname, FS_REGULAR), 0);
     }
-    //puts("Inode table full?");
     // CREATE_FILE 20
+    // the inode table is full, the inode file takes over (a block of 8 inodes at a time)
     fname[0] = '/';
     fname[1] = 'e';
     fname[2] = '/';
     fname[3] = 'c';
     fname[4] = '/';
     fname[5] = 'f';
-    ASSERT_LT(fs_create(fs, fname, FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, fname, FS_REGULAR), 0);
+    fs_info_t info;
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_EQ(info.inodes, (size_t)(256 + 8));
+    ASSERT_EQ(info.free_inodes, (size_t) 7);
+    ASSERT_EQ(info.features, (uint32_t) (FS_FEATURE_INODE_FILE | FS_FEATURE_HASHED_DIRS));  // /a went past 7 entries
     // save file for inspection
     fs_unmount(fs);
     // ... Can't really test 21 yet.
@@ -658,7 +669,7 @@ TEST(e_tests, remove_file) {
         "more/bad_req",
         "/folder/withfilethatiswayyyyytoolongwhydoyoumakefilesthataretoobigEXACT!", "/", "/mystery_file"};
     vector<const char *> a_fnames{"/file_a", "/file_b", "/file_c", "/file_d"};
-    const char *(test_fname[2]) = {"e_tests_a.F17FS", "e_tests_b.F17FS"};
+    const char *test_fname[2] = {"e_tests_a.F17FS", "e_tests_b.F17FS"};
     ASSERT_EQ(system("cp d_tests_full.F17FS e_tests_a.F17FS"), 0);
     ASSERT_EQ(system("cp c_tests.F17FS e_tests_b.F17FS"), 0);
     F17FS *fs = fs_mount(test_fname[1]);
@@ -1075,7 +1086,7 @@ TEST(j_tests, link) {
 	ASSERT_NE(record_results,nullptr);
 	ASSERT_EQ(dyn_array_size(record_results),7);
     	dyn_array_destroy(record_results);
-	ASSERT_LT(fs_link(fs,fnames[0],"/folder2/h"),0);
+	ASSERT_EQ(fs_link(fs,fnames[0],"/folder2/h"),0);  // full directory block, the directory grows
 	// FS_LINK 10 Error, src does not exist
     	ASSERT_LT(fs_link(fs,fnames[4],"/anothernewfile"),0);
     	// FS_LINK 11 Error, FS null
@@ -1092,6 +1103,1771 @@ TEST(j_tests, link) {
 }
 #endif
 
+/*
+    bitmap summary levels
+    1. Searches with a zero summary and with a set summary give what a plain bitmap does, through bits
+       set, reset and flipped around word and summary word boundaries, sizes that aren't multiples of 64,
+       before the levels are built (a plain scan) and after bitmap_build_summary
+    2. A map with no zero (or no set) bit left, the bits past the end don't count
+*/
+TEST(k_tests, bitmap_summary) {
+    const size_t sizes[] = {200, 4096 + 37, 64 * 64 * 3 + 5};
+    srand(29);
+    for (size_t bits : sizes) {
+        for (int set_summary = 0; set_summary < 2; ++set_summary) {
+            bitmap_t *plain = bitmap_create(bits), *summarized = bitmap_create(bits);
+            ASSERT_NE(plain, nullptr);
+            ASSERT_NE(summarized, nullptr);
+            const uint8_t pattern = set_summary ? 0x00 : 0xFF;
+            bitmap_format(plain, pattern);
+            bitmap_format(summarized, pattern);
+            ASSERT_TRUE(set_summary ? bitmap_enable_set_summary(summarized) : bitmap_enable_summary(summarized));
+            vector<size_t> edges = {0, 1, 63, 64, 65, 127, 128, 4095, 4096, 4097, bits - 65, bits - 64, bits - 2, bits - 1};
+            for (int step = 0; step < 3000; ++step) {
+                // SUMMARY 1
+                if (step == 100) {
+                    bitmap_build_summary(summarized);
+                }
+                size_t bit = rand() % 2 ? edges[rand() % edges.size()] : rand() % bits;
+                if (bit >= bits) {
+                    continue;
+                }
+                switch (rand() % 3) {
+                    case 0:
+                        bitmap_set(plain, bit);
+                        bitmap_set(summarized, bit);
+                        break;
+                    case 1:
+                        bitmap_reset(plain, bit);
+                        bitmap_reset(summarized, bit);
+                        break;
+                    default:
+                        bitmap_flip(plain, bit);
+                        bitmap_flip(summarized, bit);
+                        break;
+                }
+                ASSERT_EQ(bitmap_ffz(summarized), bitmap_ffz(plain));
+                ASSERT_EQ(bitmap_ffs(summarized), bitmap_ffs(plain));
+                size_t from = rand() % 2 ? edges[rand() % edges.size()] : rand() % bits;
+                if (from < bits) {
+                    ASSERT_EQ(bitmap_ffz_from(summarized, from), bitmap_ffz_from(plain, from));
+                    ASSERT_EQ(bitmap_ffs_from(summarized, from), bitmap_ffs_from(plain, from));
+                }
+            }
+            // SUMMARY 2
+            const size_t last = bits - 1;
+            for (size_t bit = 0; bit < bits; ++bit) {
+                set_summary ? bitmap_reset(summarized, bit) : bitmap_set(summarized, bit);
+            }
+            ASSERT_EQ(set_summary ? bitmap_ffs(summarized) : bitmap_ffz(summarized), SIZE_MAX);
+            ASSERT_EQ(set_summary ? bitmap_ffs_from(summarized, 70) : bitmap_ffz_from(summarized, 70), SIZE_MAX);
+            bitmap_flip(summarized, last);
+            ASSERT_EQ(set_summary ? bitmap_ffs(summarized) : bitmap_ffz(summarized), last);
+            ASSERT_EQ(set_summary ? bitmap_ffs_from(summarized, last) : bitmap_ffz_from(summarized, last), last);
+            bitmap_flip(summarized, 64);
+            ASSERT_EQ(set_summary ? bitmap_ffs_from(summarized, 1) : bitmap_ffz_from(summarized, 1), (size_t) 64);
+            ASSERT_EQ(set_summary ? bitmap_ffs_from(summarized, 65) : bitmap_ffz_from(summarized, 65), last);
+            bitmap_destroy(plain);
+            bitmap_destroy(summarized);
+        }
+    }
+}
+
+/*
+    block_store used/free counters
+    1. Fresh store, counters match a full recount
+    2. After a mix of allocate/request/release, counters match a full recount
+    3. After reopening (counters rebuilt at mount), counters match a full recount
+*/
+TEST(k_tests, block_store_counters) {
+    const char *test_fname = "k_tests.bs";
+    block_store_t *bs = block_store_create(test_fname);
+    ASSERT_NE(bs, nullptr);
+    // COUNTERS 1
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    ASSERT_EQ(block_store_get_free_blocks(bs), block_store_get_block_count(bs) - block_store_count_used_blocks(bs));
+    // COUNTERS 2
+    srand(17);
+    for (int i = 0; i < 20000; ++i) {
+        size_t block_id = rand() % 65520;
+        switch (rand() % 3) {
+            case 0:
+                block_store_allocate(bs);
+                break;
+            case 1:
+                block_store_request(bs, block_id);
+                break;
+            default:
+                block_store_release(bs, block_id);
+                break;
+        }
+    }
+    // double release/request must not drift the counters either
+    size_t block_id = block_store_allocate(bs);
+    ASSERT_NE(block_id, SIZE_MAX);
+    ASSERT_FALSE(block_store_request(bs, block_id));
+    block_store_release(bs, block_id);
+    block_store_release(bs, block_id);
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    ASSERT_EQ(block_store_get_free_blocks(bs), block_store_get_block_count(bs) - block_store_count_used_blocks(bs));
+    size_t used = block_store_get_used_blocks(bs);
+    block_store_destroy(bs);
+    // COUNTERS 3
+    bs = block_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_get_used_blocks(bs), used);
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    block_store_destroy(bs);
+}
+
+/*
+    block_store contiguous runs
+    1. Runs are contiguous, capped at the length asked for, and their blocks marked used
+    2. A run near a hint starts at the hint when it is free, stops at the next block in use
+    3. Past the last free block the search wraps around to the front
+    4. A full store, bad parameters
+*/
+TEST(k_tests, block_store_runs) {
+    const char *test_fname = "k_tests_runs.bs";
+    block_store_t *bs = block_store_create(test_fname);
+    ASSERT_NE(bs, nullptr);
+    const size_t blocks = 65520;  // the FBM takes the last 16
+    // RUNS 1
+    size_t start = SIZE_MAX, got = 0;
+    ASSERT_TRUE(block_store_allocate_run(bs, 10, &start, &got));
+    ASSERT_EQ(start, (size_t) 0);
+    ASSERT_EQ(got, (size_t) 10);
+    ASSERT_TRUE(block_store_allocate_run(bs, 5, &start, &got));
+    ASSERT_EQ(start, (size_t) 10);
+    ASSERT_EQ(got, (size_t) 5);
+    for (size_t id = 0; id < 15; ++id) {
+        ASSERT_TRUE(block_store_test(bs, id));
+    }
+    ASSERT_FALSE(block_store_test(bs, 15));
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    ASSERT_EQ(block_store_get_free_blocks(bs), blocks - 15);
+    // RUNS 2
+    ASSERT_TRUE(block_store_allocate_run_near(bs, 1000, 8, &start, &got));
+    ASSERT_EQ(start, (size_t) 1000);
+    ASSERT_EQ(got, (size_t) 8);
+    ASSERT_TRUE(block_store_request(bs, 2000));
+    ASSERT_TRUE(block_store_request(bs, 2003));
+    ASSERT_TRUE(block_store_allocate_run_near(bs, 2001, 10, &start, &got));
+    ASSERT_EQ(start, (size_t) 2001);
+    ASSERT_EQ(got, (size_t) 2);
+    ASSERT_TRUE(block_store_allocate_run_near(bs, 2001, 10, &start, &got));
+    ASSERT_EQ(start, (size_t) 2004);
+    ASSERT_EQ(got, (size_t) 10);
+    for (size_t id = 1999; id < 2015; ++id) {
+        ASSERT_EQ(block_store_test(bs, id), id != 1999 && id != 2014);
+    }
+    // RUNS 3
+    ASSERT_TRUE(block_store_allocate_run_near(bs, blocks - 5, 10, &start, &got));
+    ASSERT_EQ(start, blocks - 5);
+    ASSERT_EQ(got, (size_t) 5);
+    ASSERT_TRUE(block_store_allocate_run_near(bs, blocks - 3, 4, &start, &got));
+    ASSERT_EQ(start, (size_t) 15);
+    ASSERT_EQ(got, (size_t) 4);
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    // RUNS 4
+    size_t free_blocks = block_store_get_free_blocks(bs), taken = 0;
+    while (block_store_allocate_run(bs, 4096, &start, &got)) {
+        ASSERT_GE(got, (size_t) 1);
+        ASSERT_LE(got, (size_t) 4096);
+        taken += got;
+    }
+    ASSERT_EQ(taken, free_blocks);
+    ASSERT_EQ(block_store_get_free_blocks(bs), (size_t) 0);
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    ASSERT_FALSE(block_store_allocate_run(bs, 1, &start, &got));
+    ASSERT_FALSE(block_store_allocate_run_near(bs, 100, 1, &start, &got));
+    block_store_release(bs, 100);
+    ASSERT_FALSE(block_store_allocate_run(bs, 0, &start, &got));
+    ASSERT_FALSE(block_store_allocate_run(bs, 1, NULL, &got));
+    ASSERT_FALSE(block_store_allocate_run_near(bs, 7, 1, &start, NULL));
+    ASSERT_FALSE(block_store_allocate_run(NULL, 1, &start, &got));
+    ASSERT_FALSE(block_store_allocate_run_near(NULL, 7, 1, &start, &got));
+    ASSERT_TRUE(block_store_allocate_run_near(bs, 7, 3, &start, &got));
+    ASSERT_EQ(start, (size_t) 100);
+    ASSERT_EQ(got, (size_t) 1);
+    block_store_destroy(bs);
+}
+
+/*
+    block_store free extent tree
+    1. Tree and bitmap agree on the free runs after allocate/allocate_run/request/release churn
+    2. Runs handed out with the tree enabled are really free and really contiguous
+*/
+TEST(k_tests, block_store_extents) {
+    const char *test_fname = "k_tests_extents.bs";
+    block_store_t *bs = block_store_create(test_fname);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_TRUE(block_store_enable_extents(bs));
+    ASSERT_EQ(block_store_get_free_extents(bs), 1);
+    srand(23);
+    vector<std::pair<size_t, size_t>> runs;
+    for (int i = 0; i < 5000; ++i) {
+        size_t start = 0, got = 0;
+        switch (rand() % 4) {
+            case 0:
+                block_store_allocate(bs);
+                break;
+            case 1:
+                block_store_request(bs, rand() % 65520);
+                break;
+            case 2:
+                // EXTENTS 2
+                if (block_store_allocate_run(bs, 1 + rand() % 64, &start, &got)) {
+                    ASSERT_GE(got, 1);
+                    runs.push_back({start, got});
+                }
+                break;
+            default:
+                if (!runs.empty()) {
+                    size_t pick = rand() % runs.size();
+                    for (size_t id = runs[pick].first; id < runs[pick].first + runs[pick].second; ++id) {
+                        ASSERT_TRUE(block_store_test(bs, id));
+                        block_store_release(bs, id);
+                    }
+                    runs.erase(runs.begin() + pick);
+                } else {
+                    block_store_release(bs, rand() % 65520);
+                }
+                break;
+        }
+    }
+    ASSERT_EQ(block_store_get_used_blocks(bs), block_store_count_used_blocks(bs));
+    size_t extents = block_store_get_free_extents(bs);
+    block_store_destroy(bs);
+    // EXTENTS 1 - a store without the tree walks the bitmap instead
+    bs = block_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_get_free_extents(bs), extents);
+    block_store_destroy(bs);
+}
+
+/*
+    block_store views
+    1. Views point into the image, writes through a mutable view are seen by block_store_read
+    2. Only mutable views and writes dirty a block, allocation dirties the FBM block
+    3. Pins are counted until unpinned, bad ids give NULL
+*/
+TEST(k_tests, block_store_views) {
+    block_store_t *bs = block_store_create("k_tests_views.bs");
+    ASSERT_NE(bs, nullptr);
+    // VIEWS 1
+    uint8_t buffer[512];
+    memset(buffer, 0x5A, sizeof(buffer));
+    ASSERT_EQ(block_store_write(bs, 40, buffer), (size_t) 512);
+    const uint8_t *view = (const uint8_t *) block_store_view(bs, 40);
+    ASSERT_NE(view, nullptr);
+    ASSERT_EQ(memcmp(view, buffer, sizeof(buffer)), 0);
+    uint8_t *mut = (uint8_t *) block_store_view_mut(bs, 41);
+    ASSERT_NE(mut, nullptr);
+    mut[7] = 0xA5;
+    ASSERT_EQ(block_store_read(bs, 41, buffer), (size_t) 512);
+    ASSERT_EQ(buffer[7], 0xA5);
+    // VIEWS 2
+    ASSERT_TRUE(block_store_is_dirty(bs, 40));
+    ASSERT_TRUE(block_store_is_dirty(bs, 41));
+    ASSERT_FALSE(block_store_is_dirty(bs, 42));
+    block_store_unpin(bs, 40);
+    view = (const uint8_t *) block_store_view(bs, 42);
+    ASSERT_FALSE(block_store_is_dirty(bs, 42));
+    ASSERT_EQ(block_store_get_dirty_blocks(bs), (size_t) 2);
+    ASSERT_NE(block_store_allocate(bs), SIZE_MAX);
+    ASSERT_TRUE(block_store_is_dirty(bs, 65520));
+    // VIEWS 3
+    ASSERT_EQ(block_store_get_pinned(bs), (size_t) 2);
+    block_store_unpin(bs, 41);
+    block_store_unpin(bs, 42);
+    ASSERT_EQ(block_store_get_pinned(bs), (size_t) 0);
+    ASSERT_EQ(block_store_view(bs, 65520), nullptr);
+    ASSERT_EQ(block_store_view_mut(nullptr, 1), nullptr);
+    ASSERT_EQ(block_store_get_pinned(bs), (size_t) 0);
+    block_store_destroy(bs);
+}
+
+/*
+    block_store vectored io
+    1. writev/readv round trip across adjacent blocks, a gap, and partial blocks; writev from const data
+    2. Transfers stop at the first invalid segment
+*/
+TEST(k_tests, block_store_vectored) {
+    block_store_t *bs = block_store_create("k_tests_vectored.bs");
+    ASSERT_NE(bs, nullptr);
+    // VECTORED 1
+    vector<uint8_t> src(2048), dst(2048, 0);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (uint8_t)(i * 7 + 3);
+    }
+    block_store_segment_t out[4] = {{100, 256, 256, &src[0]},
+                                    {101, 0, 512, &src[256]},
+                                    {102, 0, 512, &src[768]},
+                                    {200, 0, 300, &src[1280]}};
+    ASSERT_EQ(block_store_writev(bs, out, 4), (size_t) 1580);
+    ASSERT_TRUE(block_store_is_dirty(bs, 101));
+    ASSERT_TRUE(block_store_is_dirty(bs, 200));
+    block_store_segment_t in[4] = {{100, 256, 256, &dst[0]},
+                                   {101, 0, 512, &dst[256]},
+                                   {102, 0, 512, &dst[768]},
+                                   {200, 0, 300, &dst[1280]}};
+    ASSERT_EQ(block_store_readv(bs, in, 4), (size_t) 1580);
+    ASSERT_EQ(memcmp(&src[0], &dst[0], 1580), 0);
+    uint8_t block[512];
+    ASSERT_EQ(block_store_read(bs, 101, block), (size_t) 512);
+    ASSERT_EQ(memcmp(block, &src[256], 512), 0);
+    const vector<uint8_t> &constant = src;
+    block_store_segment_t from_const = {300, 12, 100, {nullptr}};
+    from_const.source = &constant[500];
+    ASSERT_EQ(block_store_writev(bs, &from_const, 1), (size_t) 100);
+    ASSERT_EQ(block_store_read(bs, 300, block), (size_t) 512);
+    ASSERT_EQ(memcmp(block + 12, &src[500], 100), 0);
+    // VECTORED 2
+    block_store_segment_t bad[3] = {{5, 0, 512, &dst[0]}, {6, 100, 500, &dst[512]}, {7, 0, 512, &dst[1024]}};
+    ASSERT_EQ(block_store_readv(bs, bad, 3), (size_t) 512);
+    ASSERT_EQ(block_store_writev(bs, bad + 1, 2), (size_t) 0);
+    ASSERT_EQ(block_store_readv(nullptr, in, 4), (size_t) 0);
+    block_store_destroy(bs);
+}
+
+/*
+    backends
+    1. Every backend formats, writes through direct/indirect/double indirect blocks, remounts and reads back
+    2. Images are the same on disk whatever wrote them: each one mounts with mmap
+    3. Copied views on a non-mmap backend stay coherent with block_store_read/write
+*/
+TEST(k_tests, backends) {
+    const char *test_fname = "k_tests_backends.F17FS";
+    const fs_backend_t backends[] = {FS_BACKEND_MMAP, FS_BACKEND_PREAD, FS_BACKEND_DIRECT, FS_BACKEND_URING};
+    vector<uint8_t> data(300 * 1024 + 123), back(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 31 + i / 512);
+    }
+    for (fs_backend_t backend : backends) {
+        // BACKENDS 1
+        fs_options_t options = {};
+        options.backend = backend;
+        options.queue_depth = 4;
+        F17FS_t *fs = fs_format_with(test_fname, &options);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+        ASSERT_EQ(fs_create(fs, "/dir/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/dir/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], 1000), 1000);
+        ASSERT_EQ(fs_write(fs, fd, &data[1000], data.size() - 1000), (ssize_t)(data.size() - 1000));
+        ASSERT_EQ(fs_unmount(fs), 0);
+        fs = fs_mount_with(test_fname, &options);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/dir/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) back.size());
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+        // BACKENDS 2
+        fs = fs_mount(test_fname);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/dir/file");
+        ASSERT_GE(fd, 0);
+        std::fill(back.begin(), back.end(), 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) back.size());
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_create(fs, "/dir/other", FS_REGULAR), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+    // BACKENDS 3
+    block_store_options_t options = {};
+    options.backend = BLOCK_STORE_PREAD;
+    block_store_t *bs = block_store_create_with("k_tests_backends.bs", &options);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_Data_location(bs), nullptr);
+    uint8_t block[512];
+    memset(block, 0x11, sizeof(block));
+    const uint8_t *view = (const uint8_t *) block_store_view(bs, 50);
+    ASSERT_NE(view, nullptr);
+    ASSERT_EQ(block_store_write(bs, 50, block), (size_t) 512);
+    ASSERT_EQ(view[100], 0x11);
+    uint8_t *range = (uint8_t *) block_store_view_range_mut(bs, 60, 4);
+    ASSERT_NE(range, nullptr);
+    ASSERT_EQ(block_store_view_range_mut(bs, 62, 4), nullptr);
+    ASSERT_EQ((uint8_t *) block_store_view_mut(bs, 62), range + 2 * 512);
+    range[2 * 512 + 5] = 0x22;
+    ASSERT_EQ(block_store_read(bs, 62, block), (size_t) 512);
+    ASSERT_EQ(block[5], 0x22);
+    block_store_unpin(bs, 50);
+    block_store_unpin(bs, 62);
+    block_store_unpin(bs, 60);
+    ASSERT_EQ(block_store_get_pinned(bs), (size_t) 0);
+    ASSERT_NE(block_store_allocate(bs), SIZE_MAX);
+    block_store_destroy(bs);
+    bs = block_store_open("k_tests_backends.bs");
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_read(bs, 62, block), (size_t) 512);
+    ASSERT_EQ(block[5], 0x22);
+    ASSERT_EQ(block_store_get_used_blocks(bs), (size_t) 17);
+    block_store_destroy(bs);
+}
+
+/*
+    io_uring backend
+    1. Scattered writev/readv with more pieces than the queue depth round trip, and so do transfers larger than a slot
+    2. The backend is io_uring, or pread where io_uring can't be set up
+*/
+TEST(k_tests, uring_backend) {
+    block_store_options_t options = {};
+    options.backend = BLOCK_STORE_URING;
+    options.queue_depth = 2;
+    block_store_t *bs = block_store_create_with("k_tests_uring.bs", &options);
+    ASSERT_NE(bs, nullptr);
+    // URING 2
+    ASSERT_TRUE(block_store_get_backend(bs) == BLOCK_STORE_URING || block_store_get_backend(bs) == BLOCK_STORE_PREAD);
+    // URING 1
+    vector<uint8_t> src(40 * 512 + 300 * 512), dst(src.size(), 0);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (uint8_t)(i * 13 + i / 512);
+    }
+    vector<block_store_segment_t> out, in;
+    for (size_t i = 0; i < 40; ++i) {
+        // every other block: 40 runs of one block each
+        out.push_back({1000 + 2 * i, 0, 512, &src[i * 512]});
+        in.push_back({1000 + 2 * i, 0, 512, &dst[i * 512]});
+    }
+    for (size_t i = 0; i < 300; ++i) {
+        // one run of 300 blocks, more than two slots
+        out.push_back({5000 + i, 0, 512, &src[(40 + i) * 512]});
+        in.push_back({5000 + i, 0, 512, &dst[(40 + i) * 512]});
+    }
+    ASSERT_EQ(block_store_writev(bs, out.data(), out.size()), src.size());
+    ASSERT_EQ(block_store_readv(bs, in.data(), in.size()), src.size());
+    ASSERT_EQ(memcmp(&src[0], &dst[0], src.size()), 0);
+    uint8_t block[512];
+    ASSERT_EQ(block_store_read(bs, 1002, block), (size_t) 512);
+    ASSERT_EQ(memcmp(block, &src[512], 512), 0);
+    block_store_destroy(bs);
+}
+
+/*
+    Sync
+    1. block_store_sync_blocks cleans the listed blocks and the FBM, and leaves other dirty blocks alone
+    2. block_store_sync cleans everything, and writes out what only a pinned view holds
+    3. fs_sync and fs_fsync succeed on every backend, fs_fsync rejects bad descriptors
+*/
+TEST(k_tests, sync) {
+    const block_store_backend_t store_backends[] = {BLOCK_STORE_MMAP, BLOCK_STORE_PREAD};
+    for (block_store_backend_t backend : store_backends) {
+        // SYNC 1
+        block_store_options_t options = {};
+        options.backend = backend;
+        block_store_t *bs = block_store_create_with("k_tests_sync.bs", &options);
+        ASSERT_NE(bs, nullptr);
+        uint8_t block[512];
+        memset(block, 0x5a, sizeof(block));
+        ASSERT_TRUE(block_store_request(bs, 10));
+        ASSERT_EQ(block_store_write(bs, 10, block), (size_t) 512);
+        ASSERT_EQ(block_store_write(bs, 20, block), (size_t) 512);
+        ASSERT_EQ(block_store_write(bs, 21, block), (size_t) 512);
+        ASSERT_TRUE(block_store_is_dirty(bs, 65520));
+        size_t ids[] = {21, 10, 10, 70000};
+        ASSERT_TRUE(block_store_sync_blocks(bs, ids, 4));
+        ASSERT_FALSE(block_store_is_dirty(bs, 10));
+        ASSERT_FALSE(block_store_is_dirty(bs, 21));
+        ASSERT_FALSE(block_store_is_dirty(bs, 65520));
+        ASSERT_TRUE(block_store_is_dirty(bs, 20));
+        ASSERT_EQ(block_store_get_dirty_blocks(bs), (size_t) 1);
+        // SYNC 2
+        uint8_t *view = (uint8_t *) block_store_view_mut(bs, 30);
+        ASSERT_NE(view, nullptr);
+        view[7] = 0x77;
+        ASSERT_TRUE(block_store_sync(bs));
+        ASSERT_EQ(block_store_get_dirty_blocks(bs), (size_t) 0);
+        block_store_t *other = block_store_open("k_tests_sync.bs");
+        ASSERT_NE(other, nullptr);
+        ASSERT_EQ(block_store_read(other, 30, block), (size_t) 512);
+        ASSERT_EQ(block[7], 0x77);
+        block_store_destroy(other);
+        block_store_unpin(bs, 30);
+        block_store_destroy(bs);
+    }
+    ASSERT_FALSE(block_store_sync(NULL));
+    // SYNC 3
+    const fs_backend_t backends[] = {FS_BACKEND_MMAP, FS_BACKEND_PREAD, FS_BACKEND_DIRECT, FS_BACKEND_URING};
+    vector<uint8_t> data(140 * 1024, 0x3c);
+    for (fs_backend_t backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend;
+        F17FS_t *fs = fs_format_with("k_tests_sync.F17FS", &options);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], data.size()), (ssize_t) data.size());
+        ASSERT_EQ(fs_fsync(fs, fd), 0);
+        ASSERT_LT(fs_fsync(fs, fd + 1), 0);
+        ASSERT_LT(fs_fsync(NULL, fd), 0);
+        ASSERT_EQ(fs_sync(fs), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+    ASSERT_LT(fs_sync(NULL), 0);
+}
+
+/*
+    Background flusher
+    1. Crossing the byte threshold gets the dirty blocks flushed without any sync call, and counted
+    2. Only one flusher per store, and it can be restarted after a stop
+    3. A block flushed between pinning a writable view and writing through it is dirty again once unpinned
+       with block_store_unpin_mut, and reads back what was written
+    4. A file system mounted with the flusher on syncs by age while files are written, on every backend
+*/
+TEST(k_tests, flusher) {
+    const block_store_backend_t store_backends[] = {BLOCK_STORE_MMAP, BLOCK_STORE_PREAD};
+    vector<uint8_t> block(512, 0x6b), seen(512);
+    for (block_store_backend_t backend : store_backends) {
+        // FLUSHER 1
+        block_store_options_t options = {};
+        options.backend = backend;
+        block_store_t *bs = block_store_create_with("k_tests_flusher.bs", &options);
+        ASSERT_NE(bs, nullptr);
+        block_store_flusher_options_t flusher = {};
+        flusher.dirty_bytes = 64 * 1024;
+        flusher.max_age_ms = 60000;
+        ASSERT_TRUE(block_store_start_flusher(bs, &flusher));
+        // FLUSHER 2
+        ASSERT_FALSE(block_store_start_flusher(bs, &flusher));
+        for (size_t id = 100; id < 100 + 1024; ++id) {
+            ASSERT_EQ(block_store_write(bs, id, &block[0]), (size_t) 512);
+        }
+        block_store_flush_stats_t stats = {};
+        for (int wait = 0; wait < 200 && (stats.flushes == 0 || block_store_get_dirty_blocks(bs) >= 128); ++wait) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_TRUE(block_store_get_flush_stats(bs, &stats));
+        }
+        ASSERT_GT(stats.flushes, (size_t) 0);
+        ASSERT_GE(stats.flushed_blocks, (size_t) 128);
+        ASSERT_EQ(stats.failures, (size_t) 0);
+        ASSERT_LT(block_store_get_dirty_blocks(bs), (size_t) 128);
+        block_store_stop_flusher(bs);
+        ASSERT_TRUE(block_store_start_flusher(bs, NULL));
+        block_store_stop_flusher(bs);
+        // FLUSHER 3
+        flusher.dirty_bytes = 512;
+        flusher.max_age_ms = 1;
+        for (size_t id = 3000; id < 3020; ++id) {
+            ASSERT_TRUE(block_store_sync(bs));
+            ASSERT_TRUE(block_store_start_flusher(bs, &flusher));
+            ASSERT_TRUE(block_store_get_flush_stats(bs, &stats));
+            const size_t flushes = stats.flushes;
+            uint8_t *view = (uint8_t *) block_store_view_mut(bs, id);
+            ASSERT_NE(view, nullptr);
+            for (int wait = 0; wait < 200 && stats.flushes == flushes; ++wait) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                ASSERT_TRUE(block_store_get_flush_stats(bs, &stats));
+            }
+            ASSERT_GT(stats.flushes, flushes);
+            block_store_stop_flusher(bs);
+            ASSERT_FALSE(block_store_is_dirty(bs, id));
+            memset(view, (int) id, 512);
+            block_store_unpin_mut(bs, id, 1);
+            ASSERT_TRUE(block_store_is_dirty(bs, id));
+            ASSERT_EQ(block_store_read(bs, id, &seen[0]), (size_t) 512);
+            ASSERT_EQ(seen[511], (uint8_t) id);
+        }
+        ASSERT_EQ(block_store_get_pinned(bs), (size_t) 0);
+        block_store_destroy(bs);
+    }
+    // FLUSHER 4
+    const fs_backend_t backends[] = {FS_BACKEND_MMAP, FS_BACKEND_PREAD, FS_BACKEND_DIRECT, FS_BACKEND_URING};
+    vector<uint8_t> data(256 * 1024), back(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 7 + i / 512);
+    }
+    for (fs_backend_t backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend;
+        options.flusher = true;
+        options.flush_max_age_ms = 20;
+        F17FS_t *fs = fs_format_with("k_tests_flusher.F17FS", &options);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        for (size_t done = 0; done < data.size(); done += 4096) {
+            ASSERT_EQ(fs_write(fs, fd, &data[done], 4096), 4096);
+        }
+        fs_flush_stats_t stats = {};
+        for (int wait = 0; wait < 200 && stats.flushes == 0; ++wait) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_EQ(fs_get_flush_stats(fs, &stats), 0);
+        }
+        ASSERT_GT(stats.flushes, (size_t) 0);
+        ASSERT_GT(stats.flush_ns_total, (uint64_t) 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+        fs = fs_mount("k_tests_flusher.F17FS");
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) back.size());
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_get_flush_stats(fs, &stats), 0);
+        ASSERT_EQ(stats.flushes, (size_t) 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+}
+
+/*
+    Readahead
+    1. block_store_prefetch accepts ranges in the store on every backend and rejects the rest
+    2. With readahead on, sequential reads across the indirect and double indirect blocks, a seek back and
+       small reads return the same data as without
+*/
+TEST(k_tests, readahead) {
+    // READAHEAD 1
+    const block_store_backend_t store_backends[] = {BLOCK_STORE_MMAP, BLOCK_STORE_PREAD, BLOCK_STORE_DIRECT};
+    for (block_store_backend_t backend : store_backends) {
+        block_store_options_t options = {};
+        options.backend = backend;
+        block_store_t *bs = block_store_create_with("k_tests_readahead.bs", &options);
+        ASSERT_NE(bs, nullptr);
+        ASSERT_TRUE(block_store_prefetch(bs, 100, 64));
+        ASSERT_TRUE(block_store_prefetch(bs, 65535, 1));
+        ASSERT_FALSE(block_store_prefetch(bs, 65535, 2));
+        ASSERT_FALSE(block_store_prefetch(NULL, 0, 1));
+        block_store_destroy(bs);
+    }
+    // READAHEAD 2
+    const fs_backend_t backends[] = {FS_BACKEND_MMAP, FS_BACKEND_PREAD, FS_BACKEND_URING};
+    vector<uint8_t> data(400 * 1024 + 77), back(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 11 + i / 512);
+    }
+    for (fs_backend_t backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend;
+        options.readahead = true;
+        F17FS_t *fs = fs_format_with("k_tests_readahead.F17FS", &options);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], data.size()), (ssize_t) data.size());
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+        for (size_t done = 0; done < data.size(); done += 3000) {
+            const size_t n = data.size() - done < 3000 ? data.size() - done : 3000;
+            ASSERT_EQ(fs_read(fs, fd, &back[done], n), (ssize_t) n);
+        }
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_seek(fs, fd, 1000, FS_SEEK_SET), 1000);
+        std::fill(back.begin(), back.end(), 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], 10), 10);
+        ASSERT_EQ(fs_read(fs, fd, &back[10], 200 * 1024), 200 * 1024);
+        ASSERT_EQ(memcmp(&data[1000], &back[0], 200 * 1024 + 10), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+}
+
+TEST(k_tests, advise) {
+    // ADVISE 1
+    const fs_backend_t backends[] = {FS_BACKEND_MMAP, FS_BACKEND_PREAD, FS_BACKEND_DIRECT};
+    vector<uint8_t> data(300 * 1024 + 5), back(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 7 + i / 512);
+    }
+    for (fs_backend_t backend : backends) {
+        fs_options_t options = {};
+        options.backend = backend;
+        F17FS_t *fs = fs_format_with("k_tests_advise.F17FS", &options);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_advise(fs, fd, 0, 0, FS_ADVICE_NOREUSE), 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], data.size()), (ssize_t) data.size());
+        const fs_advice_t advices[] = {FS_ADVICE_SEQUENTIAL, FS_ADVICE_RANDOM, FS_ADVICE_WILLNEED,
+                                       FS_ADVICE_DONTNEED, FS_ADVICE_NOREUSE, FS_ADVICE_NORMAL};
+        for (fs_advice_t advice : advices) {
+            ASSERT_EQ(fs_advise(fs, fd, 0, 0, advice), 0);
+            ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+            std::fill(back.begin(), back.end(), 0);
+            for (size_t done = 0; done < data.size(); done += 5000) {
+                const size_t n = data.size() - done < 5000 ? data.size() - done : 5000;
+                ASSERT_EQ(fs_read(fs, fd, &back[done], n), (ssize_t) n);
+            }
+            ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        }
+        // ranges past the end are cut off, the rest are errors
+        ASSERT_EQ(fs_advise(fs, fd, 1 << 30, 4096, FS_ADVICE_WILLNEED), 0);
+        ASSERT_EQ(fs_advise(fs, fd, 100, 1, FS_ADVICE_DONTNEED), 0);
+        ASSERT_LT(fs_advise(fs, fd, -1, 0, FS_ADVICE_WILLNEED), 0);
+        ASSERT_LT(fs_advise(fs, fd, 0, 0, (fs_advice_t) 42), 0);
+        ASSERT_LT(fs_advise(fs, fd + 1, 0, 0, FS_ADVICE_NORMAL), 0);
+        ASSERT_LT(fs_advise(NULL, fd, 0, 0, FS_ADVICE_NORMAL), 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+        fs = fs_mount_with("k_tests_advise.F17FS", &options);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        std::fill(back.begin(), back.end(), 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], data.size()), (ssize_t) data.size());
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+}
+
+TEST(k_tests, mapping) {
+    // MAPPING 1
+    const char *test_fname = "k_tests_mapping.F17FS";
+    vector<uint8_t> data(200 * 1024 + 9), back(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 13 + i / 512);
+    }
+    for (int mode = 0; mode < 8; ++mode) {
+        fs_options_t options = {};
+        options.map_populate = mode & 1;
+        options.map_hugepages = mode & 2;
+        options.map_lock = mode & 4;
+        F17FS_t *fs = fs_format_with(test_fname, &options);
+        if (fs == nullptr && options.map_lock) {
+            continue;  // no room under RLIMIT_MEMLOCK for the image
+        }
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], data.size()), (ssize_t) data.size());
+        ASSERT_EQ(fs_unmount(fs), 0);
+        fs = fs_mount_with(test_fname, &options);
+        ASSERT_NE(fs, nullptr);
+        fd = fs_open(fs, "/file");
+        ASSERT_GE(fd, 0);
+        std::fill(back.begin(), back.end(), 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) back.size());
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+    // MAPPING 2
+    fs_options_t options = {};
+    options.backend = FS_BACKEND_PREAD;
+    options.map_populate = true;
+    options.map_hugepages = true;
+    F17FS_t *fs = fs_mount_with(test_fname, &options);  // the mapping options don't apply, nothing changes
+    ASSERT_NE(fs, nullptr);
+    int fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+    std::fill(back.begin(), back.end(), 0);
+    ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) back.size());
+    ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, wide_blocks) {
+    // WIDE BLOCKS 1
+    const char *bs_fname = "k_tests_wide_blocks.bs";
+    block_store_options_t bs_options = {};
+    bs_options.blocks = 100000;
+    ASSERT_EQ(block_store_create_with(bs_fname, &bs_options), nullptr);  // not a multiple of 32 MB
+    bs_options.blocks = 131072;
+    block_store_t *bs = block_store_create_with(bs_fname, &bs_options);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_get_block_count(bs), (size_t) 131072);
+    ASSERT_EQ(block_store_get_free_blocks(bs), (size_t)(131072 - 32));  // the FBM takes the last 32
+    ASSERT_TRUE(block_store_request(bs, 100000));
+    ASSERT_TRUE(block_store_is_dirty(bs, 131040 + 100000 / 4096));
+    ASSERT_EQ(block_store_allocate_near(bs, 131000), (size_t) 131000);
+    ASSERT_EQ(block_store_allocate_near(bs, 131039), (size_t) 131039);
+    ASSERT_EQ(block_store_allocate_near(bs, 131039), (size_t) 0);  // wraps around at the FBM
+    block_store_destroy(bs);
+    bs_options = {};
+    bs_options.backend = BLOCK_STORE_PREAD;
+    bs = block_store_open_with(bs_fname, &bs_options);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_get_block_count(bs), (size_t) 131072);
+    ASSERT_TRUE(block_store_test(bs, 100000));
+    ASSERT_TRUE(block_store_test(bs, 131000));
+    ASSERT_FALSE(block_store_test(bs, 99999));
+    ASSERT_EQ(block_store_count_used_blocks(bs), (size_t)(32 + 4));
+    block_store_destroy(bs);
+
+    // WIDE BLOCKS 2
+    // with 32-bit ids a file tops out at 6 + 128 + 128 * 128 blocks, five of them don't fit below block 65536
+    const char *test_fname = "k_tests_wide_blocks.F17FS";
+    const size_t max_size = (6 + 128 + 128 * 128) * 512;
+    vector<uint8_t> data(max_size + 1000), back(max_size);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t)(i * 7 + i / 509);
+    }
+    fs_options_t options = {};
+    options.blocks = 131072;
+    F17FS_t *fs = fs_format_with(test_fname, &options);
+    ASSERT_NE(fs, nullptr);
+    const char *fnames[] = {"/a", "/b", "/c", "/d", "/e"};
+    for (int f = 0; f < 5; ++f) {
+        ASSERT_EQ(fs_create(fs, fnames[f], FS_REGULAR), 0);
+        int fd = fs_open(fs, fnames[f]);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[f], 1000), 1000);
+        ASSERT_EQ(fs_write(fs, fd, &data[f + 1000], data.size() - 1000 - f), (ssize_t)(max_size - 1000));
+        ASSERT_EQ(fs_write(fs, fd, &data[0], 1), 0);  // full
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+    bs = block_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_GT(block_store_get_used_blocks(bs), (size_t) 65536);
+    block_store_destroy(bs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    for (int f = 4; f >= 0; --f) {
+        int fd = fs_open(fs, fnames[f]);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_seek(fs, fd, 3000, FS_SEEK_SET), 3000);  // inside the direct blocks
+        ASSERT_EQ(fs_read(fs, fd, &back[0], 100), 100);
+        ASSERT_EQ(memcmp(&data[f + 3000], &back[0], 100), 0);
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+        std::fill(back.begin(), back.end(), 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) max_size);
+        ASSERT_EQ(memcmp(&data[f], &back[0], max_size), 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+    ASSERT_EQ(fs_remove(fs, "/e"), 0);
+    ASSERT_EQ(fs_create(fs, "/f", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/f");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, &data[0], max_size), (ssize_t) max_size);  // fits again in what /e gave back
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, block_sizes) {
+    // BLOCK SIZES 1
+    const char *bs_fname = "k_tests_block_sizes.bs";
+    block_store_options_t bs_options = {};
+    bs_options.block_size = 1000;
+    ASSERT_EQ(block_store_create_with(bs_fname, &bs_options), nullptr);  // not a power of two
+    bs_options.block_size = 131072;
+    ASSERT_EQ(block_store_create_with(bs_fname, &bs_options), nullptr);  // too big
+    bs_options.block_size = 4096;
+    bs_options.blocks = 8192;
+    block_store_t *bs = block_store_create_with(bs_fname, &bs_options);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_get_block_size(bs), (size_t) 4096);
+    ASSERT_EQ(block_store_get_free_blocks(bs), (size_t) 8191);  // one block holds all 8192 bits of the FBM
+    vector<uint8_t> block(4096, 0x5a);
+    ASSERT_EQ(block_store_write(bs, 8190, &block[0]), (size_t) 4096);
+    ASSERT_EQ(block_store_n_write(bs, 8189, 4000, &block[0], 96), (size_t) 96);
+    ASSERT_EQ(block_store_n_write(bs, 8189, 4000, &block[0], 97), (size_t) 0);  // past the end of the block
+    block_store_destroy(bs);
+    bs_options = {};
+    bs_options.backend = BLOCK_STORE_PREAD;
+    bs_options.block_size = 4096;
+    bs = block_store_open_with(bs_fname, &bs_options);
+    ASSERT_NE(bs, nullptr);
+    ASSERT_EQ(block_store_get_block_count(bs), (size_t) 8192);
+    ASSERT_EQ(block_store_get_used_blocks(bs), (size_t) 1);
+    std::fill(block.begin(), block.end(), 0);
+    ASSERT_EQ(block_store_read(bs, 8190, &block[0]), (size_t) 4096);
+    ASSERT_EQ(block[4095], 0x5a);
+    block_store_destroy(bs);
+
+    // BLOCK SIZES 2
+    // 4 KB blocks with 16-bit ids: 2048 ids per index table, 12 MB reaches the double indirect tables;
+    //  64 KB blocks in a 32 MB image: 10 MB is the direct blocks and part of the indirect table
+    const char *test_fname = "k_tests_block_sizes.F17FS";
+    const size_t block_sizes[] = {4096, 65536}, image_blocks[] = {0, 512}, file_sizes[] = {12 << 20, 10 << 20};
+    for (int b = 0; b < 2; ++b) {
+        vector<uint8_t> data(file_sizes[b]), back(file_sizes[b]);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = (uint8_t)(i * 13 + i / 4093 + b);
+        }
+        fs_options_t options = {};
+        options.block_size = block_sizes[b];
+        options.blocks = image_blocks[b];
+        F17FS_t *fs = fs_format_with(test_fname, &options);
+        ASSERT_NE(fs, nullptr);
+        ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+        ASSERT_EQ(fs_create(fs, "/dir/file", FS_REGULAR), 0);
+        int fd = fs_open(fs, "/dir/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], 777), 777);
+        ASSERT_EQ(fs_write(fs, fd, &data[777], data.size() - 777), (ssize_t)(data.size() - 777));
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        fs = fs_mount(test_fname);  // the block size comes from the image
+        ASSERT_NE(fs, nullptr);
+        dyn_array_t *records = fs_get_dir(fs, "/dir");
+        ASSERT_NE(records, nullptr);
+        ASSERT_EQ(dyn_array_size(records), (size_t) 1);
+        dyn_array_destroy(records);
+        fd = fs_open(fs, "/dir/file");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_seek(fs, fd, block_sizes[b] * 6 + 5, FS_SEEK_SET), (off_t)(block_sizes[b] * 6 + 5));  // first indirect block
+        ASSERT_EQ(fs_read(fs, fd, &back[0], 100), 100);
+        ASSERT_EQ(memcmp(&data[block_sizes[b] * 6 + 5], &back[0], 100), 0);
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t) data.size());
+        ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+        std::fill(back.begin(), back.end(), 0);
+        ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) data.size());
+        ASSERT_EQ(memcmp(&data[0], &back[0], data.size()), 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_remove(fs, "/dir/file"), 0);
+        ASSERT_EQ(fs_remove(fs, "/dir"), 0);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+}
+
+TEST(k_tests, superblock) {
+    // SUPERBLOCK 1
+    const char *test_fname = "k_tests_superblock.F17FS", *copy_fname = "k_tests_superblock_copy.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fs_info_t info;
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_EQ(info.block_size, (size_t) 512);
+    ASSERT_EQ(info.blocks, (size_t) 65536);
+    ASSERT_EQ(info.free_blocks, (size_t)(65536 - 16 - 33 - 1));  // FBM, inode bitmap and table, root directory
+    ASSERT_EQ(info.inodes, (size_t) 256);
+    ASSERT_EQ(info.free_inodes, (size_t) 255);
+    ASSERT_EQ(info.features, (uint32_t) 0);
+    ASSERT_FALSE(info.mounted_clean);
+    ASSERT_EQ(info.mount_count, (size_t) 1);
+    vector<uint8_t> data(10000, 0x3D);
+    ASSERT_EQ(fs_create(fs, "/file", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, &data[0], data.size()), (ssize_t) data.size());
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    const size_t free_blocks = info.free_blocks;
+    ASSERT_EQ(free_blocks, (size_t)(65536 - 16 - 33 - 1 - 21));  // 20 data blocks and an index table
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // the counts come from the superblock
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_TRUE(info.mounted_clean);
+    ASSERT_EQ(info.mount_count, (size_t) 2);
+    ASSERT_EQ(info.free_blocks, free_blocks);
+    ASSERT_EQ(info.free_inodes, (size_t) 254);
+
+    // SUPERBLOCK 2
+    // a copy taken while mounted looks like a crash: it mounts, recounting
+    FILE *in = fopen(test_fname, "rb"), *out = fopen(copy_fname, "wb");
+    ASSERT_NE(in, nullptr);
+    ASSERT_NE(out, nullptr);
+    vector<char> chunk(1 << 20);
+    size_t got;
+    while ((got = fread(&chunk[0], 1, chunk.size(), in)) > 0) {
+        ASSERT_EQ(fwrite(&chunk[0], 1, got, out), got);
+    }
+    fclose(in);
+    fclose(out);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(copy_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_FALSE(info.mounted_clean);
+    ASSERT_EQ(info.mount_count, (size_t) 3);
+    ASSERT_EQ(info.free_blocks, free_blocks);
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // SUPERBLOCK 3
+    // an image from before superblocks mounts with the legacy geometry and gets one
+    block_store_t *bs = block_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    vector<uint8_t> zeros(256, 0);
+    ASSERT_EQ(block_store_n_write(bs, 0, 256, &zeros[0], zeros.size()), zeros.size());
+    block_store_destroy(bs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_FALSE(info.mounted_clean);
+    ASSERT_EQ(info.mount_count, (size_t) 1);
+    ASSERT_EQ(info.free_blocks, free_blocks);
+    fd = fs_open(fs, "/file");
+    ASSERT_GE(fd, 0);
+    vector<uint8_t> back(data.size());
+    ASSERT_EQ(fs_read(fs, fd, &back[0], back.size()), (ssize_t) back.size());
+    ASSERT_EQ(back, data);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_TRUE(info.mounted_clean);
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // SUPERBLOCK 4
+    // feature bits this code doesn't know keep the image from mounting (features are 8 bytes into the superblock)
+    bs = block_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    const uint32_t unknown = 0x80000000;
+    ASSERT_EQ(block_store_n_write(bs, 0, 256 + 8, &unknown, sizeof(unknown)), sizeof(unknown));
+    block_store_destroy(bs);
+    ASSERT_EQ(fs_mount(test_fname), nullptr);
+}
+
+TEST(k_tests, many_inodes) {
+    // MANY_INODES 1
+    // directories hold 7 entries: 7 + 49 directories and 343 files take the 256 inodes of the table and
+    //  144 of the inode file, 18 blocks of it. With 16-bit and with 32-bit block ids
+    const char *test_fname = "k_tests_many_inodes.F17FS";
+    const size_t image_blocks[] = {0, 131072};
+    for (int b = 0; b < 2; ++b) {
+        fs_options_t options = {};
+        options.blocks = image_blocks[b];
+        F17FS_t *fs = fs_format_with(test_fname, &options);
+        ASSERT_NE(fs, nullptr);
+        vector<string> files;
+        char path[16];
+        for (int i = 0; i < 7; ++i) {
+            snprintf(path, sizeof(path), "/%d", i);
+            ASSERT_EQ(fs_create(fs, path, FS_DIRECTORY), 0);
+            for (int j = 0; j < 7; ++j) {
+                snprintf(path, sizeof(path), "/%d/%d", i, j);
+                ASSERT_EQ(fs_create(fs, path, FS_DIRECTORY), 0);
+                for (int k = 0; k < 7; ++k) {
+                    snprintf(path, sizeof(path), "/%d/%d/%d", i, j, k);
+                    ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+                    files.push_back(path);
+                }
+            }
+        }
+        for (size_t i = 0; i < files.size(); ++i) {
+            int fd = fs_open(fs, files[i].c_str());
+            ASSERT_GE(fd, 0);
+            ASSERT_EQ(fs_write(fs, fd, &i, sizeof(i)), (ssize_t) sizeof(i));
+            ASSERT_EQ(fs_close(fs, fd), 0);
+        }
+        fs_info_t info;
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_EQ(info.inodes, (size_t) 400);
+        ASSERT_EQ(info.free_inodes, (size_t) 0);
+        ASSERT_EQ(info.features & FS_FEATURE_INODE_FILE, (uint32_t) FS_FEATURE_INODE_FILE);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        // MANY_INODES 2
+        // they survive a remount, freed ones are reused before the inode file grows
+        fs = fs_mount(test_fname);
+        ASSERT_NE(fs, nullptr);
+        for (size_t i = 0; i < files.size(); ++i) {
+            int fd = fs_open(fs, files[i].c_str());
+            ASSERT_GE(fd, 0);
+            size_t back = SIZE_MAX;
+            ASSERT_EQ(fs_read(fs, fd, &back, sizeof(back)), (ssize_t) sizeof(back));
+            ASSERT_EQ(back, i);
+            ASSERT_EQ(fs_close(fs, fd), 0);
+        }
+        dyn_array_t *records = fs_get_dir(fs, "/6/6");
+        ASSERT_NE(records, nullptr);
+        ASSERT_EQ(dyn_array_size(records), (size_t) 7);
+        dyn_array_destroy(records);
+        for (size_t i = files.size() - 10; i < files.size(); ++i) {
+            ASSERT_EQ(fs_remove(fs, files[i].c_str()), 0);
+        }
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_EQ(info.free_inodes, (size_t) 10);
+        ASSERT_EQ(fs_move(fs, "/6/5/0", "/6/6/0"), 0);
+        int fd = fs_open(fs, "/6/6/0");
+        ASSERT_GE(fd, 0);
+        size_t back = SIZE_MAX;
+        ASSERT_EQ(fs_read(fs, fd, &back, sizeof(back)), (ssize_t) sizeof(back));
+        ASSERT_EQ(back, files.size() - 14);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_move(fs, "/6/6/0", "/6/5/0"), 0);
+        for (size_t i = files.size() - 10; i < files.size(); ++i) {
+            ASSERT_EQ(fs_create(fs, files[i].c_str(), FS_REGULAR), 0);
+        }
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_EQ(info.inodes, (size_t) 400);
+        ASSERT_EQ(info.free_inodes, (size_t) 0);
+        ASSERT_EQ(fs_create(fs, "/6/6/x", FS_REGULAR), 0);  // an eighth entry, the directory becomes hashed
+        ASSERT_GE(fs_open(fs, "/6/6/x"), 0);
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_NE(info.features & FS_FEATURE_HASHED_DIRS, 0u);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+}
+
+TEST(k_tests, hashed_directories) {
+    // HASHED_DIRECTORIES 1
+    // thousands of entries in one directory, with 512 and 4096-byte blocks. Names that are prefixes of
+    //  others ("f1", "f10", "f100") each find their own file
+    const char *test_fname = "k_tests_hashed_directories.F17FS";
+    const size_t block_sizes[] = {0, 4096};
+    const int count = 3000;
+    for (int b = 0; b < 2; ++b) {
+        fs_options_t options = {};
+        options.block_size = block_sizes[b];
+        F17FS_t *fs = fs_format_with(test_fname, &options);
+        ASSERT_NE(fs, nullptr);
+        fs_info_t empty;
+        ASSERT_EQ(fs_get_info(fs, &empty), 0);
+        ASSERT_EQ(empty.features & FS_FEATURE_HASHED_DIRS, 0u);
+        ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+        ASSERT_EQ(fs_create(fs, "/small", FS_DIRECTORY), 0);
+        char path[32];
+        for (int i = 0; i < count; ++i) {
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            ASSERT_EQ(fs_create(fs, path, i % 100 == 0 ? FS_DIRECTORY : FS_REGULAR), 0);
+            if (i % 100 != 0) {
+                int fd = fs_open(fs, path);
+                ASSERT_GE(fd, 0);
+                ASSERT_EQ(fs_write(fs, fd, &i, sizeof(i)), (ssize_t) sizeof(i));
+                ASSERT_EQ(fs_close(fs, fd), 0);
+            }
+        }
+        ASSERT_LT(fs_create(fs, "/big/f42", FS_REGULAR), 0);
+        fs_info_t info;
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_NE(info.features & FS_FEATURE_HASHED_DIRS, 0u);
+        dyn_array_t *records = fs_get_dir(fs, "/big");
+        ASSERT_NE(records, nullptr);
+        ASSERT_EQ(dyn_array_size(records), (size_t) count);
+        vector<bool> seen(count, false);
+        for (size_t r = 0; r < dyn_array_size(records); ++r) {
+            file_record_t *record = (file_record_t *) dyn_array_at(records, r);
+            int i = atoi(record->name + 1);
+            ASSERT_EQ(record->name[0], 'f');
+            ASSERT_FALSE(seen[i]);
+            seen[i] = true;
+            ASSERT_EQ(record->type, i % 100 == 0 ? FS_DIRECTORY : FS_REGULAR);
+        }
+        dyn_array_destroy(records);
+        ASSERT_EQ(fs_unmount(fs), 0);
+
+        // HASHED_DIRECTORIES 2
+        // after a remount every name finds its file, removed names are gone and come back
+        fs = fs_mount(test_fname);
+        ASSERT_NE(fs, nullptr);
+        for (int i = 0; i < count; ++i) {
+            if (i % 100 == 0) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            int fd = fs_open(fs, path);
+            ASSERT_GE(fd, 0);
+            int back = -1;
+            ASSERT_EQ(fs_read(fs, fd, &back, sizeof(back)), (ssize_t) sizeof(back));
+            ASSERT_EQ(back, i);
+            ASSERT_EQ(fs_close(fs, fd), 0);
+        }
+        ASSERT_EQ(fs_remove(fs, "/big"), -5);  // not empty
+        for (int i = 0; i < count; i += 2) {
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            ASSERT_EQ(fs_remove(fs, path), 0);
+            ASSERT_LT(fs_open(fs, path), 0);
+        }
+        records = fs_get_dir(fs, "/big");
+        ASSERT_NE(records, nullptr);
+        ASSERT_EQ(dyn_array_size(records), (size_t) count / 2);
+        dyn_array_destroy(records);
+        for (int i = 0; i < count; i += 2) {
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+        }
+
+        // HASHED_DIRECTORIES 3
+        // moves and links between a hashed and a small directory
+        ASSERT_EQ(fs_move(fs, "/big/f7", "/small/f7"), 0);
+        ASSERT_LT(fs_open(fs, "/big/f7"), 0);
+        ASSERT_EQ(fs_move(fs, "/small/f7", "/big/g7"), 0);
+        ASSERT_EQ(fs_link(fs, "/big/f9", "/small/f9"), 0);
+        ASSERT_EQ(fs_remove(fs, "/big/f9"), 0);
+        int fd = fs_open(fs, "/big/g7");
+        ASSERT_GE(fd, 0);
+        int back = -1;
+        ASSERT_EQ(fs_read(fs, fd, &back, sizeof(back)), (ssize_t) sizeof(back));
+        ASSERT_EQ(back, 7);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        fd = fs_open(fs, "/small/f9");
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_read(fs, fd, &back, sizeof(back)), (ssize_t) sizeof(back));
+        ASSERT_EQ(back, 9);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_remove(fs, "/small/f9"), 0);
+
+        // HASHED_DIRECTORIES 4
+        // emptied, the directory is removed with all its blocks
+        ASSERT_EQ(fs_remove(fs, "/big/g7"), 0);
+        for (int i = 0; i < count; ++i) {
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            if (i != 7 && i != 9) {
+                ASSERT_EQ(fs_remove(fs, path), 0);
+            }
+        }
+        ASSERT_EQ(fs_remove(fs, "/big"), 0);
+        ASSERT_EQ(fs_remove(fs, "/small"), 0);
+        ASSERT_EQ(fs_get_info(fs, &empty), 0);
+        ASSERT_EQ(empty.free_inodes, empty.inodes - 1);
+        // the inode file keeps its size, a second round gives back exactly what it takes
+        ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+        for (int i = 0; i < count; ++i) {
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+        }
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_EQ(info.inodes, empty.inodes);
+        ASSERT_LT(info.free_blocks, empty.free_blocks);
+        for (int i = count - 1; i >= 0; --i) {
+            snprintf(path, sizeof(path), "/big/f%d", i);
+            ASSERT_EQ(fs_remove(fs, path), 0);
+        }
+        ASSERT_EQ(fs_remove(fs, "/big"), 0);
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        ASSERT_EQ(info.free_blocks, empty.free_blocks);
+        ASSERT_EQ(info.free_inodes, empty.free_inodes);
+        ASSERT_EQ(fs_unmount(fs), 0);
+    }
+
+    // HASHED_DIRECTORIES 6
+    // in images from before superblocks the flags of an inode were owner[0], which nothing set: with its
+    //  bits on, directories are still small ones, before and after another one becomes hashed
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/a", FS_DIRECTORY), 0);  // inode 1
+    ASSERT_EQ(fs_create(fs, "/b", FS_DIRECTORY), 0);  // inode 2
+    ASSERT_EQ(fs_create(fs, "/a/f", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/b/f", FS_REGULAR), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    block_store_t *bs = block_store_open(test_fname);
+    ASSERT_NE(bs, nullptr);
+    vector<uint8_t> zeros(256, 0);
+    ASSERT_EQ(block_store_n_write(bs, 0, 256, &zeros[0], zeros.size()), zeros.size());
+    const uint8_t garbage = 0xFF;
+    for (size_t inode = 0; inode < 4; ++inode) {  // 64-byte inodes from block 1, owner[0] is byte 1
+        ASSERT_EQ(block_store_n_write(bs, 1, inode * 64 + 1, &garbage, 1), (size_t) 1);
+    }
+    block_store_destroy(bs);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    char path[32];
+    for (const char *dir : {"/a", "/b"}) {
+        snprintf(path, sizeof(path), "%s/f", dir);
+        int fd = fs_open(fs, path);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+    for (int i = 0; i < 20; ++i) {
+        snprintf(path, sizeof(path), "/a/g%d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    fs_info_t info;
+    ASSERT_EQ(fs_get_info(fs, &info), 0);
+    ASSERT_NE(info.features & FS_FEATURE_HASHED_DIRS, 0u);
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    for (int i = 0; i < 6; ++i) {
+        snprintf(path, sizeof(path), "/b/g%d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    for (const char *dir : {"/a", "/b"}) {
+        snprintf(path, sizeof(path), "%s/f", dir);
+        int fd = fs_open(fs, path);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        dyn_array_t *records = fs_get_dir(fs, dir);
+        ASSERT_NE(records, nullptr);
+        ASSERT_EQ(dyn_array_size(records), (size_t)(dir[1] == 'a' ? 21 : 7));
+        dyn_array_destroy(records);
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // HASHED_DIRECTORIES 7
+    // out of space in the middle of growing the index: links to a few files (no inodes needed) on a full
+    //  image, a block given back each time one fails. When a split needs more slots than there are blocks
+    //  (the root splitting too) the link fails and every name there already is still there
+    fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+    char target[16];
+    for (int i = 0; i < 4; ++i) {  // 254 links to each at most
+        snprintf(target, sizeof(target), "/target%d", i);
+        ASSERT_EQ(fs_create(fs, target, FS_REGULAR), 0);
+    }
+    vector<uint8_t> data(512, 0x5A);
+    const int spares = 150;
+    for (int i = 0; i < spares; ++i) {
+        snprintf(path, sizeof(path), "/spare%d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+        int fd = fs_open(fs, path);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_write(fs, fd, &data[0], data.size()), (ssize_t) data.size());
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+    ASSERT_EQ(fs_create(fs, "/filler", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/filler");
+    ASSERT_GE(fd, 0);
+    while (fs_write(fs, fd, &data[0], data.size()) == (ssize_t) data.size()) {
+    }
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    int linked = 0, spare = 0;
+    bool short_of_slots = false;
+    while (spare < spares) {  // 7 names to a leaf at most, 62 leaves to an index node
+        snprintf(path, sizeof(path), "/big/link%d", linked);
+        snprintf(target, sizeof(target), "/target%d", linked / 250);
+        if (fs_link(fs, target, path) == 0) {
+            ++linked;
+            continue;
+        }
+        ASSERT_LT(fs_open(fs, path), 0);
+        ASSERT_EQ(fs_get_info(fs, &info), 0);
+        short_of_slots |= info.free_blocks > 0;
+        snprintf(path, sizeof(path), "/spare%d", spare++);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    ASSERT_TRUE(short_of_slots);
+    ASSERT_GT(linked, 7 * 62);  // more leaves than the root indexes, it has split
+    dyn_array_t *records = fs_get_dir(fs, "/big");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), (size_t) linked);
+    dyn_array_destroy(records);
+    for (int i = 0; i < linked; ++i) {
+        snprintf(path, sizeof(path), "/big/link%d", i);
+        fd = fs_open(fs, path);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, dentry_cache) {
+    // DENTRY_CACHE 1
+    // names looked up before they exist, after they're gone, moved, linked, and replaced by a file of
+    //  another type, in a small directory and in a hashed one
+    const char *test_fname = "k_tests_dentry_cache.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/small", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/hashed", FS_DIRECTORY), 0);
+    char path[32];
+    for (int i = 0; i < 20; ++i) {
+        snprintf(path, sizeof(path), "/hashed/h%d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    const char *dirs[] = {"/small", "/hashed"};
+    for (const char *dir : dirs) {
+        string name = string(dir) + "/name", other = string(dir) + "/other";
+        ASSERT_LT(fs_open(fs, name.c_str()), 0);
+        ASSERT_LT(fs_open(fs, name.c_str()), 0);
+        ASSERT_EQ(fs_create(fs, name.c_str(), FS_DIRECTORY), 0);
+        ASSERT_EQ(fs_create(fs, (name + "/child").c_str(), FS_REGULAR), 0);
+        ASSERT_EQ(fs_create(fs, name.c_str(), FS_REGULAR), -7);
+        ASSERT_EQ(fs_remove(fs, name.c_str()), -5);
+        ASSERT_EQ(fs_remove(fs, (name + "/child").c_str()), 0);
+        ASSERT_LT(fs_open(fs, (name + "/child").c_str()), 0);
+        ASSERT_EQ(fs_remove(fs, name.c_str()), 0);
+        // the same name as a file now: nothing can be created under it
+        ASSERT_EQ(fs_create(fs, name.c_str(), FS_REGULAR), 0);
+        ASSERT_LT(fs_create(fs, (name + "/child").c_str(), FS_REGULAR), 0);
+        int fd = fs_open(fs, name.c_str());
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_move(fs, name.c_str(), other.c_str()), 0);
+        ASSERT_LT(fs_open(fs, name.c_str()), 0);
+        fd = fs_open(fs, other.c_str());
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_link(fs, other.c_str(), name.c_str()), 0);
+        fd = fs_open(fs, name.c_str());
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+        ASSERT_EQ(fs_remove(fs, other.c_str()), 0);
+        ASSERT_EQ(fs_remove(fs, name.c_str()), 0);
+        ASSERT_LT(fs_open(fs, name.c_str()), 0);
+        ASSERT_LT(fs_open(fs, other.c_str()), 0);
+    }
+    // a directory removed and made again (its inode reused) starts out empty
+    ASSERT_EQ(fs_create(fs, "/small/d", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/small/d/f", FS_REGULAR), 0);
+    int fd = fs_open(fs, "/small/d/f");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_remove(fs, "/small/d/f"), 0);
+    ASSERT_EQ(fs_remove(fs, "/small/d"), 0);
+    ASSERT_EQ(fs_create(fs, "/small/e", FS_DIRECTORY), 0);
+    ASSERT_LT(fs_open(fs, "/small/e/f"), 0);
+    ASSERT_LT(fs_open(fs, "/small/d/f"), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+
+    // DENTRY_CACHE 2
+    // a deep path opened over and over
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    string deep;
+    for (int i = 0; i < 16; ++i) {
+        deep += "/level" + std::to_string(i);
+        ASSERT_EQ(fs_create(fs, deep.c_str(), FS_DIRECTORY), 0);
+    }
+    deep += "/file";
+    ASSERT_EQ(fs_create(fs, deep.c_str(), FS_REGULAR), 0);
+    for (int i = 0; i < 1000; ++i) {
+        fd = fs_open(fs, deep.c_str());
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(fs_close(fs, fd), 0);
+    }
+    ASSERT_EQ(fs_move(fs, "/level0", "/small/moved"), 0);
+    ASSERT_LT(fs_open(fs, deep.c_str()), 0);
+    fd = fs_open(fs, ("/small/moved" + deep.substr(strlen("/level0"))).c_str());
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, path_walk) {
+    // PATH_WALK 1
+    // slashes in a row count as one, a trailing one is fine where a directory is meant
+    const char *test_fname = "k_tests_path_walk.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/a", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "//a///b", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/a/b//file", FS_REGULAR), 0);
+    int fd = fs_open(fs, "///a/b/file");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    dyn_array_t *records = fs_get_dir(fs, "/a/b/");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), (size_t) 1);
+    dyn_array_destroy(records);
+    records = fs_get_dir(fs, "/");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), (size_t) 1);
+    dyn_array_destroy(records);
+
+    // PATH_WALK 2
+    // through a file, through a name that isn't there, too long a name along the way or at the end
+    ASSERT_EQ(fs_create(fs, "/a/b/file/x", FS_REGULAR), -6);
+    ASSERT_EQ(fs_create(fs, "/a/c/x", FS_REGULAR), -6);
+    ASSERT_EQ(fs_open(fs, "/a/b/file/x"), -5);
+    ASSERT_EQ(fs_open(fs, "/a/b/x"), -6);
+    ASSERT_EQ(fs_open(fs, "/a/b"), -8);
+    ASSERT_EQ(fs_get_dir(fs, "/a/b/file"), nullptr);
+    string name(FS_FNAME_MAX, 'n');
+    ASSERT_EQ(fs_create(fs, ("/a/" + name).c_str(), FS_REGULAR), -5);
+    ASSERT_EQ(fs_create(fs, ("/a/" + name + "/x").c_str(), FS_REGULAR), -6);
+    ASSERT_EQ(fs_open(fs, ("/a/" + name).c_str()), -4);
+    name.resize(FS_FNAME_MAX - 1);
+    ASSERT_EQ(fs_create(fs, ("/a/" + name).c_str(), FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, ("/a/" + name + "/x").c_str(), FS_REGULAR), 0);
+    ASSERT_EQ(fs_move(fs, ("/a/" + name + "/x").c_str(), ("/a/" + name + "n").c_str()), -4);
+    ASSERT_EQ(fs_remove(fs, "/"), -4);
+    ASSERT_EQ(fs_remove(fs, "/a/b/file/x"), -3);
+    ASSERT_EQ(fs_remove(fs, "/a//b/file"), 0);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, directory_handles) {
+    // DIRECTORY_HANDLES 1
+    // create, open, list and remove relative to a handle, relative paths of more than one name
+    //  and absolute ones too
+    const char *test_fname = "k_tests_directory_handles.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/a", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/a/b", FS_DIRECTORY), 0);
+    int dh = fs_opendir_handle(fs, "/a/b");
+    ASSERT_GE(dh, 0);
+    int root = fs_opendir_handle(fs, "/");
+    ASSERT_GE(root, 0);
+    ASSERT_NE(root, dh);
+    char name[16];
+    for (int i = 0; i < 20; ++i) {
+        snprintf(name, sizeof(name), "f%d", i);
+        ASSERT_EQ(fs_createat(fs, dh, name, FS_REGULAR), 0);
+    }
+    ASSERT_EQ(fs_createat(fs, dh, "f3", FS_REGULAR), -7);
+    ASSERT_EQ(fs_createat(fs, dh, "sub", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_createat(fs, dh, "sub/x", FS_REGULAR), 0);
+    ASSERT_EQ(fs_createat(fs, root, "a/top", FS_REGULAR), 0);
+    ASSERT_EQ(fs_createat(fs, dh, "/a/abs", FS_REGULAR), 0);
+    int fd = fs_openat(fs, dh, "f7");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_write(fs, fd, "seven", 5), 5);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    fd = fs_open(fs, "/a/b/f7");
+    ASSERT_GE(fd, 0);
+    char back[8] = {};
+    ASSERT_EQ(fs_read(fs, fd, back, 5), 5);
+    ASSERT_STREQ(back, "seven");
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    fd = fs_openat(fs, dh, "sub/x");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_openat(fs, dh, "missing"), -6);
+    ASSERT_EQ(fs_openat(fs, dh, "sub"), -8);
+    dyn_array_t *records = fs_get_dirat(fs, dh, "");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), (size_t) 21);
+    dyn_array_destroy(records);
+    records = fs_get_dirat(fs, root, "a");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), (size_t) 3);
+    dyn_array_destroy(records);
+    ASSERT_EQ(fs_removeat(fs, dh, "f7"), 0);
+    ASSERT_LT(fs_open(fs, "/a/b/f7"), 0);
+    ASSERT_EQ(fs_removeat(fs, dh, "sub"), -5);
+    ASSERT_EQ(fs_removeat(fs, dh, "sub/x"), 0);
+    ASSERT_EQ(fs_removeat(fs, dh, "sub"), 0);
+
+    // DIRECTORY_HANDLES 2
+    // the handle follows its directory through a move, and is closed when it is removed
+    ASSERT_EQ(fs_move(fs, "/a/b", "/moved"), 0);
+    fd = fs_openat(fs, dh, "f8");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    for (int i = 0; i < 20; ++i) {
+        snprintf(name, sizeof(name), "f%d", i);
+        if (i != 7) {
+            ASSERT_EQ(fs_removeat(fs, dh, name), 0);
+        }
+    }
+    ASSERT_EQ(fs_remove(fs, "/moved"), 0);
+    ASSERT_EQ(fs_createat(fs, dh, "late", FS_REGULAR), -1);
+    ASSERT_EQ(fs_get_dirat(fs, dh, ""), nullptr);
+    ASSERT_EQ(fs_closedir_handle(fs, dh), -1);
+
+    // DIRECTORY_HANDLES 3
+    // errors: not a directory, no such directory, bad handles, all handles in use
+    ASSERT_EQ(fs_opendir_handle(fs, "/a/top"), -2);
+    ASSERT_EQ(fs_opendir_handle(fs, "/nothere"), -2);
+    ASSERT_EQ(fs_opendir_handle(fs, "a"), -1);
+    ASSERT_EQ(fs_opendir_handle(NULL, "/a"), -1);
+    ASSERT_EQ(fs_openat(fs, -1, "f1"), -1);
+    ASSERT_EQ(fs_openat(fs, 4096, "f1"), -1);
+    ASSERT_EQ(fs_openat(fs, root, ""), -1);
+    ASSERT_EQ(fs_createat(NULL, root, "x", FS_REGULAR), -1);
+    vector<int> handles;
+    int h;
+    while ((h = fs_opendir_handle(fs, "/a")) >= 0) {
+        handles.push_back(h);
+    }
+    ASSERT_EQ(h, -3);
+    ASSERT_EQ(handles.size(), (size_t) 255);
+    for (int opened : handles) {
+        ASSERT_EQ(fs_closedir_handle(fs, opened), 0);
+    }
+    ASSERT_EQ(fs_closedir_handle(fs, root), 0);
+    ASSERT_EQ(fs_closedir_handle(fs, root), -1);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, readdir) {
+    // READDIR 1
+    // a small directory and a hashed one listed a few records at a time, types included
+    const char *test_fname = "k_tests_readdir.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/small", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/small/d", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/small/f", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+    const int count = 1000;
+    char path[32];
+    for (int i = 0; i < count; ++i) {
+        snprintf(path, sizeof(path), "/big/e%d", i);
+        ASSERT_EQ(fs_create(fs, path, i % 3 == 0 ? FS_DIRECTORY : FS_REGULAR), 0);
+    }
+    fs_dir_t dir;
+    file_record_t records[7];
+    ASSERT_EQ(fs_opendir(fs, "/small", &dir), 0);
+    ASSERT_EQ(fs_readdir(fs, &dir, records, 1), 1);
+    ASSERT_EQ(fs_readdir(fs, &dir, records + 1, 7), 1);
+    ASSERT_EQ(fs_readdir(fs, &dir, records, 7), 0);
+    ASSERT_EQ(fs_readdir(fs, &dir, records, 7), 0);
+    ASSERT_EQ(fs_closedir(fs, &dir), 0);
+    if (strcmp(records[0].name, "d") != 0) {
+        std::swap(records[0], records[1]);
+    }
+    ASSERT_STREQ(records[0].name, "d");
+    ASSERT_EQ(records[0].type, FS_DIRECTORY);
+    ASSERT_STREQ(records[1].name, "f");
+    ASSERT_EQ(records[1].type, FS_REGULAR);
+
+    vector<int> seen(count, 0);
+    ASSERT_EQ(fs_opendir(fs, "/big", &dir), 0);
+    ssize_t filled;
+    size_t listed = 0;
+    while ((filled = fs_readdir(fs, &dir, records, 7)) > 0) {
+        for (ssize_t r = 0; r < filled; ++r) {
+            int i = atoi(records[r].name + 1);
+            ASSERT_EQ(records[r].type, i % 3 == 0 ? FS_DIRECTORY : FS_REGULAR);
+            seen[i]++;
+            listed++;
+        }
+    }
+    ASSERT_EQ(filled, 0);
+    ASSERT_EQ(listed, (size_t) count);
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(seen[i], 1);
+    }
+    ASSERT_EQ(fs_closedir(fs, &dir), 0);
+    ASSERT_EQ(fs_closedir(fs, &dir), -1);
+
+    // READDIR 2
+    // a listing resumed from its cursor after the directory changed (leaves splitting): entries that
+    //  were there all along are listed once
+    std::fill(seen.begin(), seen.end(), 0);
+    ASSERT_EQ(fs_opendir(fs, "/big", &dir), 0);
+    for (listed = 0; listed < count / 2;) {
+        filled = fs_readdir(fs, &dir, records, 5);
+        ASSERT_GT(filled, 0);
+        for (ssize_t r = 0; r < filled; ++r) {
+            seen[atoi(records[r].name + 1)]++;
+        }
+        listed += filled;
+    }
+    uint64_t cursor = dir.cursor;
+    ASSERT_EQ(fs_closedir(fs, &dir), 0);
+    for (int i = 0; i < 2000; ++i) {
+        snprintf(path, sizeof(path), "/big/n%d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_opendir(fs, "/big", &dir), 0);
+    dir.cursor = cursor;
+    while ((filled = fs_readdir(fs, &dir, records, 7)) > 0) {
+        for (ssize_t r = 0; r < filled; ++r) {
+            if (records[r].name[0] == 'e') {
+                seen[atoi(records[r].name + 1)]++;
+            }
+        }
+    }
+    ASSERT_EQ(filled, 0);
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(seen[i], 1);
+    }
+    ASSERT_EQ(fs_closedir(fs, &dir), 0);
+
+    // READDIR 3
+    // errors: no such directory, a file, no room, a listing of a directory that was removed
+    ASSERT_LT(fs_opendir(fs, "/nothere", &dir), 0);
+    ASSERT_LT(fs_opendir(fs, "/big/e1", &dir), 0);
+    ASSERT_LT(fs_opendir(fs, "/big", NULL), 0);
+    ASSERT_EQ(fs_opendir(fs, "/small/d", &dir), 0);
+    ASSERT_EQ(fs_readdir(fs, &dir, NULL, 7), -1);
+    ASSERT_EQ(fs_readdir(fs, &dir, records, 0), 0);
+    ASSERT_EQ(fs_remove(fs, "/small/d"), 0);
+    ASSERT_EQ(fs_readdir(fs, &dir, records, 7), -1);
+    ASSERT_EQ(fs_closedir(fs, &dir), -1);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, name_fingerprints) {
+    // NAME_FINGERPRINTS 1
+    // names are matched whole, never as the prefix of a longer name, in small and hashed directories
+    const char *test_fname = "k_tests_name_fingerprints.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    ASSERT_EQ(fs_create(fs, "/small", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/small/ab", FS_REGULAR), 0);
+    ASSERT_EQ(fs_open(fs, "/small/a"), -6);
+    ASSERT_LT(fs_remove(fs, "/small/a"), 0);
+    ASSERT_EQ(fs_create(fs, "/small/a", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/small/a/x", FS_REGULAR), 0);
+    ASSERT_EQ(fs_open(fs, "/small/ab/x"), -5);
+    ASSERT_EQ(fs_create(fs, "/small/f10", FS_REGULAR), 0);
+    ASSERT_EQ(fs_create(fs, "/small/f1", FS_DIRECTORY), 0);
+    ASSERT_EQ(fs_create(fs, "/small/f1/y", FS_REGULAR), 0);
+    ASSERT_EQ(fs_open(fs, "/small/f10/y"), -5);
+    dyn_array_t *records = fs_get_dir(fs, "/small/f1");
+    ASSERT_NE(records, nullptr);
+    ASSERT_EQ(dyn_array_size(records), (size_t) 1);
+    dyn_array_destroy(records);
+    ASSERT_EQ(fs_remove(fs, "/small/f10"), 0);
+    int fd = fs_open(fs, "/small/f1/y");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_open(fs, "/small/f10"), -6);
+
+    ASSERT_EQ(fs_create(fs, "/big", FS_DIRECTORY), 0);
+    char path[32];
+    for (int i = 0; i < 200; ++i) {
+        snprintf(path, sizeof(path), "/big/f%d", i);
+        ASSERT_EQ(fs_create(fs, path, i < 10 ? FS_DIRECTORY : FS_REGULAR), 0);
+    }
+    for (int i = 0; i < 10; ++i) {
+        snprintf(path, sizeof(path), "/big/f%d/only", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+        snprintf(path, sizeof(path), "/big/f%d%d/only", i, i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), -6);
+    }
+    ASSERT_EQ(fs_open(fs, "/big/f"), -6);
+    ASSERT_EQ(fs_open(fs, "/big/f1000"), -6);
+
+    // NAME_FINGERPRINTS 2
+    // removed and created again, the names are still found, also once mounted again
+    for (int i = 10; i < 200; i += 2) {
+        snprintf(path, sizeof(path), "/big/f%d", i);
+        ASSERT_EQ(fs_remove(fs, path), 0);
+    }
+    for (int i = 10; i < 200; i += 4) {
+        snprintf(path, sizeof(path), "/big/f%d", i);
+        ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+    }
+    ASSERT_EQ(fs_unmount(fs), 0);
+    fs = fs_mount(test_fname);
+    ASSERT_NE(fs, nullptr);
+    for (int i = 10; i < 200; ++i) {
+        snprintf(path, sizeof(path), "/big/f%d", i);
+        fd = fs_open(fs, path);
+        if (i % 4 == 0) {
+            ASSERT_EQ(fd, -6);
+        } else {
+            ASSERT_GE(fd, 0);
+            ASSERT_EQ(fs_close(fs, fd), 0);
+        }
+    }
+    fd = fs_open(fs, "/small/ab");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(fs_close(fs, fd), 0);
+    ASSERT_EQ(fs_open(fs, "/small/a"), -8);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
+TEST(k_tests, remove_with_open_files) {
+    // REMOVE_WITH_OPEN_FILES 1
+    // a file removed while descriptors are open, to it and to another file: its own are closed, the
+    //  others stay open, its inode and blocks are free again
+    const char *test_fname = "k_tests_remove_with_open_files.F17FS";
+    F17FS_t *fs = fs_format(test_fname);
+    ASSERT_NE(fs, nullptr);
+    fs_info_t before, after;
+    ASSERT_EQ(fs_create(fs, "/keep", FS_REGULAR), 0);
+    ASSERT_EQ(fs_get_info(fs, &before), 0);
+    ASSERT_EQ(fs_create(fs, "/gone", FS_REGULAR), 0);
+    vector<uint8_t> data(5000, 0x42);
+    int gone = fs_open(fs, "/gone");
+    ASSERT_GE(gone, 0);
+    ASSERT_EQ(fs_write(fs, gone, &data[0], data.size()), (ssize_t) data.size());
+    int keep = fs_open(fs, "/keep");
+    ASSERT_GE(keep, 0);
+    ASSERT_EQ(fs_remove(fs, "/gone"), 0);
+    ASSERT_EQ(fs_open(fs, "/gone"), -6);
+    ASSERT_LT(fs_close(fs, gone), 0);
+    ASSERT_EQ(fs_get_info(fs, &after), 0);
+    ASSERT_EQ(after.free_inodes, before.free_inodes);
+    ASSERT_EQ(after.free_blocks, before.free_blocks);
+    ASSERT_EQ(fs_write(fs, keep, &data[0], 100), (ssize_t) 100);
+    ASSERT_EQ(fs_close(fs, keep), 0);
+
+    // REMOVE_WITH_OPEN_FILES 2
+    // the same with only an unrelated descriptor open, then with none
+    keep = fs_open(fs, "/keep");
+    ASSERT_GE(keep, 0);
+    ASSERT_EQ(fs_create(fs, "/gone", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/gone"), 0);
+    ASSERT_EQ(fs_close(fs, keep), 0);
+    ASSERT_EQ(fs_create(fs, "/gone", FS_REGULAR), 0);
+    ASSERT_EQ(fs_remove(fs, "/gone"), 0);
+    ASSERT_EQ(fs_get_info(fs, &after), 0);
+    ASSERT_EQ(after.free_inodes, before.free_inodes);
+    ASSERT_EQ(fs_unmount(fs), 0);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     ::testing::AddGlobalTestEnvironment(new GradeEnvironment);